@@ -0,0 +1,107 @@
+#include <iostream>
+#include <array>
+#include <vector>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <algorithm>
+
+#include "../include/particle.h"
+#include "../include/environment.h"
+
+// One Barnes-Hut setting and its measured cost and force errors
+struct TreeSetting {
+    std::string criterion;
+    float parameter;  // theta, or forceAccuracy for the relative criterion
+    int multipoleOrder;
+    int leafSize;
+    double seconds;
+    std::array<double, 4> errors;  // 50th, 90th and 99th percentiles and the maximum of the relative force error
+};
+
+// Force error against cost of the Barnes-Hut settings on a Plummer sphere (configs/plummer.yaml): the direct-summation
+// forces are computed once as the reference, then every combination of opening criterion and its parameter, multipole
+// order and leaf size, and the dual-tree walk over the same opening angles, is timed and compared with them. Each setting is evaluated once untimed first, which also gives
+// the relative criterion its previous accelerations. Settings on the Pareto frontier of time against the 99th-percentile error are listed
+// last. Usage: bench_barneshut [nParticles]
+int main(int argc, char* argv[]) {
+    int nParticles = argc > 1 ? std::stoi(argv[1]) : 1000;
+    std::map<std::string, std::map<std::string, std::string>> configMap = loadConfig("plummer.yaml");
+    ParticleCatalog sample = sampleParticles(configMap, nParticles, 1);
+    std::vector<std::shared_ptr<Particle>> particlePtrs;
+    for (int i = 0; i < nParticles; i++) {
+        particlePtrs.push_back(std::make_shared<Particle>(&sample.positions[i], &sample.velocities[i], sample.masses[i]));
+    }
+    // One thread throughout, so that the parallel walks compare with the serial one
+    GravitationalEnvironment<Particle> env(particlePtrs, false, "run", "Barnes-Hut");
+    env.applyGlobalConfig(configMap.at("global"));
+    env.applyGlobalConfig({{"nThreads", "1"}});
+    GravitationalEnvironment<Particle> dualTreeEnv(particlePtrs, false, "run", "dual-tree");
+    dualTreeEnv.applyGlobalConfig(configMap.at("global"));
+    dualTreeEnv.applyGlobalConfig({{"nThreads", "1"}});
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::array<float, 3>> reference = env.getForcesPairWise(0);
+    double directSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("N = %d, direct summation %.4f s\n\n", nParticles, directSeconds);
+
+    // Opening angles for the geometric and Salmon-Warren criteria, the geometric criterion on the compact tree layout
+    // and the dual-tree walk, force accuracies for the relative criterion
+    std::vector<std::pair<std::string, std::vector<float>>> criteria = {
+        {"geometric", {0.2f, 0.3f, 0.4f, 0.5f, 0.6f, 0.7f, 0.8f, 1.0f}},
+        {"salmon-warren", {0.2f, 0.3f, 0.4f, 0.5f, 0.6f, 0.7f, 0.8f, 1.0f}},
+        {"relative", {0.0005f, 0.001f, 0.0025f, 0.005f, 0.01f, 0.02f}},
+        {"compact", {0.2f, 0.3f, 0.4f, 0.5f, 0.6f, 0.7f, 0.8f, 1.0f}},
+        {"dual-tree", {0.1f, 0.2f, 0.3f, 0.4f, 0.5f, 0.6f, 0.7f}},
+    };
+    std::vector<TreeSetting> settings;
+    std::printf("%14s %9s %6s %5s %10s %11s %11s %11s %11s\n", "criterion", "parameter", "order", "leaf", "seconds", "p50", "p90", "p99", "max");
+    for (const auto& [criterion, parameters] : criteria) {
+        for (float parameter : parameters) {
+            for (int multipoleOrder : {0, 2}) {
+                for (int leafSize : {1, 8}) {
+                    GravitationalEnvironment<Particle>& treeEnv = criterion == "dual-tree" ? dualTreeEnv : env;
+                    std::string parameterKey = criterion == "relative" ? "forceAccuracy" : "theta";
+                    std::map<std::string, std::string> treeSettings = {{parameterKey, std::to_string(parameter)}, {"multipoleOrder", std::to_string(multipoleOrder)}, {"leafSize", std::to_string(leafSize)}};
+                    if (criterion == "compact") {
+                        treeSettings["openingCriterion"] = "geometric";
+                        treeSettings["treeLayout"] = "compact";
+                    } else if (criterion != "dual-tree") {
+                        treeSettings["openingCriterion"] = criterion;
+                        treeSettings["treeLayout"] = "pointer";
+                    }
+                    treeEnv.applyGlobalConfig(treeSettings);
+                    treeEnv.getForces(0);
+                    start = std::chrono::steady_clock::now();
+                    std::vector<std::array<float, 3>> forces = treeEnv.getForces(0);
+                    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                    std::vector<double> errors(nParticles);
+                    for (int i = 0; i < nParticles; i++) {
+                        errors[i] = getEuclidianDistance(forces[i], reference[i]) / getEuclidianDistance(reference[i], {0, 0, 0});
+                    }
+                    std::sort(errors.begin(), errors.end());
+                    TreeSetting setting = {criterion, parameter, multipoleOrder, leafSize, seconds, {errors[nParticles / 2], errors[nParticles * 9 / 10], errors[nParticles * 99 / 100], errors.back()}};
+                    settings.push_back(setting);
+                    std::printf("%14s %9.4f %6d %5d %10.4f %11.3e %11.3e %11.3e %11.3e\n", criterion.c_str(), parameter, multipoleOrder, leafSize, seconds, setting.errors[0], setting.errors[1], setting.errors[2], setting.errors[3]);
+                }
+            }
+        }
+    }
+
+    // A setting is on the frontier when every faster setting has a larger 99th-percentile error
+    std::sort(settings.begin(), settings.end(), [](const TreeSetting& a, const TreeSetting& b) { return a.seconds < b.seconds; });
+    std::printf("\nPareto frontier (seconds vs p99 error)\n");
+    std::printf("%14s %9s %6s %5s %10s %11s\n", "criterion", "parameter", "order", "leaf", "seconds", "p99");
+    double bestError = INFINITY;
+    for (const TreeSetting& setting : settings) {
+        if (setting.errors[2] < bestError) {
+            bestError = setting.errors[2];
+            std::printf("%14s %9.4f %6d %5d %10.4f %11.3e\n", setting.criterion.c_str(), setting.parameter, setting.multipoleOrder, setting.leafSize, setting.seconds, setting.errors[2]);
+        }
+    }
+    return 0;
+}
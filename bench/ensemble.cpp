@@ -0,0 +1,57 @@
+#include <iostream>
+#include <array>
+#include <vector>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <cstdio>
+
+#include "../include/particle.h"
+#include "../include/environment.h"
+#include "../include/ensemble.h"
+
+// Throughput of many small realizations of configs/ensemble.yaml, advanced either as separate leapfrog environments
+// or together as one batched ensemble, in realization-steps per second
+int main() {
+    const int nRealizations = 256;
+    const int nSteps = 100;
+    const float timestep = 0.01;
+    std::map<std::string, std::map<std::string, std::string>> configMap = loadConfig("ensemble.yaml");
+
+    std::printf("%10s %14s %14s %10s\n", "nParticles", "separate", "ensemble", "speedup");
+    for (int nParticles : {3, 10, 30, 100}) {
+        configMap["global"]["nParticles"] = std::to_string(nParticles);
+
+        // Separate environments, one after another
+        std::vector<std::unique_ptr<GravitationalEnvironment<Particle>>> environments;
+        for (int realization = 0; realization < nRealizations; realization++) {
+            ParticleCatalog sample = sampleParticles(configMap, nParticles, realization, 1);
+            std::vector<std::shared_ptr<Particle>> particlePtrs;
+            for (int i = 0; i < nParticles; i++) {
+                particlePtrs.push_back(std::make_shared<Particle>(&sample.positions[i], &sample.velocities[i], sample.masses[i]));
+            }
+            environments.push_back(std::make_unique<GravitationalEnvironment<Particle>>(particlePtrs, false));
+            environments.back()->applyGlobalConfig(configMap.at("global"));
+            environments.back()->setIntegrator("leapfrog");
+        }
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (auto& environment : environments) {
+            for (int i = 0; i < nSteps; i++) {
+                environment->step(timestep);
+            }
+        }
+        double separateSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // One ensemble
+        Ensemble ensemble(configMap, 0, nRealizations, false);
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < nSteps; i++) {
+            ensemble.step(timestep);
+        }
+        double ensembleSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        double work = static_cast<double>(nRealizations) * nSteps;
+        std::printf("%10d %14.0f %14.0f %10.1f\n", nParticles, work / separateSeconds, work / ensembleSeconds, separateSeconds / ensembleSeconds);
+    }
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include <iostream>
+#include <array>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+#include "../include/particle.h"
+#include "../include/environment.h"
+
+extern float G;
+
+// Error versus cost of each integrator on an eccentric (e = 0.5) Kepler orbit followed for 10 periods, in units with
+// G = 1. Cost is counted in force evaluations; the error is the relative energy drift and the distance from the
+// analytic end position (the pericenter, since a whole number of periods is integrated).
+int main() {
+    G = 1;
+    const double eccentricity = 0.5;
+    const double period = 2 * M_PI;  // Semi-major axis 1, GM = 1
+    const int nOrbits = 10;
+
+    std::printf("%-10s %8s %12s %12s %12s %10s\n", "integrator", "steps", "forceEvals", "energyError", "positionError", "seconds");
+    for (std::string integrator : {"euler", "leapfrog", "yoshida4", "yoshida6", "hermite", "wisdom-holman"}) {
+        for (int stepsPerOrbit : {64, 128, 256, 512, 1024}) {
+
+            // Start at pericenter, r = a (1 - e), v = sqrt((1 + e) / (1 - e))
+            std::array<float, 3> centralPosition = {0, 0, 0};
+            std::array<float, 3> centralVelocity = {0, 0, 0};
+            std::array<float, 3> orbitPosition = {static_cast<float>(1 - eccentricity), 0, 0};
+            std::array<float, 3> orbitVelocity = {0, static_cast<float>(std::sqrt((1 + eccentricity) / (1 - eccentricity))), 0};
+            std::vector<std::shared_ptr<Particle>> particles = {std::make_shared<Particle>(&centralPosition, &centralVelocity, 1), std::make_shared<Particle>(&orbitPosition, &orbitVelocity, 1E-7)};
+            GravitationalEnvironment<Particle> env(particles, false);
+            env.applyGlobalConfig({{"integrator", integrator}, {"diagnosticsInterval", "1"}});
+
+            // Count force evaluations through the engine the integrator selected
+            long forceEvaluations = 0;
+            std::function<std::vector<std::array<float, 3>>(float)> engine = env.getForces;
+            env.getForces = [&](float timestep) {
+                forceEvaluations++;
+                return engine(timestep);
+            };
+
+            int nSteps = stepsPerOrbit * nOrbits;
+            float timestep = period / stepsPerOrbit;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (int i = 0; i < nSteps; i++) {
+                env.step(timestep);
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            double dx = particles[1]->position[0] - particles[0]->position[0] - (1 - eccentricity);
+            double dy = particles[1]->position[1] - particles[0]->position[1];
+            std::printf("%-10s %8d %12ld %12.3e %12.3e %10.4f\n", integrator.c_str(), nSteps, forceEvaluations, env.getEnergyError(), std::sqrt(dx * dx + dy * dy), seconds);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include <iostream>
+#include <array>
+#include <vector>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <algorithm>
+
+#include "../include/particle.h"
+#include "../include/environment.h"
+
+// Cost of reusing Barnes-Hut interaction lists on a Plummer sphere (configs/plummer.yaml): each setting of
+// interactionListInterval and interactionListMargin takes the same leapfrog steps from the same initial conditions,
+// and reports the time per step, the number of full walks and the force error at the last step against direct
+// summation. Usage: bench_interactionlists [nParticles] [nSteps]
+int main(int argc, char* argv[]) {
+    int nParticles = argc > 1 ? std::stoi(argv[1]) : 1000;
+    int nSteps = argc > 2 ? std::stoi(argv[2]) : 16;
+    const float timestep = 0.01;
+    std::map<std::string, std::map<std::string, std::string>> configMap = loadConfig("plummer.yaml");
+    ParticleCatalog sample = sampleParticles(configMap, nParticles, 1);
+
+    std::printf("N = %d, %d leapfrog steps of %g\n\n", nParticles, nSteps, timestep);
+    std::printf("%9s %7s %12s %7s %11s %11s\n", "interval", "margin", "s per step", "walks", "p50", "p99");
+    for (int interval : {0, 2, 4, 8}) {
+        for (float margin : {0.1f, 0.2f, 0.3f}) {
+            if (interval == 0 && margin != 0.1f) {
+                continue;
+            }
+            std::vector<std::array<float, 3>> positions = sample.positions;
+            std::vector<std::array<float, 3>> velocities = sample.velocities;
+            std::vector<std::shared_ptr<Particle>> particlePtrs;
+            for (int i = 0; i < nParticles; i++) {
+                particlePtrs.push_back(std::make_shared<Particle>(&positions[i], &velocities[i], sample.masses[i]));
+            }
+            GravitationalEnvironment<Particle> env(particlePtrs, false, "run", "Barnes-Hut");
+            env.applyGlobalConfig(configMap.at("global"));
+            env.applyGlobalConfig({{"integrator", "leapfrog"}, {"leafSize", "8"}, {"interactionListInterval", std::to_string(interval)}, {"interactionListMargin", std::to_string(margin)}});
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (int step = 0; step < nSteps; step++) {
+                env.step(timestep);
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            // The forces left for the next step against direct summation at the same positions
+            std::vector<std::array<float, 3>> forces = env.cachedForces;
+            std::vector<std::array<float, 3>> reference = env.getForcesPairWise(0);
+            std::vector<double> errors(nParticles);
+            for (int i = 0; i < nParticles; i++) {
+                errors[i] = getEuclidianDistance(forces[i], reference[i]) / getEuclidianDistance(reference[i], {0, 0, 0});
+            }
+            std::sort(errors.begin(), errors.end());
+            std::printf("%9d %7.2f %12.4f %7d %11.3e %11.3e\n", interval, margin, seconds / nSteps, env.fullWalkCount, errors[nParticles / 2], errors[nParticles * 99 / 100]);
+        }
+    }
+    return 0;
+}
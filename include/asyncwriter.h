@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <functional>
+
+// A copy of the logged particle state at one output time
+struct Snapshot {
+    float time;
+    std::vector<float> values;  // Per-particle fields, particle-major
+    std::vector<float> masses;  // Masses of the logged particles if they changed since the last row, else empty
+};
+
+// Describe a bounded single-producer, single-consumer lock-free ring buffer
+template <typename Item>
+class SpscQueue {
+
+    public:
+        // Constructor
+        explicit SpscQueue(size_t capacity)
+            : slots(capacity + 1), head(0), tail(0) {};
+
+        // Push an item, returning false if the queue is full (producer thread only)
+        bool push(const Item& item) {
+            size_t currentTail = tail.load(std::memory_order_relaxed);
+            size_t nextTail = (currentTail + 1) % slots.size();
+            if (nextTail == head.load(std::memory_order_acquire)) {
+                return false;
+            }
+            slots[currentTail] = item;
+            tail.store(nextTail, std::memory_order_release);
+            return true;
+        }
+
+        // Pop an item, returning false if the queue is empty (consumer thread only)
+        bool pop(Item& item) {
+            size_t currentHead = head.load(std::memory_order_relaxed);
+            if (currentHead == tail.load(std::memory_order_acquire)) {
+                return false;
+            }
+            item = slots[currentHead];
+            head.store((currentHead + 1) % slots.size(), std::memory_order_release);
+            return true;
+        }
+
+    private:
+        std::vector<Item> slots;
+        alignas(64) std::atomic<size_t> head;
+        alignas(64) std::atomic<size_t> tail;
+};
+
+// Describe a background writer: the simulation thread fills snapshot buffers and hands them to a writer thread that
+// encodes and writes them. There are only 'nBuffers' snapshots, so when storage falls behind, acquire() blocks the
+// simulation until a buffer is free again.
+class AsyncWriter {
+
+    public:
+        // Constructor and destructor (the destructor drains the queue)
+        AsyncWriter(std::function<void(const Snapshot&)> encoder, size_t nBuffers=2);
+        ~AsyncWriter();
+        AsyncWriter(const AsyncWriter&) = delete;
+        AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+        // Member functions (simulation thread)
+        Snapshot* acquire();
+        void submit(Snapshot* snapshot);
+        void finish();
+
+    private:
+        void run();
+
+        std::function<void(const Snapshot&)> encoder;
+        std::vector<Snapshot> buffers;
+        SpscQueue<Snapshot*> filledQueue;
+        SpscQueue<Snapshot*> freeQueue;
+        std::atomic<bool> finished;
+        std::thread worker;
+};
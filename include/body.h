@@ -16,3 +16,7 @@ class Body : public Particle {
         // New physical member
         float radius;
 };
+
+// Radius accessors used by the collision stage
+inline float getRadius(const Body& body) { return body.radius; }
+inline void setRadius(Body& body, float radius) { body.radius = radius; }
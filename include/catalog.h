@@ -0,0 +1,40 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <string>
+
+// Particles read from an external catalog. Radii are zero when the catalog has no radius column, and so are masses
+// when it has none and the loader was told not to require them.
+struct ParticleCatalog {
+    std::vector<std::array<float, 3>> positions;
+    std::vector<std::array<float, 3>> velocities;
+    std::vector<float> masses;
+    std::vector<float> radii;
+};
+
+// Split a comma-separated column list, e.g. "x,y,z,vx,vy,vz,mass". Names other than x, y, z, vx, vy, vz, mass and
+// radius mark columns to skip.
+std::vector<std::string> parseColumnList(const std::string& columns);
+
+// Load a csv catalog with a chunked, multithreaded parser. If 'columns' is empty, the names are taken from the
+// header row; a header row is detected and skipped either way.
+ParticleCatalog loadCatalogCSV(const std::string& fileName, std::vector<std::string> columns, int nThreads=0, bool requireMass=true);
+
+// Load a binary catalog of row-major float32 records (native byte order) with one value per column, via mmap
+ParticleCatalog loadCatalogBinary(const std::string& fileName, const std::vector<std::string>& columns, int nThreads=0, bool requireMass=true);
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+
+    public:
+        // Constructor and destructor
+        explicit MappedFile(const std::string& fileName);
+        ~MappedFile();
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        // Members
+        const char* data;
+        size_t size;
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+
+// One cache line per node: the cubic cell (center and half-width), the monopole and the radius bmax of the node's
+// particles about their center of mass, the index of the first child (the children of a node are stored together, in
+// octant order, one per set bit of 'childMask') and the range [begin, end) of the node's particles in the sorted
+// particle arrays. A node without children is a leaf.
+struct alignas(64) CompactNode {
+    std::array<float, 3> center;
+    float halfWidth;
+    std::array<float, 3> centerOfMass;
+    float mass;
+    float bmax;
+    uint32_t firstChild;
+    uint32_t begin;
+    uint32_t end;
+    uint8_t childMask;
+    uint8_t depth;
+};
+
+static_assert(sizeof(CompactNode) == 64, "CompactNode should fill one cache line");
+
+// Describe an octree stored as one contiguous array of CompactNodes, built over a copy of the particle positions and
+// masses sorted so that every node's particles are contiguous. Children always follow their parent in the array, so
+// the moments are computed by one reverse sweep. Multipole moments beyond the monopole live in arrays parallel to
+// 'nodes', keeping the nodes the walk touches small.
+class CompactOctree {
+
+    public:
+        // Constructor ('leafSize' is the most particles a leaf holds before it splits)
+        explicit CompactOctree(int leafSize=1);
+
+        // Member functions
+        void build(const std::vector<std::array<float, 3>>& positions, const std::vector<float>& masses);
+        void build(const std::vector<std::array<float, 3>>& positions, const std::vector<float>& masses, const std::array<float, 3>& boxCenter, float boxHalfWidth);
+        void computeQuadrupoles();
+        int getChildCount(const CompactNode& node) const;
+
+        // Spatial queries, answered with the original indices of the particles. Each writes up to 'maxResults' indices
+        // (in tree order) and returns how many particles matched, which may be more. kNearest writes the min(k, N)
+        // nearest particles, nearest first, with their squared distances, and returns how many it wrote.
+        int radiusQuery(const std::array<float, 3>& center, float radius, int* indices, int maxResults) const;
+        int boxQuery(const std::array<float, 3>& lower, const std::array<float, 3>& upper, int* indices, int maxResults) const;
+        int kNearest(const std::array<float, 3>& center, int k, int* indices, float* distances2) const;
+
+        // Batched queries, run in parallel over the query points. Query q writes to its own slots of the preallocated
+        // buffers: indices[q * maxResults, (q + 1) * maxResults) and counts[q] (or k slots for kNearest, where slots
+        // past the particle count hold -1 and infinity)
+        void radiusQueries(const std::vector<std::array<float, 3>>& centers, float radius, int maxResults, std::vector<int>& indices, std::vector<int>& counts, int nThreads=0) const;
+        void boxQueries(const std::vector<std::array<float, 3>>& lowers, const std::vector<std::array<float, 3>>& uppers, int maxResults, std::vector<int>& indices, std::vector<int>& counts, int nThreads=0) const;
+        void kNearestQueries(const std::vector<std::array<float, 3>>& centers, int k, std::vector<int>& indices, std::vector<float>& distances2, int nThreads=0) const;
+
+        // Members
+        std::vector<CompactNode> nodes;
+
+        // Traceless quadrupole moment of each node about its center of mass (xx, yy, zz, xy, xz, yz), filled by
+        // computeQuadrupoles
+        std::vector<std::array<float, 6>> quadrupoles;
+
+        // Particles in tree order, the original index of each, and the tree slot of each original particle
+        std::vector<std::array<float, 3>> positions;
+        std::vector<float> masses;
+        std::vector<int> order;
+        std::vector<int> slots;
+
+        int leafSize;
+
+        // Side of the periodic box that radius and nearest-neighbor queries wrap around (0 for open boundaries)
+        float period;
+
+        // Depth at which cells stop splitting, so that coincident particles end up in one leaf
+        static const int maxDepth = 32;
+
+    private:
+        void computeMoments();
+        float getOffset(float from, float to) const;
+        float getCellDistance2(const CompactNode& node, const std::array<float, 3>& point) const;
+};
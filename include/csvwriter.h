@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vector>
+#include <string_view>
+
+// Describe a csv row builder that formats numbers with std::to_chars into a buffer reused across rows, so a row
+// costs no allocations once the buffer has grown to fit it
+class CsvWriter {
+
+    public:
+        // Constructor ('shortest' writes the shortest round-trip representation instead of fixed 6-decimal output)
+        explicit CsvWriter(bool shortest=false);
+
+        // Member functions
+        void clear();
+        void append(float value);
+        void append(const float* values, size_t n);
+        void endRow();
+        std::string_view view() const;
+
+        // Members
+        bool shortest;
+
+    private:
+        void reserve(size_t extra);
+
+        std::vector<char> buffer;
+        size_t length;
+};
@@ -0,0 +1,61 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <map>
+#include <string>
+#include <cstdint>
+
+#include "./softening.h"
+#include "./csvwriter.h"
+
+// Realizations advanced together by one vectorizable loop
+constexpr int ENSEMBLE_LANES = 8;
+
+// Describe an ensemble of independent few-body realizations of one configuration, sampled with the seeds
+// [firstSeed, firstSeed + nRealizations). Realizations are packed ENSEMBLE_LANES to a batch in structure-of-arrays
+// form with the realization innermost, x[(batch * nParticles + particle) * ENSEMBLE_LANES + lane], so that each
+// pairwise interaction is evaluated for a whole batch at once; batches are spread across threads. Every realization
+// takes kick-drift-kick leapfrog steps with direct summation, and all of them are logged to one csv.
+class Ensemble {
+
+    public:
+        // Constructors, from a configuration file or an already loaded configuration
+        Ensemble(const std::string configFileName, uint64_t firstSeed, int nRealizations, const bool log, std::string logFilePrefix="ensemble");
+        Ensemble(const std::map<std::string, std::map<std::string, std::string>>& configMap, uint64_t firstSeed, int nRealizations, const bool log, std::string logFilePrefix="ensemble");
+
+        // Member functions
+        void computeAccelerations(int batch);
+        void step(const float timestep);
+        void simulate(const float duration, const float timestep);
+        std::array<float, 3> getPosition(int realization, int particle) const;
+        std::array<float, 3> getVelocity(int realization, int particle) const;
+        float getMass(int realization, int particle) const;
+        std::vector<double> getEnergies() const;
+        std::string getLogHeader() const;
+        void appendLogRows(CsvWriter& writer) const;
+
+        // Members
+        uint64_t firstSeed;
+        int nRealizations;
+        int nParticles;
+        int nBatches;
+        bool log;
+        float time;
+        std::string logFileName;
+
+        // Settings read from the 'global' block of the configuration
+        Softening softening;
+        int nThreads;
+
+        // Batched state; lanes past the last realization repeat it and are never logged
+        std::vector<float> x, y, z;
+        std::vector<float> vx, vy, vz;
+        std::vector<float> ax, ay, az;
+        std::vector<float> mass;
+
+    private:
+        size_t getIndex(int realization, int particle) const;
+        template <float (Softening::*forceFactor)(float) const>
+        void accumulateAccelerations(size_t batchStart);
+        bool accelerationsCurrent;
+};
@@ -4,9 +4,29 @@
 #include <map>
 #include <memory>
 #include <functional>
+#include <cstdint>
+#include <unordered_map>
 
 #include "./particle.h"
 #include "./octree.h"
+#include "./compactoctree.h"
+#include "./groups.h"
+#include "./softening.h"
+#include "./ewald.h"
+#include "./csvwriter.h"
+#include "./asyncwriter.h"
+#include "./catalog.h"
+
+// Conservation diagnostics for a single snapshot of the environment
+struct EnvironmentDiagnostics {
+    double time;
+    double kineticEnergy;
+    double potentialEnergy;
+    double totalEnergy;
+    std::array<double, 3> momentum;
+    std::array<double, 3> angularMomentum;
+    double virialRatio;  // 2K / |W|, which is 1 for a system in virial equilibrium
+};
 
 template <typename T>
 class GravitationalEnvironment{
@@ -16,20 +36,111 @@ class GravitationalEnvironment{
         GravitationalEnvironment(const std::vector<std::shared_ptr<T>>& particlePtrs, const bool log, std::string logFilePrefix="run", std::string forceAlgorithm="pair-wise");
         GravitationalEnvironment(const std::string configFileName, const bool log, std::string logFilePrefix = "run", std::string forceAlgorithm="pair-wise");
 
-        // Callable member that we will set to pair-wise or Barnes-Hut force algorithm
+        // Callable member that we will set to the "pair-wise", "Barnes-Hut" or "dual-tree" force algorithm
         std::function<std::vector<std::array<float, 3>>(float)> getForces;
+        std::string forceAlgorithm;
+
+        // Barnes-Hut settings: opening angle, most particles per octree leaf, and multipole order of the accepted nodes
+        // (0 for monopoles, 2 to add their quadrupole moments)
+        float theta;
+        int leafSize;
+        int multipoleOrder;
+
+        // Node acceptance criterion of the tree walks: "geometric" (cell diagonal / distance < theta),
+        // "salmon-warren" (distance > bmax / theta) or "relative" (estimated force error below forceAccuracy times the
+        // previous acceleration), with the acceleration magnitudes of the last tree evaluation for the latter
+        std::string openingCriterion;
+        float forceAccuracy;
+        std::vector<float> previousAccelerations;
+
+        // Interaction lists: a full walk records each particle's accepted nodes and directly summed particles with
+        // the opening criterion tightened by 'interactionListMargin' (theta scaled by 1 - margin). The next
+        // 'interactionListInterval' - 1 evaluations (0 disables the lists) reuse them against the refitted octree,
+        // until a stored node fails the untightened criterion.
+        int interactionListInterval;
+        float interactionListMargin;
+        std::vector<std::vector<const Octree<T>*>> interactionNodes;
+        std::vector<std::vector<const T*>> interactionParticles;
+        int interactionListAge;
+        int fullWalkCount;
+
+        // Node layout of the Barnes-Hut walk: "pointer" (Octree, linked nodes holding their particles) or "compact"
+        // (CompactOctree, 64-byte nodes in one array over a sorted copy of the particles, walked in parallel)
+        std::string treeLayout;
+        CompactOctree compactOctree;
+
+        // Callable member that advances the particles by one step from the forces at its start, set by name with
+        // setIntegrator: "euler" (Particle::update), "leapfrog", "yoshida4", "yoshida6", "hermite" or "wisdom-holman"
+        std::function<void(const std::vector<std::array<float, 3>>&, const float)> integrate;
+        std::string integrator;
 
         // Define member functions for force algorithms
         std::vector<std::array<float, 3>> getForcesPairWise(const float timestep);
         std::vector<std::array<float, 3>> getForcesBarnesHut(const float timestep);
+        std::vector<std::array<float, 3>> getForcesDualTree(const float timestep);
+        std::vector<std::array<float, 3>> getForcesPairWiseWithJerks(const float timestep);
+        std::vector<std::array<float, 3>> getForcesWisdomHolman(const float timestep);
+
+        // Define member functions for integrators
+        void setIntegrator(const std::string& name);
+        void kick(const std::vector<std::array<float, 3>>& forces, const float timestep);
+        void drift(const float timestep);
+        void integrateLeapfrog(const std::vector<std::array<float, 3>>& forces, const float timestep);
+        void integrateComposition(const std::vector<std::array<float, 3>>& forces, const float timestep, const std::vector<double>& weights);
+        void integrateHermite(const std::vector<std::array<float, 3>>& forces, const float timestep);
+        void integrateWisdomHolman(const std::vector<std::array<float, 3>>& forces, const float timestep);
+        int getCentralIndex() const;
+
+        // Define member functions for massless tracers
+        void addTracers(const std::vector<std::array<float, 3>>& positions, const std::vector<std::array<float, 3>>& velocities);
+        std::array<float, 3> getAccelerationBarnesHut(const std::array<float, 3>& position, const Octree<T>* node, float previousAcceleration) const;
+        void computeTracerAccelerations();
+        void kickTracers(const float timestep);
+        void driftTracers(const float timestep);
         
         void loadParticlesFromConfig(std::string configFileName);
-        std::array<float, 3> calculateForceBarnesHut(std::shared_ptr<T> objPtr, std::shared_ptr<Octree<T>> currPtr, std::array<float, 3> netForce, float theta);
+        void loadParticlesFromCatalog(const std::map<std::string, std::string>& globalConfigMap);
+        void applyGlobalConfig(const std::map<std::string, std::string>& globalConfigMap);
+        void accumulateInteraction(std::array<float, 3> separation, const float prop_to_force, std::array<float, 3>& force, float& potential) const;
+        void accumulateQuadrupole(const std::array<float, 3>& separation, const std::array<float, 6>& quadrupole, const float prop_to_force, std::array<float, 3>& force, float& potential) const;
+        void applyMinimumImage(std::array<float, 3>& separation) const;
+        void wrapPositions();
+        std::array<float, 3> calculateForceBarnesHut(std::shared_ptr<T> objPtr, std::shared_ptr<Octree<T>> currPtr, std::array<float, 3> netForce, float previousAcceleration, float& potential);
+        bool acceptNode(const Octree<T>& node, const std::array<float, 3>& position, const std::array<float, 3>& separation, float previousAcceleration, float tolerance=1) const;
+        bool acceptCell(const std::array<float, 3>& cellCenter, const std::array<float, 3>& widths, float mass, float bmax, const std::array<float, 3>& position, const std::array<float, 3>& separation, float previousAcceleration, float tolerance=1) const;
+        void buildCompactOctree();
+
+        // Batched spatial queries over the current particle positions, answered with particle indices into
+        // preallocated buffers (see CompactOctree); each call rebuilds the compact octree once for all its points
+        void radiusQueries(const std::vector<std::array<float, 3>>& centers, float radius, int maxResults, std::vector<int>& indices, std::vector<int>& counts);
+        void boxQueries(const std::vector<std::array<float, 3>>& lowers, const std::vector<std::array<float, 3>>& uppers, int maxResults, std::vector<int>& indices, std::vector<int>& counts);
+        void kNearestQueries(const std::vector<std::array<float, 3>>& centers, int k, std::vector<int>& indices, std::vector<float>& distances2);
+        std::vector<GroupProperties> findGroups();
+        std::array<float, 3> calculateForceCompact(int index, float previousAcceleration, float& potential) const;
+        void recordInteractionList(int index, const Octree<T>* node, float previousAcceleration);
+        bool evaluateInteractionList(int index, float previousAcceleration, bool checkCriterion, std::array<float, 3>& force, float& potential) const;
+        void clearInteractionLists();
+        void interactDualTree(Octree<T>* sink, const Octree<T>* source, const std::unordered_map<const T*, int>& indices, std::vector<std::array<float, 3>>& forces);
+        void pushLocalExpansion(Octree<T>* node, std::array<float, 10> expansion, const std::array<float, 3>& origin, const std::unordered_map<const T*, int>& indices, std::vector<std::array<float, 3>>& forces);
+        void buildOctree();
+        void refitOctree();
         void updateAll(const std::vector<std::array<float, 3>>& forces, const float timestep);
-        void step(const float timestep);
+        int resolveCollisions();
+        void recordAccelerations(const std::vector<std::array<float, 3>>& forces);
+        float step(const float timestep, Snapshot* snapshot=nullptr);
+        float chooseTimestep(const std::vector<std::array<float, 3>>& forces) const;
         void simulate(const float duration, const float timestep);
         std::string getStepLog() const;
+        void captureSnapshot(float rowTime, Snapshot& snapshot) const;
+        void formatSnapshot(const Snapshot& snapshot, CsvWriter& writer) const;
+        void setLogFields(const std::vector<std::string>& fields);
+        void selectOutputParticles();
         std::string getLogHeader() const;
+        std::string getMassLine(const std::vector<float>& masses) const;
+        EnvironmentDiagnostics getDiagnostics() const;
+        std::string getDiagnosticsLog() const;
+        std::string getGroupLog() const;
+        double getEnergyError() const;
         void reset();
         
         // Instantiation of the physical members
@@ -40,12 +151,123 @@ class GravitationalEnvironment{
         std::string logFileName;
         Octree<T> envOctree;
 
+        // Whether envOctree was built or refitted at the current positions and settings, so that tracer walks can reuse
+        // the tree of the last force evaluation. Cleared whenever the environment moves its particles, and at each step.
+        bool octreeCurrent;
+
+        // Potential energy of each particle from the most recent force evaluation
+        std::vector<float> potentials;
+
+        // Time derivative of the forces, computed with them by the Hermite integrator's direct-summation kernel
+        std::vector<std::array<float, 3>> jerks;
+
+        // Accelerations from every body except the central one, for the Wisdom-Holman interaction kicks
+        std::vector<std::array<float, 3>> interactionAccelerations;
+
+        // Forces at the current positions left by the last integrator step (the leapfrog family and Hermite end
+        // with a force evaluation), reused by the next step instead of recomputing them
+        std::vector<std::array<float, 3>> cachedForces;
+        bool forcesCached;
+
+        // Massless tracers, stored apart from the massive particles: they are kept out of the octree and the force
+        // loops, and take a leapfrog step in the field of the massive particles around each massive step
+        std::vector<std::array<float, 3>> tracerPositions;
+        std::vector<std::array<float, 3>> tracerVelocities;
+        std::vector<std::array<float, 3>> tracerAccelerations;
+        bool tracerAccelerationsCurrent;
+
+        // Accelerations from the most recent force evaluation, kept only when they are logged
+        std::vector<std::array<float, 3>> accelerations;
+
+        // Diagnostics are recorded every 'diagnosticsInterval' steps (0 disables them)
+        int diagnosticsInterval;
+        int stepCount;
+        std::vector<EnvironmentDiagnostics> diagnostics;
+
+        // Friends-of-friends groups with linking length 'linkingLength' (0 disables them) are found every
+        // 'groupInterval' outputs of simulate, and those of at least 'minGroupMembers' particles are cataloged
+        float linkingLength;
+        int groupInterval;
+        int minGroupMembers;
+        std::vector<GroupProperties> groupCatalog;
+
+        // Collision handling after each step: "none", "merge" (inelastic) or "bounce" (hard spheres)
+        std::string collisionMode;
+        float restitution;
+
+        // Original index (ID) of each particle, which names its log columns and output selection. Merges compact the
+        // particle list, so indices and IDs differ after the first one; empty (every index is its ID) until then.
+        // Absorbed bodies keep their columns, filled with NaN, so there are 'nParticleIds' of them.
+        std::vector<int> particleIds;
+        int nParticleIds;
+
+        // Softening kernel applied in every force engine and in the potentials
+        Softening softening;
+
+        // Periodic cube [boxMin, boxMin + boxSize)^3, with Ewald corrections for the images
+        bool periodic;
+        float boxSize;
+        float boxMin;
+        std::shared_ptr<EwaldTable> ewaldTable;
+
+        // Seed of the counter-based generator used to sample initial conditions
+        uint64_t seed;
+
+        // Worker threads for parallel loops (0 uses every hardware core)
+        int nThreads;
+
+        // Per-particle fields written to the log, and the row formatter reused across steps
+        std::vector<std::string> logFields;
+        CsvWriter logWriter;
+
+        // Snapshot buffers shared with the writer thread; the simulation waits when all of them are being written
+        int outputBuffers;
+
+        // Output selection, fixed at the start of each run: inclusive particle index ranges, a random fraction of
+        // tracers and a region [xmin, xmax) x [ymin, ymax) x [zmin, zmax)
+        std::vector<std::array<int, 2>> outputRanges;
+        float outputFraction;
+        std::vector<float> outputRegion;
+
+        // Timestepping: "fixed" or "adaptive", with dt = timestepEta * sqrt(timestepLength / |a|max) (the length
+        // defaults to the softening length), bounded by [dtMin, dtMax] (0 = unbounded) and 'timestepGrowth' times the
+        // previous step
+        std::string timestepping;
+        float timestepEta;
+        float timestepLength;
+        float dtMin;
+        float dtMax;
+        float timestepGrowth;
+        float lastTimestep;
+
+        // Log format: "csv" or "trajectory" (chunked, compressed columns, see trajectory.h)
+        std::string outputFormat;
+        int trajectoryChunkSize;
+        int keyframeInterval;
+
+        // Console output: "silent", "progress" (a status line every 'progressInterval' seconds) or "full" (every row)
+        std::string verbosity;
+        float progressInterval;
+
     private:
         // Instantiation of the physical members
         std::string logFilePrefix;
+        std::vector<int> logFieldIds;
+        bool outputSubset;
+        std::vector<int> outputIds;
+        bool massesChanged;
+        enum OpeningRule { GEOMETRIC, SALMON_WARREN, RELATIVE };
+        OpeningRule openingRule;
+
+        std::vector<int> getOutputIds() const;
+        std::vector<int> getParticleSlots() const;
+        void appendTracerFields(int tracer, std::vector<float>& values, size_t& index) const;
 };
 
 // Helper functions
 int getLargestLabelNumber(const std::vector<std::string>& filenames, const std::string logFilePrefix);
 float getEuclidianDistance(std::array<float, 3> coords1, std::array<float, 3> coords2);
 std::map<std::string, std::map<std::string, std::string>> loadConfig(const std::string& fileName);
+ParticleCatalog sampleParticles(const std::map<std::string, std::map<std::string, std::string>>& configMap, int nParticles, uint64_t seed, int nThreads=0);
+ParticleCatalog getInitialConditions(const std::map<std::string, std::map<std::string, std::string>>& configMap, uint64_t seed, int nThreads=0);
+std::string formatProgress(int stepNumber, int totalSteps, float simTime, double elapsed, double energyError);
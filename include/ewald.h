@@ -0,0 +1,34 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+// Describe a precomputed Ewald correction table for a periodic cube. The corrections are what must be added to the
+// minimum-image Newtonian interaction to recover the full periodic sum over all images, and are tabulated on a grid
+// over one octant of the box [0, L/2]^3 and extended to the others by symmetry.
+class EwaldTable {
+
+    public:
+        // Constructor
+        explicit EwaldTable(int gridSize=16);
+
+        // Correction to the acceleration s / |s|^3 due to a unit mass (with G = 1), where s = source - target is the
+        // minimum-image separation in a box of side 'boxSize'
+        std::array<float, 3> forceCorrection(const std::array<float, 3>& separation, float boxSize) const;
+
+        // Correction to the potential -1 / |s| of a unit mass (with G = 1)
+        float potentialCorrection(const std::array<float, 3>& separation, float boxSize) const;
+
+        // Number of grid cells along each axis of the tabulated octant
+        int gridSize;
+
+    private:
+        // Interpolate the table at a point in the octant (box units), returning (fx, fy, fz, psi)
+        std::array<float, 4> interpolate(const std::array<float, 3>& x) const;
+
+        std::vector<std::array<float, 4>> table;
+};
+
+// Exact Ewald sums in box units (L = 1, G = 1) for a target at x relative to a unit source, used to fill the table
+std::array<double, 3> getEwaldForceCorrection(const std::array<double, 3>& x);
+double getEwaldPotentialCorrection(const std::array<double, 3>& x);
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <atomic>
+
+#include "./compactoctree.h"
+
+// Properties of one friends-of-friends group at one output time. Groups are numbered by decreasing member count.
+struct GroupProperties {
+    double time;
+    int group;
+    int nMembers;
+    double mass;
+    std::array<double, 3> center;  // Center of mass
+    std::array<double, 3> velocity;  // Center-of-mass velocity
+    double velocityDispersion;  // One-dimensional, mass weighted
+};
+
+// Describe disjoint sets over [0, n) that threads may unite concurrently without locks. Roots are linked with a
+// compare-and-swap, always from the larger index to the smaller, and finds halve their paths with relaxed updates, so
+// every set ends up labelled by its smallest member whatever the interleaving.
+class ConcurrentUnionFind {
+
+    public:
+        // Constructor
+        explicit ConcurrentUnionFind(int n);
+
+        // Member functions
+        int find(int x);
+        void unite(int a, int b);
+
+    private:
+        std::vector<std::atomic<int>> parents;
+};
+
+// Label every particle of the tree with the smallest index of its friends-of-friends group: particles closer than
+// 'linkingLength' (to the nearest image when the tree has a period) are friends, and groups are the connected sets of
+// friends. Neighbor candidates come from radius queries on the tree, in parallel over the particles.
+std::vector<int> findFriendsOfFriends(const CompactOctree& tree, float linkingLength, int nThreads=0);
+
+// Catalog of the groups with at least 'minMembers' members from their labels. In a periodic box ('period' > 0),
+// members are placed at their nearest image of the group's first member, so the center may lie outside the box.
+std::vector<GroupProperties> getGroupProperties(const std::vector<int>& labels, const std::vector<std::array<float, 3>>& positions, const std::vector<std::array<float, 3>>& velocities, const std::vector<float>& masses, int minMembers, float period, double time);
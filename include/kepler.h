@@ -0,0 +1,11 @@
+#pragma once
+
+#include <array>
+
+// Stumpff functions c0..c3 of x = beta * s^2, as used by the universal-variable Kepler solver
+std::array<double, 4> getStumpffFunctions(double x);
+
+// Advance a body on the two-body orbit about a fixed mass with gravitational parameter 'mu' = GM by 'timestep', in
+// place. Universal variables handle elliptic, parabolic and hyperbolic orbits alike; the universal anomaly is found
+// with Laguerre-Conway iterations, which converge from a crude starting guess.
+void keplerDrift(std::array<double, 3>& position, std::array<double, 3>& velocity, double mu, double timestep);
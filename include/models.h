@@ -0,0 +1,30 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <map>
+#include <string>
+#include <cstdint>
+
+// Positions, velocities and masses sampled jointly from a phase-space model
+struct PhaseSpaceSample {
+    std::vector<std::array<float, 3>> positions;
+    std::vector<std::array<float, 3>> velocities;
+    std::vector<float> masses;
+};
+
+// Whether a config 'dist' names a phase-space model rather than a per-coordinate distribution
+bool isPhaseSpaceModel(const std::string& distType);
+
+// Sample an equal-mass realization of the model described by a config block ('dist' plus its parameters). Every
+// particle uses its own counter-based random stream, so the result is independent of the thread count.
+PhaseSpaceSample samplePhaseSpaceModel(const std::map<std::string, std::string>& modelConfig, int nParticles, uint64_t seed, int nThreads=0);
+
+// Dimensionless King (1966) model with central potential W0, in units where G = sigma = r0 = 1. Columns are radius,
+// potential W and enclosed mass, from the center out to the tidal radius.
+struct KingProfile {
+    std::vector<double> radius;
+    std::vector<double> potential;
+    std::vector<double> enclosedMass;
+};
+KingProfile getKingProfile(double W0);
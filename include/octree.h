@@ -9,20 +9,34 @@ template <typename T>
 class Octree {
     public:
 
-        // Octree constructor
-        Octree(std::array<float, 2>& xCoords, std::array<float, 2>& yCoords, std::array<float, 2>& zCoords, bool internal);
+        // Octree constructor ('leafSize' is the most objects an external node holds before it splits)
+        Octree(std::array<float, 2>& xCoords, std::array<float, 2>& yCoords, std::array<float, 2>& zCoords, bool internal, int leafSize=1);
 
         // Member functions
         void clearOctree();
         void updateCoords(std::array<float, 2>& newXCoords, std::array<float, 2>& newYCoords, std::array<float, 2>& newZCoords);
         void insert(std::shared_ptr<T> objPtr);
         void build(std::vector<std::shared_ptr<T>>& objPtrs);
+        void computeQuadrupoles();
+        void computeBmax();
+        void refit();
 
         // Members
         std::vector<std::shared_ptr<T>> objPtrs;
         std::array<float, 3> centerOfMass;
         float totalMass;
+
+        // Traceless quadrupole moment about the center of mass (xx, yy, zz, xy, xz, yz), filled by computeQuadrupoles
+        std::array<float, 6> quadrupole;
+
+        // Distance from the center of mass to the furthest object in the node, filled by computeBmax
+        float bmax;
+
+        // Local field expansion about the center of mass per unit mass (potential, acceleration, and tidal tensor xx,
+        // yy, zz, xy, xz, yz), accumulated by the dual-tree walk
+        std::array<float, 10> localExpansion;
         bool internal;
+        int leafSize;
 
         // Dimensions of the current octant
         std::array<float, 2> xCoords;
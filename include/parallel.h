@@ -0,0 +1,37 @@
+#pragma once
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+// Resolve a requested thread count, where anything below 1 means one thread per hardware core
+inline int getThreadCount(int nThreads) {
+    if (nThreads > 0) {
+        return nThreads;
+    }
+    return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+// Split [0, n) into contiguous chunks and call body(begin, end) for each on its own thread. The chunking depends
+// only on n and the thread count, and each index is visited exactly once.
+template <typename Function>
+void parallelFor(size_t n, int nThreads, Function body) {
+    size_t nChunks = std::min(n, static_cast<size_t>(getThreadCount(nThreads)));
+    if (nChunks <= 1) {
+        body(static_cast<size_t>(0), n);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    workers.reserve(nChunks - 1);
+    size_t chunkSize = (n + nChunks - 1) / nChunks;
+    for (size_t begin = chunkSize; begin < n; begin += chunkSize) {
+        workers.emplace_back(body, begin, std::min(n, begin + chunkSize));
+    }
+
+    // The calling thread takes the first chunk
+    body(static_cast<size_t>(0), std::min(n, chunkSize));
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
@@ -17,3 +17,7 @@ class Particle {
         std::array<float, 3> velocity;
         float mass;
 };
+
+// Particles are points, so they never collide; 'Body' overloads these with its physical radius
+inline float getRadius(const Particle& particle) { return 0; }
+inline void setRadius(Particle& particle, float radius) {}
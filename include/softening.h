@@ -0,0 +1,118 @@
+#pragma once
+
+#include <string>
+#include <cmath>
+
+// Describe the gravitational softening kernel shared by every force engine and the potential-energy diagnostics.
+// 'length' is the Plummer-equivalent softening length; the spline kernel (as in Gadget) is exactly Newtonian beyond
+// 2.8 softening lengths.
+class Softening {
+
+    public:
+        // Constructor ("none", "plummer" or "spline")
+        explicit Softening(std::string type="none", float length=0);
+
+        enum Kernel { NONE, PLUMMER, SPLINE };
+
+        // Factor g(r^2) such that the acceleration due to a unit mass at separation dx is G * g * dx
+        inline float forceFactor(float r2) const;
+
+        // Branch-free forceFactor for one fixed kernel, for loops that pick the kernel once and vectorize over pairs
+        inline float newtonianForceFactor(float r2) const;
+        inline float plummerForceFactor(float r2) const;
+        inline float splineForceFactor(float r2) const;
+
+        // Derivative dg/d(r^2) of the force factor, for jerks
+        inline float forceFactorDerivative(float r2) const;
+
+        // Potential of a unit mass at separation r, in units of G (Newtonian: -1/r)
+        inline float potential(float r2) const;
+
+        // Kernel settings
+        std::string type;
+        float length;
+        Kernel getKernel() const { return kernel; }
+
+    private:
+        Kernel kernel;
+        float length2;
+        float h;  // Spline kernel support radius
+        float hInv;
+        float h3Inv;
+};
+
+
+inline float Softening::forceFactor(float r2) const {
+    switch (kernel) {
+        case PLUMMER:
+            return plummerForceFactor(r2);
+        case SPLINE:
+            return splineForceFactor(r2);
+        default:
+            return newtonianForceFactor(r2);
+    }
+}
+
+// Both sides of each selection are evaluated, so the ternaries compile to blends rather than branches
+inline float Softening::newtonianForceFactor(float r2) const {
+    // Coincident particles exert no force on each other
+    float g = 1 / (r2 * std::sqrt(r2));
+    return r2 > 0 ? g : 0;
+}
+
+inline float Softening::plummerForceFactor(float r2) const {
+    float s2 = r2 + length2;
+    return 1 / (s2 * std::sqrt(s2));
+}
+
+inline float Softening::splineForceFactor(float r2) const {
+    float r = std::sqrt(r2);
+    float u = r * hInv;
+    float inner = h3Inv * (10.666666666667f + u * u * (32.0f * u - 38.4f));
+    float outer = h3Inv * (21.333333333333f - 48.0f * u + 38.4f * u * u - 10.666666666667f * u * u * u - 0.066666666667f / (u * u * u));
+    float newtonian = 1 / (r2 * r);
+    return r < h ? (u < 0.5f ? inner : outer) : newtonian;
+}
+
+inline float Softening::forceFactorDerivative(float r2) const {
+    if (r2 == 0 && kernel == NONE) {
+        return 0;
+    }
+
+    if (kernel == PLUMMER) {
+        float s2 = r2 + length2;
+        return -1.5f / (s2 * s2 * std::sqrt(s2));
+    }
+
+    // dg/d(r^2) = dg/du / (2 u h^2)
+    float r = std::sqrt(r2);
+    if (kernel == SPLINE && r < h) {
+        float u = r * hInv;
+        float h5Inv = h3Inv * hInv * hInv;
+        if (u < 0.5f) {
+            return h5Inv * (48.0f * u - 38.4f);
+        }
+        return h5Inv * (-48.0f + 76.8f * u - 32.0f * u * u + 0.2f / (u * u * u * u)) / (2 * u);
+    }
+    return -1.5f / (r2 * r2 * r);
+}
+
+inline float Softening::potential(float r2) const {
+    if (r2 == 0 && kernel == NONE) {
+        return 0;
+    }
+
+    if (kernel == PLUMMER) {
+        return -1 / std::sqrt(r2 + length2);
+    }
+
+    float r = std::sqrt(r2);
+    if (kernel == SPLINE && r < h) {
+        float u = r * hInv;
+        if (u < 0.5f) {
+            return hInv * (-2.8f + u * u * (5.333333333333f + u * u * (6.4f * u - 9.6f)));
+        }
+        return hInv * (-3.2f + 0.066666666667f / u + u * u * (10.666666666667f + u * (-16.0f + u * (9.6f - 2.133333333333f * u))));
+    }
+    return -1 / r;
+}
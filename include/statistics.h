@@ -1,6 +1,9 @@
 #pragma once
 #include <vector>
 #include <random>
+#include <array>
+#include <string>
+#include <cstdint>
 
 // Assuming you have the random device and generator declared somewhere
 extern std::random_device rd;
@@ -17,5 +20,33 @@ std::vector<float> sampleFromDistribution(size_t n, Distribution& distribution)
     return samples;
 }
 
+// Philox4x32-10 block cipher: four random words that depend only on (counter, key)
+std::array<uint32_t, 4> philox4x32(std::array<uint32_t, 4> counter, const std::array<uint32_t, 2>& key);
+
+// Describe a counter-based random number generator. Draw 'draw' of sample 'index' is a pure function of
+// (seed, stream, index, draw), so samples can be computed in any order on any thread with identical results.
+class CounterRNG {
+
+    public:
+        // Constructor
+        CounterRNG(uint64_t seed, uint32_t stream=0);
+
+        // Member functions
+        std::array<uint32_t, 4> bits(uint64_t index, uint32_t draw=0) const;
+        double uniform(uint64_t index, uint32_t draw=0) const;  // U[0, 1)
+        double normal(uint64_t index, uint32_t draw=0) const;  // N(0, 1)
+
+        // Members
+        uint64_t seed;
+        uint32_t stream;
+};
+
+// Sample n values in parallel with a counter-based generator (bit-identical for any thread count)
+std::vector<float> sampleUniform(size_t n, float min, float max, const CounterRNG& rng, int nThreads=0);
+std::vector<float> sampleNormal(size_t n, float mu, float sigma, const CounterRNG& rng, int nThreads=0);
+
+// Stable stream identifier for a named quantity (FNV-1a), so each property gets an independent stream
+uint32_t getStreamId(const std::string& name);
+
 // Dummy executable to work with testing framework
 int dummyExecutable();
@@ -0,0 +1,53 @@
+#pragma once
+#include <vector>
+#include <map>
+#include <string>
+#include <cstdint>
+
+// One point of a parameter sweep: the overrides applied to the base configuration, keyed "block.key" (e.g.
+// "global.softeningLength", or "sweep.timestep" for the run settings), and its results
+struct SweepRun {
+    std::map<std::string, std::string> overrides;
+    double estimatedCost;
+    int initialConditions;  // Index of the shared initial conditions the run starts from
+    int nSteps;
+    double seconds;
+    double energyError;  // Relative change of the total energy over the run
+    std::string logFileName;
+    std::string error;  // Empty unless the run failed
+};
+
+// Describe a parameter sweep read from a YAML file with three blocks:
+//   sweep:  config (the base configuration in configs/), duration, timestep, forceAlgorithm, workers, log
+//   grid:   "block.key" -> list of values; every combination is run
+//   points: list of override maps, each crossed with the grid
+// Runs share one process: they are sorted by estimated cost (longest first) and handed to a pool of workers as they
+// become free, and runs whose initial conditions match share one read-only copy of them. A summary table with a row
+// per run is written to data/sweep<n>.csv.
+class Sweep {
+
+    public:
+        // Constructor
+        explicit Sweep(const std::string sweepFileName);
+
+        // Member functions
+        void run();
+        std::map<std::string, std::map<std::string, std::string>> getRunConfig(const SweepRun& sweepRun) const;
+        std::string getSummary() const;
+
+        // Members
+        std::map<std::string, std::map<std::string, std::string>> baseConfig;
+        std::vector<std::string> overrideKeys;
+        std::vector<SweepRun> runs;
+        int nInitialConditions;
+        int nWorkers;
+        bool log;
+        uint64_t seed;
+        std::string summaryFileName;
+
+    private:
+        std::string getInitialConditionsKey(const std::map<std::string, std::map<std::string, std::string>>& configMap) const;
+};
+
+// Relative cost of a run from its particle count, step count, force algorithm and integrator
+double estimateRunCost(const std::map<std::string, std::map<std::string, std::string>>& configMap, int nParticles);
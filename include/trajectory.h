@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <fstream>
+#include <cstdint>
+
+#include "./asyncwriter.h"
+
+class MappedFile;
+
+// Byte-shuffle 'n' 4-byte words so that byte k of every word lands in plane k (and its inverse)
+void shuffleBytes(const uint8_t* source, size_t n, uint8_t* destination);
+void unshuffleBytes(const uint8_t* source, size_t n, uint8_t* destination);
+
+// Self-contained LZ77 codec in the style of LZ4: literal runs and back-references within a 64 KiB window
+std::vector<uint8_t> compressLZ(const uint8_t* source, size_t size);
+std::vector<uint8_t> decompressLZ(const uint8_t* source, size_t size, size_t decompressedSize);
+
+// Location of one compressed column chunk in a trajectory file
+struct TrajectoryBlock {
+    uint64_t offset;
+    uint32_t size;
+    uint8_t compressed;
+};
+
+// Index entry of one output step
+struct TrajectoryStep {
+    float time;
+    uint32_t nParticles;
+    uint8_t keyframe;
+    std::vector<TrajectoryBlock> blocks;  // Field-major: blocks[field * nChunks + chunk]
+};
+
+// Write a chunked, compressed, columnar trajectory. Each output step stores every field as column chunks of
+// 'chunkSize' particles. Between keyframes (every 'keyframeInterval' steps, or when the particle count changes)
+// the float bits are XORed with the previous output, which zeroes the slowly varying sign, exponent and high
+// mantissa bytes; the words are then byte-shuffled and LZ-compressed. A footer index locates every chunk.
+class TrajectoryWriter {
+
+    public:
+        // Constructor and destructor (the destructor writes the index)
+        TrajectoryWriter(const std::string& fileName, const std::vector<std::string>& fields, uint32_t chunkSize=4096, uint32_t keyframeInterval=16);
+        ~TrajectoryWriter();
+        TrajectoryWriter(const TrajectoryWriter&) = delete;
+        TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+
+        // Member functions
+        void writeStep(const Snapshot& snapshot);
+        void close();
+
+    private:
+        std::ofstream file;
+        std::vector<std::string> fields;
+        uint32_t chunkSize;
+        uint32_t keyframeInterval;
+        std::vector<uint32_t> previousBits;  // Field-major bits of the previous output
+        std::vector<TrajectoryStep> steps;
+        std::vector<uint32_t> columnBits;
+        std::vector<uint8_t> shuffled;
+};
+
+// Random-access reader of a trajectory file: the footer index is loaded once, and reading a field of a particle
+// range at a step only decodes the chunks that cover it, from the preceding keyframe onwards
+class TrajectoryReader {
+
+    public:
+        // Constructor and destructor
+        explicit TrajectoryReader(const std::string& fileName);
+        ~TrajectoryReader();
+
+        // Member functions
+        size_t getNSteps() const;
+        float getTime(size_t step) const;
+        uint32_t getNParticles(size_t step) const;
+        const std::vector<std::string>& getFields() const;
+        size_t findStep(float time) const;
+        std::vector<float> readField(size_t step, const std::string& field, size_t begin=0, size_t end=SIZE_MAX) const;
+
+    private:
+        std::vector<uint32_t> decodeBlock(const TrajectoryBlock& block, size_t count) const;
+
+        std::unique_ptr<MappedFile> file;
+        std::vector<std::string> fields;
+        uint32_t chunkSize;
+        std::vector<TrajectoryStep> steps;
+};
@@ -0,0 +1,76 @@
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+
+#include "../include/asyncwriter.h"
+
+// Wait without holding a core: spin briefly, then back off to short sleeps
+static void backOff(int& attempt) {
+    if (attempt < 64) {
+        std::this_thread::yield();
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(std::min(1000, 10 * (attempt - 63))));
+    }
+    attempt++;
+}
+
+// Constructor definition: every buffer starts out free
+AsyncWriter::AsyncWriter(std::function<void(const Snapshot&)> encoder, size_t nBuffers)
+    : encoder(encoder), buffers(nBuffers), filledQueue(nBuffers), freeQueue(nBuffers), finished(false) {
+    for (Snapshot& buffer : buffers) {
+        freeQueue.push(&buffer);
+    }
+    worker = std::thread(&AsyncWriter::run, this);
+}
+
+AsyncWriter::~AsyncWriter() {
+    finish();
+}
+
+// Get a free snapshot to fill, waiting for the writer if every buffer is in flight
+Snapshot* AsyncWriter::acquire() {
+    Snapshot* snapshot;
+    int attempt = 0;
+    while (!freeQueue.pop(snapshot)) {
+        backOff(attempt);
+    }
+    return snapshot;
+}
+
+// Hand a filled snapshot to the writer thread (there is always room, since there are only 'nBuffers' snapshots)
+void AsyncWriter::submit(Snapshot* snapshot) {
+    filledQueue.push(snapshot);
+}
+
+// Write everything submitted so far and stop the writer thread
+void AsyncWriter::finish() {
+    if (worker.joinable()) {
+        finished.store(true, std::memory_order_release);
+        worker.join();
+    }
+}
+
+// Writer thread: encode snapshots in submission order and recycle their buffers
+void AsyncWriter::run() {
+    Snapshot* snapshot;
+    int attempt = 0;
+    while (true) {
+        if (filledQueue.pop(snapshot)) {
+            encoder(*snapshot);
+            freeQueue.push(snapshot);
+            attempt = 0;
+        } else if (finished.load(std::memory_order_acquire)) {
+            // Submissions happen before 'finished' is set, so one last check drains the queue
+            if (!filledQueue.pop(snapshot)) {
+                return;
+            }
+            encoder(*snapshot);
+            freeQueue.push(snapshot);
+        } else {
+            backOff(attempt);
+        }
+    }
+}
@@ -0,0 +1,219 @@
+#include <array>
+#include <vector>
+#include <string>
+#include <charconv>
+#include <stdexcept>
+#include <algorithm>
+#include <cctype>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../include/catalog.h"
+#include "../include/parallel.h"
+
+
+// Constructor definition
+MappedFile::MappedFile(const std::string& fileName)
+    : data(nullptr), size(0) {
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open file: " + fileName);
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0) {
+        close(fd);
+        throw std::runtime_error("Failed to stat file: " + fileName);
+    }
+    size = fileStat.st_size;
+
+    // Empty files cannot be mapped, but are valid (and empty) catalogs
+    if (size > 0) {
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Failed to map file: " + fileName);
+        }
+        madvise(mapping, size, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(mapping);
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data != nullptr) {
+        munmap(const_cast<char*>(data), size);
+    }
+}
+
+std::vector<std::string> parseColumnList(const std::string& columns) {
+    std::vector<std::string> names;
+    if (columns.find_first_not_of(" \t\r") == std::string::npos) {
+        return names;
+    }
+
+    size_t start = 0;
+    while (true) {
+        size_t end = std::min(columns.find(',', start), columns.size());
+        std::string name = columns.substr(start, end - start);
+        name.erase(0, name.find_first_not_of(" \t\r"));
+        name.erase(name.find_last_not_of(" \t\r") + 1);
+        names.push_back(name);
+        if (end == columns.size()) {
+            return names;
+        }
+        start = end + 1;
+    }
+}
+
+// Index of each catalog field among the columns (-1 if absent): x, y, z, vx, vy, vz, mass, radius
+std::array<int, 8> getFieldColumns(const std::vector<std::string>& columns, bool requireMass) {
+    const std::array<std::string, 8> fields = {"x", "y", "z", "vx", "vy", "vz", "mass", "radius"};
+    std::array<int, 8> fieldColumns;
+    for (int f = 0; f < 8; f++) {
+        auto it = std::find(columns.begin(), columns.end(), fields[f]);
+        fieldColumns[f] = it == columns.end() ? -1 : it - columns.begin();
+    }
+    for (int f : {0, 1, 2, 6}) {
+        if (fieldColumns[f] < 0 && (f != 6 || requireMass)) {
+            throw std::invalid_argument("Catalog is missing the required column " + fields[f] + ".");
+        }
+    }
+    return fieldColumns;
+}
+
+// Fill a catalog from rows of 'nColumns' values each
+ParticleCatalog getCatalogFromRows(const float* values, size_t nRows, size_t nColumns, const std::array<int, 8>& fieldColumns, int nThreads) {
+    ParticleCatalog catalog;
+    catalog.positions.resize(nRows);
+    catalog.velocities.resize(nRows);
+    catalog.masses.resize(nRows);
+    catalog.radii.resize(nRows);
+
+    parallelFor(nRows, nThreads, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const float* row = &values[i * nColumns];
+            for (int k = 0; k < 3; k++) {
+                catalog.positions[i][k] = row[fieldColumns[k]];
+                catalog.velocities[i][k] = fieldColumns[3 + k] < 0 ? 0 : row[fieldColumns[3 + k]];
+            }
+            catalog.masses[i] = fieldColumns[6] < 0 ? 0 : row[fieldColumns[6]];
+            catalog.radii[i] = fieldColumns[7] < 0 ? 0 : row[fieldColumns[7]];
+        }
+    });
+    return catalog;
+}
+
+// Parse the lines in [begin, end), appending 'nColumns' values per non-empty line
+void parseCSVChunk(const char* begin, const char* end, size_t nColumns, std::vector<float>& values) {
+    const char* cursor = begin;
+    while (cursor < end) {
+        const char* lineEnd = std::find(cursor, end, '\n');
+
+        // Skip blank lines
+        const char* firstChar = cursor;
+        while (firstChar < lineEnd && (*firstChar == ' ' || *firstChar == '\t' || *firstChar == '\r')) {
+            firstChar++;
+        }
+        if (firstChar < lineEnd) {
+            for (size_t c = 0; c < nColumns; c++) {
+                while (cursor < lineEnd && (*cursor == ' ' || *cursor == '\t')) {
+                    cursor++;
+                }
+
+                // from_chars does not accept a leading '+'
+                if (cursor < lineEnd && *cursor == '+') {
+                    cursor++;
+                }
+                float value;
+                std::from_chars_result result = std::from_chars(cursor, lineEnd, value);
+                if (result.ec != std::errc()) {
+                    throw std::invalid_argument("Malformed catalog line: " + std::string(firstChar, lineEnd));
+                }
+                values.push_back(value);
+
+                // Move past the separator
+                cursor = std::find(result.ptr, lineEnd, ',');
+                if (cursor < lineEnd) {
+                    cursor++;
+                } else if (c + 1 < nColumns) {
+                    throw std::invalid_argument("Catalog line has too few columns: " + std::string(firstChar, lineEnd));
+                }
+            }
+        }
+        cursor = lineEnd + 1;
+    }
+}
+
+ParticleCatalog loadCatalogCSV(const std::string& fileName, std::vector<std::string> columns, int nThreads, bool requireMass) {
+    MappedFile file(fileName);
+    const char* begin = file.data;
+    const char* end = file.data + file.size;
+
+    // A first line that does not start like a number is a header
+    const char* firstLineEnd = std::find(begin, end, '\n');
+    if (begin < end && !(std::isdigit(static_cast<unsigned char>(*begin)) || *begin == '-' || *begin == '+' || *begin == '.')) {
+        if (columns.empty()) {
+            columns = parseColumnList(std::string(begin, firstLineEnd));
+        }
+        begin = std::min(firstLineEnd + 1, end);
+    }
+    if (columns.empty()) {
+        throw std::invalid_argument("Catalog " + fileName + " has no header, so its columns must be given.");
+    }
+    std::array<int, 8> fieldColumns = getFieldColumns(columns, requireMass);
+
+    // Split into chunks on line boundaries
+    size_t nChunks = std::max(static_cast<size_t>(1), std::min(static_cast<size_t>(getThreadCount(nThreads)), static_cast<size_t>(end - begin) / 4096 + 1));
+    std::vector<const char*> boundaries = {begin};
+    for (size_t chunk = 1; chunk < nChunks; chunk++) {
+        const char* boundary = std::max(begin + (end - begin) * chunk / nChunks, boundaries.back());
+        boundaries.push_back(std::min(std::find(boundary, end, '\n') + 1, end));
+    }
+    boundaries.push_back(end);
+
+    // Parse each chunk on its own thread, then stitch the chunks together in order
+    std::vector<std::vector<float>> chunkValues(nChunks);
+    std::vector<std::string> chunkErrors(nChunks);
+    parallelFor(nChunks, nChunks, [&](size_t first, size_t last) {
+        for (size_t chunk = first; chunk < last; chunk++) {
+            try {
+                chunkValues[chunk].reserve((boundaries[chunk + 1] - boundaries[chunk]) / 8);
+                parseCSVChunk(boundaries[chunk], boundaries[chunk + 1], columns.size(), chunkValues[chunk]);
+            } catch (const std::invalid_argument& e) {
+                chunkErrors[chunk] = e.what();
+            }
+        }
+    });
+    for (const std::string& error : chunkErrors) {
+        if (!error.empty()) {
+            throw std::invalid_argument(error);
+        }
+    }
+
+    std::vector<float> values;
+    size_t nValues = 0;
+    for (const std::vector<float>& chunk : chunkValues) {
+        nValues += chunk.size();
+    }
+    values.reserve(nValues);
+    for (const std::vector<float>& chunk : chunkValues) {
+        values.insert(values.end(), chunk.begin(), chunk.end());
+    }
+    return getCatalogFromRows(values.data(), values.size() / columns.size(), columns.size(), fieldColumns, nThreads);
+}
+
+ParticleCatalog loadCatalogBinary(const std::string& fileName, const std::vector<std::string>& columns, int nThreads, bool requireMass) {
+    std::array<int, 8> fieldColumns = getFieldColumns(columns, requireMass);
+    MappedFile file(fileName);
+
+    size_t recordSize = columns.size() * sizeof(float);
+    if (file.size % recordSize != 0) {
+        throw std::invalid_argument("Binary catalog " + fileName + " is not a whole number of " + std::to_string(columns.size()) + "-column records.");
+    }
+
+    // Read the records straight out of the (page-aligned) mapping
+    return getCatalogFromRows(reinterpret_cast<const float*>(file.data), file.size / recordSize, columns.size(), fieldColumns, nThreads);
+}
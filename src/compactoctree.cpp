@@ -0,0 +1,404 @@
+#include <array>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
+
+#include "../include/compactoctree.h"
+#include "../include/parallel.h"
+
+// Constructor
+CompactOctree::CompactOctree(int leafSize) : leafSize(leafSize), period(0) {
+    if (leafSize < 1) {
+        throw std::invalid_argument("leafSize must be at least 1.");
+    }
+}
+
+// Build around the bounding cube of the particles
+void CompactOctree::build(const std::vector<std::array<float, 3>>& positions, const std::vector<float>& masses) {
+    std::array<float, 3> lower = {0, 0, 0};
+    std::array<float, 3> upper = {0, 0, 0};
+    if (!positions.empty()) {
+        lower = positions[0];
+        upper = positions[0];
+    }
+    for (const std::array<float, 3>& position : positions) {
+        for (int k = 0; k < 3; k++) {
+            lower[k] = std::min(lower[k], position[k]);
+            upper[k] = std::max(upper[k], position[k]);
+        }
+    }
+    float halfWidth = 0;
+    std::array<float, 3> center;
+    for (int k = 0; k < 3; k++) {
+        center[k] = (lower[k] + upper[k]) / 2;
+        halfWidth = std::max(halfWidth, (upper[k] - lower[k]) / 2);
+    }
+    build(positions, masses, center, halfWidth);
+}
+
+// Build inside a given cube (e.g. a periodic box). Cells are split breadth first: the particles of a cell are
+// reordered by octant with a counting sort, and its children are appended together to the node array.
+void CompactOctree::build(const std::vector<std::array<float, 3>>& positions, const std::vector<float>& masses, const std::array<float, 3>& boxCenter, float boxHalfWidth) {
+    if (positions.size() != masses.size()) {
+        throw std::invalid_argument("Expected one mass per position.");
+    }
+    int nParticles = positions.size();
+    order.resize(nParticles);
+    for (int i = 0; i < nParticles; i++) {
+        order[i] = i;
+    }
+
+    nodes.clear();
+    CompactNode root = {};
+    root.center = boxCenter;
+    root.halfWidth = boxHalfWidth;
+    root.end = nParticles;
+    nodes.push_back(root);
+
+    std::vector<int> octants;
+    std::vector<int> sorted;
+    for (size_t n = 0; n < nodes.size(); n++) {
+        CompactNode node = nodes[n];
+        int count = node.end - node.begin;
+        if (count <= leafSize || node.depth >= maxDepth) {
+            continue;
+        }
+
+        // Octant of each particle: bit 0 for x, 1 for y and 2 for z above the center
+        octants.resize(count);
+        std::array<int, 8> counts = {0, 0, 0, 0, 0, 0, 0, 0};
+        for (int j = 0; j < count; j++) {
+            const std::array<float, 3>& position = positions[order[node.begin + j]];
+            int octant = (position[0] > node.center[0]) | (position[1] > node.center[1]) << 1 | (position[2] > node.center[2]) << 2;
+            octants[j] = octant;
+            counts[octant]++;
+        }
+        std::array<int, 8> starts;
+        int start = 0;
+        for (int octant = 0; octant < 8; octant++) {
+            starts[octant] = start;
+            start += counts[octant];
+        }
+        sorted.resize(count);
+        std::array<int, 8> next = starts;
+        for (int j = 0; j < count; j++) {
+            sorted[next[octants[j]]++] = order[node.begin + j];
+        }
+        std::copy(sorted.begin(), sorted.end(), order.begin() + node.begin);
+
+        // Children of the occupied octants
+        uint8_t childMask = 0;
+        uint32_t firstChild = nodes.size();
+        float childHalfWidth = node.halfWidth / 2;
+        for (int octant = 0; octant < 8; octant++) {
+            if (counts[octant] == 0) {
+                continue;
+            }
+            childMask |= 1 << octant;
+            CompactNode child = {};
+            for (int k = 0; k < 3; k++) {
+                child.center[k] = node.center[k] + ((octant >> k & 1) ? childHalfWidth : -childHalfWidth);
+            }
+            child.halfWidth = childHalfWidth;
+            child.begin = node.begin + starts[octant];
+            child.end = child.begin + counts[octant];
+            child.depth = node.depth + 1;
+            nodes.push_back(child);
+        }
+        nodes[n].firstChild = firstChild;
+        nodes[n].childMask = childMask;
+    }
+
+    // Copy the particles into tree order
+    this->positions.resize(nParticles);
+    this->masses.resize(nParticles);
+    slots.resize(nParticles);
+    for (int j = 0; j < nParticles; j++) {
+        this->positions[j] = positions[order[j]];
+        this->masses[j] = masses[order[j]];
+        slots[order[j]] = j;
+    }
+    quadrupoles.clear();
+    computeMoments();
+}
+
+int CompactOctree::getChildCount(const CompactNode& node) const {
+    int count = 0;
+    for (int octant = 0; octant < 8; octant++) {
+        count += node.childMask >> octant & 1;
+    }
+    return count;
+}
+
+// Mass, center of mass and bmax of every node. Children follow their parents, so a reverse sweep sees every child
+// before its parent.
+void CompactOctree::computeMoments() {
+    for (size_t n = nodes.size(); n-- > 0;) {
+        CompactNode& node = nodes[n];
+        int nChildren = getChildCount(node);
+        std::array<double, 3> weighted = {0, 0, 0};
+        double mass = 0;
+        if (nChildren == 0) {
+            for (uint32_t j = node.begin; j < node.end; j++) {
+                for (int k = 0; k < 3; k++) {
+                    weighted[k] += static_cast<double>(masses[j]) * positions[j][k];
+                }
+                mass += masses[j];
+            }
+        } else {
+            for (int c = 0; c < nChildren; c++) {
+                const CompactNode& child = nodes[node.firstChild + c];
+                for (int k = 0; k < 3; k++) {
+                    weighted[k] += static_cast<double>(child.mass) * child.centerOfMass[k];
+                }
+                mass += child.mass;
+            }
+        }
+        node.mass = mass;
+        for (int k = 0; k < 3; k++) {
+            // Massless nodes are centered on their first particle, as in Octree
+            node.centerOfMass[k] = mass > 0 ? weighted[k] / mass : (node.end > node.begin ? positions[node.begin][k] : node.center[k]);
+        }
+
+        node.bmax = 0;
+        if (nChildren == 0) {
+            for (uint32_t j = node.begin; j < node.end; j++) {
+                float dx = positions[j][0] - node.centerOfMass[0];
+                float dy = positions[j][1] - node.centerOfMass[1];
+                float dz = positions[j][2] - node.centerOfMass[2];
+                node.bmax = std::max(node.bmax, std::sqrt(dx * dx + dy * dy + dz * dz));
+            }
+        } else {
+            for (int c = 0; c < nChildren; c++) {
+                const CompactNode& child = nodes[node.firstChild + c];
+                float dx = child.centerOfMass[0] - node.centerOfMass[0];
+                float dy = child.centerOfMass[1] - node.centerOfMass[1];
+                float dz = child.centerOfMass[2] - node.centerOfMass[2];
+                node.bmax = std::max(node.bmax, child.bmax + std::sqrt(dx * dx + dy * dy + dz * dz));
+            }
+        }
+    }
+}
+
+// Quadrupole moments about each node's center of mass, bottom up: leaves sum their particles, and internal nodes shift
+// the moments of their children with the parallel-axis theorem
+void CompactOctree::computeQuadrupoles() {
+    quadrupoles.assign(nodes.size(), {0, 0, 0, 0, 0, 0});
+    for (size_t n = nodes.size(); n-- > 0;) {
+        const CompactNode& node = nodes[n];
+        std::array<float, 6>& quadrupole = quadrupoles[n];
+        if (node.childMask == 0) {
+            for (uint32_t j = node.begin; j < node.end; j++) {
+                std::array<float, 3> d = {positions[j][0] - node.centerOfMass[0], positions[j][1] - node.centerOfMass[1], positions[j][2] - node.centerOfMass[2]};
+                float d2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+                quadrupole[0] += masses[j] * (3 * d[0] * d[0] - d2);
+                quadrupole[1] += masses[j] * (3 * d[1] * d[1] - d2);
+                quadrupole[2] += masses[j] * (3 * d[2] * d[2] - d2);
+                quadrupole[3] += masses[j] * 3 * d[0] * d[1];
+                quadrupole[4] += masses[j] * 3 * d[0] * d[2];
+                quadrupole[5] += masses[j] * 3 * d[1] * d[2];
+            }
+            continue;
+        }
+
+        int nChildren = getChildCount(node);
+        for (int c = 0; c < nChildren; c++) {
+            uint32_t childIndex = node.firstChild + c;
+            const CompactNode& child = nodes[childIndex];
+            std::array<float, 3> d = {child.centerOfMass[0] - node.centerOfMass[0], child.centerOfMass[1] - node.centerOfMass[1], child.centerOfMass[2] - node.centerOfMass[2]};
+            float d2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+            for (int k = 0; k < 6; k++) {
+                quadrupole[k] += quadrupoles[childIndex][k];
+            }
+            quadrupole[0] += child.mass * (3 * d[0] * d[0] - d2);
+            quadrupole[1] += child.mass * (3 * d[1] * d[1] - d2);
+            quadrupole[2] += child.mass * (3 * d[2] * d[2] - d2);
+            quadrupole[3] += child.mass * 3 * d[0] * d[1];
+            quadrupole[4] += child.mass * 3 * d[0] * d[2];
+            quadrupole[5] += child.mass * 3 * d[1] * d[2];
+        }
+    }
+}
+
+// Offset from one coordinate to another, to the nearest periodic image when the tree has a period
+float CompactOctree::getOffset(float from, float to) const {
+    float offset = to - from;
+    if (period > 0) {
+        offset -= period * std::round(offset / period);
+    }
+    return offset;
+}
+
+// Squared distance from a point to the closest point of a node's cell
+float CompactOctree::getCellDistance2(const CompactNode& node, const std::array<float, 3>& point) const {
+    float distance2 = 0;
+    for (int k = 0; k < 3; k++) {
+        float excess = std::max(0.f, std::abs(getOffset(point[k], node.center[k])) - node.halfWidth);
+        distance2 += excess * excess;
+    }
+    return distance2;
+}
+
+int CompactOctree::radiusQuery(const std::array<float, 3>& center, float radius, int* indices, int maxResults) const {
+    int count = 0;
+    float radius2 = radius * radius;
+    std::array<uint32_t, 8 * maxDepth + 8> stack;
+    int stackSize = 0;
+    if (!nodes.empty()) {
+        stack[stackSize++] = 0;
+    }
+    while (stackSize > 0) {
+        const CompactNode& node = nodes[stack[--stackSize]];
+        if (getCellDistance2(node, center) > radius2) {
+            continue;
+        }
+        if (node.childMask == 0) {
+            for (uint32_t j = node.begin; j < node.end; j++) {
+                float dx = getOffset(center[0], positions[j][0]);
+                float dy = getOffset(center[1], positions[j][1]);
+                float dz = getOffset(center[2], positions[j][2]);
+                if (dx * dx + dy * dy + dz * dz <= radius2) {
+                    if (count < maxResults) {
+                        indices[count] = order[j];
+                    }
+                    count++;
+                }
+            }
+            continue;
+        }
+        for (int c = getChildCount(node) - 1; c >= 0; c--) {
+            stack[stackSize++] = node.firstChild + c;
+        }
+    }
+    return count;
+}
+
+// Particles in the box [lower, upper] (inclusive, not wrapped around a periodic box)
+int CompactOctree::boxQuery(const std::array<float, 3>& lower, const std::array<float, 3>& upper, int* indices, int maxResults) const {
+    int count = 0;
+    std::array<uint32_t, 8 * maxDepth + 8> stack;
+    int stackSize = 0;
+    if (!nodes.empty()) {
+        stack[stackSize++] = 0;
+    }
+    while (stackSize > 0) {
+        const CompactNode& node = nodes[stack[--stackSize]];
+        bool overlaps = true;
+        for (int k = 0; k < 3; k++) {
+            overlaps = overlaps && node.center[k] - node.halfWidth <= upper[k] && lower[k] <= node.center[k] + node.halfWidth;
+        }
+        if (!overlaps) {
+            continue;
+        }
+        if (node.childMask == 0) {
+            for (uint32_t j = node.begin; j < node.end; j++) {
+                const std::array<float, 3>& position = positions[j];
+                if (lower[0] <= position[0] && position[0] <= upper[0] && lower[1] <= position[1] && position[1] <= upper[1] && lower[2] <= position[2] && position[2] <= upper[2]) {
+                    if (count < maxResults) {
+                        indices[count] = order[j];
+                    }
+                    count++;
+                }
+            }
+            continue;
+        }
+        for (int c = getChildCount(node) - 1; c >= 0; c--) {
+            stack[stackSize++] = node.firstChild + c;
+        }
+    }
+    return count;
+}
+
+// Depth first with the children nearest the point first, pruning cells beyond the k-th nearest particle found so far.
+// The results are kept sorted by insertion, which is cheap for the small k of neighbor searches.
+int CompactOctree::kNearest(const std::array<float, 3>& center, int k, int* indices, float* distances2) const {
+    int count = 0;
+    if (k <= 0) {
+        return 0;
+    }
+    std::array<uint32_t, 8 * maxDepth + 8> stack;
+    int stackSize = 0;
+    if (!nodes.empty()) {
+        stack[stackSize++] = 0;
+    }
+    while (stackSize > 0) {
+        const CompactNode& node = nodes[stack[--stackSize]];
+        if (count == k && getCellDistance2(node, center) > distances2[k - 1]) {
+            continue;
+        }
+        if (node.childMask == 0) {
+            for (uint32_t j = node.begin; j < node.end; j++) {
+                float dx = getOffset(center[0], positions[j][0]);
+                float dy = getOffset(center[1], positions[j][1]);
+                float dz = getOffset(center[2], positions[j][2]);
+                float distance2 = dx * dx + dy * dy + dz * dz;
+                if (count == k && distance2 >= distances2[k - 1]) {
+                    continue;
+                }
+                int slot = count < k ? count++ : k - 1;
+                while (slot > 0 && distances2[slot - 1] > distance2) {
+                    distances2[slot] = distances2[slot - 1];
+                    indices[slot] = indices[slot - 1];
+                    slot--;
+                }
+                distances2[slot] = distance2;
+                indices[slot] = order[j];
+            }
+            continue;
+        }
+
+        // Push the farthest children first, so the nearest is visited next
+        int nChildren = getChildCount(node);
+        std::array<std::pair<float, uint32_t>, 8> children;
+        for (int c = 0; c < nChildren; c++) {
+            children[c] = {getCellDistance2(nodes[node.firstChild + c], center), node.firstChild + c};
+        }
+        std::sort(children.begin(), children.begin() + nChildren, [](const std::pair<float, uint32_t>& a, const std::pair<float, uint32_t>& b) { return a.first > b.first; });
+        for (int c = 0; c < nChildren; c++) {
+            stack[stackSize++] = children[c].second;
+        }
+    }
+    return count;
+}
+
+void CompactOctree::radiusQueries(const std::vector<std::array<float, 3>>& centers, float radius, int maxResults, std::vector<int>& indices, std::vector<int>& counts, int nThreads) const {
+    if (indices.size() < centers.size() * maxResults || counts.size() < centers.size()) {
+        throw std::invalid_argument("Query buffers are too small.");
+    }
+    parallelFor(centers.size(), nThreads, [&](size_t begin, size_t end) {
+        for (size_t q = begin; q < end; q++) {
+            counts[q] = radiusQuery(centers[q], radius, indices.data() + q * maxResults, maxResults);
+        }
+    });
+}
+
+void CompactOctree::boxQueries(const std::vector<std::array<float, 3>>& lowers, const std::vector<std::array<float, 3>>& uppers, int maxResults, std::vector<int>& indices, std::vector<int>& counts, int nThreads) const {
+    if (lowers.size() != uppers.size()) {
+        throw std::invalid_argument("Expected one upper corner per lower corner.");
+    }
+    if (indices.size() < lowers.size() * maxResults || counts.size() < lowers.size()) {
+        throw std::invalid_argument("Query buffers are too small.");
+    }
+    parallelFor(lowers.size(), nThreads, [&](size_t begin, size_t end) {
+        for (size_t q = begin; q < end; q++) {
+            counts[q] = boxQuery(lowers[q], uppers[q], indices.data() + q * maxResults, maxResults);
+        }
+    });
+}
+
+void CompactOctree::kNearestQueries(const std::vector<std::array<float, 3>>& centers, int k, std::vector<int>& indices, std::vector<float>& distances2, int nThreads) const {
+    if (indices.size() < centers.size() * k || distances2.size() < centers.size() * k) {
+        throw std::invalid_argument("Query buffers are too small.");
+    }
+    parallelFor(centers.size(), nThreads, [&](size_t begin, size_t end) {
+        for (size_t q = begin; q < end; q++) {
+            int found = kNearest(centers[q], k, indices.data() + q * k, distances2.data() + q * k);
+            for (int slot = found; slot < k; slot++) {
+                indices[q * k + slot] = -1;
+                distances2[q * k + slot] = std::numeric_limits<float>::infinity();
+            }
+        }
+    });
+}
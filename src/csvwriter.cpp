@@ -0,0 +1,55 @@
+#include <vector>
+#include <charconv>
+#include <algorithm>
+#include <string_view>
+
+#include "../include/csvwriter.h"
+
+// Longest float in fixed notation with 6 decimals ("-3.4e38" written out), plus a separator
+const size_t MAX_FIELD_CHARS = 48;
+
+// Constructor definition
+CsvWriter::CsvWriter(bool shortest)
+    : shortest(shortest), buffer(4096), length(0) {};
+
+// Start a new row
+void CsvWriter::clear() {
+    length = 0;
+}
+
+void CsvWriter::reserve(size_t extra) {
+    if (length + extra > buffer.size()) {
+        buffer.resize(std::max(2 * buffer.size(), length + extra));
+    }
+}
+
+// Append a value followed by a separator
+void CsvWriter::append(float value) {
+    reserve(MAX_FIELD_CHARS);
+    char* first = buffer.data() + length;
+    char* last = buffer.data() + buffer.size();
+    std::to_chars_result result = shortest ? std::to_chars(first, last, value) : std::to_chars(first, last, value, std::chars_format::fixed, 6);
+    *result.ptr = ',';
+    length = result.ptr + 1 - buffer.data();
+}
+
+void CsvWriter::append(const float* values, size_t n) {
+    reserve(n * MAX_FIELD_CHARS);
+    for (size_t i = 0; i < n; i++) {
+        append(values[i]);
+    }
+}
+
+// Replace the trailing separator with a newline
+void CsvWriter::endRow() {
+    if (length > 0 && buffer[length - 1] == ',') {
+        buffer[length - 1] = '\n';
+    } else {
+        reserve(1);
+        buffer[length++] = '\n';
+    }
+}
+
+std::string_view CsvWriter::view() const {
+    return std::string_view(buffer.data(), length);
+}
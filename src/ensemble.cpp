@@ -0,0 +1,276 @@
+#include <iostream>
+#include <string>
+#include <array>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+
+#include "../include/ensemble.h"
+#include "../include/environment.h"
+#include "../include/catalog.h"
+#include "../include/parallel.h"
+
+namespace fs = std::filesystem;
+extern float G;
+extern std::string REPOPATH;
+
+
+// Constructor for config files
+Ensemble::Ensemble(const std::string configFileName, uint64_t firstSeed, int nRealizations, const bool log, std::string logFilePrefix)
+    : Ensemble(loadConfig(configFileName), firstSeed, nRealizations, log, logFilePrefix) {}
+
+// Constructor: sample every realization from the configuration and pack them into batches
+Ensemble::Ensemble(const std::map<std::string, std::map<std::string, std::string>>& configMap, uint64_t firstSeed, int nRealizations, const bool log, std::string logFilePrefix)
+    : firstSeed(firstSeed), nRealizations(nRealizations), log(log), time(0), softening("none", 0), nThreads(0), accelerationsCurrent(false) {
+
+    if (nRealizations < 1) {
+        throw std::invalid_argument("An ensemble needs at least one realization.");
+    }
+
+    std::map<std::string, std::string> globalConfigMap = configMap.at("global");
+    if (globalConfigMap.find("particleFile") != globalConfigMap.end()) {
+        throw std::invalid_argument("An ensemble samples its realizations and cannot load a particleFile.");
+    }
+    if (globalConfigMap.find("softening") != globalConfigMap.end()) {
+        float softeningLength = globalConfigMap.find("softeningLength") != globalConfigMap.end() ? std::stof(globalConfigMap.at("softeningLength")) : 0;
+        softening = Softening(globalConfigMap.at("softening"), softeningLength);
+    }
+    if (globalConfigMap.find("nThreads") != globalConfigMap.end()) {
+        nThreads = std::stoi(globalConfigMap.at("nThreads"));
+    }
+    nParticles = std::stoi(globalConfigMap.at("nParticles"));
+    nBatches = (nRealizations + ENSEMBLE_LANES - 1) / ENSEMBLE_LANES;
+
+    size_t nValues = static_cast<size_t>(nBatches) * nParticles * ENSEMBLE_LANES;
+    for (std::vector<float>* values : {&x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az, &mass}) {
+        values->assign(nValues, 0);
+    }
+
+    // Each realization is sampled on its own, so it is the same for any ensemble that contains its seed; the padding
+    // lanes of the last batch copy the last realization
+    parallelFor(static_cast<size_t>(nBatches) * ENSEMBLE_LANES, nThreads, [&](size_t begin, size_t end) {
+        for (size_t lane = begin; lane < end; lane++) {
+            int realization = std::min(static_cast<int>(lane), nRealizations - 1);
+            ParticleCatalog sample = sampleParticles(configMap, nParticles, firstSeed + realization, 1);
+            for (int i = 0; i < nParticles; i++) {
+                size_t index = (lane / ENSEMBLE_LANES * nParticles + i) * ENSEMBLE_LANES + lane % ENSEMBLE_LANES;
+                x[index] = sample.positions[i][0];
+                y[index] = sample.positions[i][1];
+                z[index] = sample.positions[i][2];
+                vx[index] = sample.velocities[i][0];
+                vy[index] = sample.velocities[i][1];
+                vz[index] = sample.velocities[i][2];
+                mass[index] = sample.masses[i];
+            }
+        }
+    });
+
+    // Create a log file if we want one
+    if (log == true) {
+        std::string dataPath = REPOPATH + "/data";
+        if (!fs::exists(dataPath)) {
+            fs::create_directory(dataPath);
+        }
+        std::vector<std::string> lastLogFileNames;
+        for (const auto& entry : fs::directory_iterator(dataPath)) {
+            if (fs::is_regular_file(entry.status())) {
+                lastLogFileNames.push_back(entry.path().filename().string());
+            }
+        }
+        int lastLogNum = getLargestLabelNumber(lastLogFileNames, logFilePrefix);
+        logFileName = dataPath + "/" + logFilePrefix + std::to_string(lastLogNum + 1) + ".csv";
+    }
+}
+
+// Index of a particle of a realization in the batched arrays
+size_t Ensemble::getIndex(int realization, int particle) const {
+    return (static_cast<size_t>(realization / ENSEMBLE_LANES) * nParticles + particle) * ENSEMBLE_LANES + realization % ENSEMBLE_LANES;
+}
+
+std::array<float, 3> Ensemble::getPosition(int realization, int particle) const {
+    size_t index = getIndex(realization, particle);
+    return {x[index], y[index], z[index]};
+}
+
+std::array<float, 3> Ensemble::getVelocity(int realization, int particle) const {
+    size_t index = getIndex(realization, particle);
+    return {vx[index], vy[index], vz[index]};
+}
+
+float Ensemble::getMass(int realization, int particle) const {
+    return mass[getIndex(realization, particle)];
+}
+
+// Direct-summation accelerations of every realization in a batch. The kernel is picked once here, so that the lane
+// loop of each instantiation below is branch-free.
+void Ensemble::computeAccelerations(int batch) {
+    size_t batchStart = static_cast<size_t>(batch) * nParticles * ENSEMBLE_LANES;
+    std::fill(ax.begin() + batchStart, ax.begin() + batchStart + nParticles * ENSEMBLE_LANES, 0.0f);
+    std::fill(ay.begin() + batchStart, ay.begin() + batchStart + nParticles * ENSEMBLE_LANES, 0.0f);
+    std::fill(az.begin() + batchStart, az.begin() + batchStart + nParticles * ENSEMBLE_LANES, 0.0f);
+
+    switch (softening.getKernel()) {
+        case Softening::PLUMMER:
+            accumulateAccelerations<&Softening::plummerForceFactor>(batchStart);
+            break;
+        case Softening::SPLINE:
+            accumulateAccelerations<&Softening::splineForceFactor>(batchStart);
+            break;
+        default:
+            accumulateAccelerations<&Softening::newtonianForceFactor>(batchStart);
+    }
+}
+
+// Pairwise accelerations for one kernel. The innermost loop runs over the lanes, which are contiguous and independent,
+// so each pair is evaluated for the whole batch by one vector loop. G and the kernel are copied to locals so that the
+// stores to the accelerations cannot alias them.
+template <float (Softening::*forceFactor)(float) const>
+void Ensemble::accumulateAccelerations(size_t batchStart) {
+    const float g0 = G;
+    const Softening kernel = softening;
+    const float* px = x.data();
+    const float* py = y.data();
+    const float* pz = z.data();
+    const float* pm = mass.data();
+    float* pax = ax.data();
+    float* pay = ay.data();
+    float* paz = az.data();
+
+    for (int i = 0; i < nParticles; i++) {
+        size_t iStart = batchStart + i * ENSEMBLE_LANES;
+        for (int j = i + 1; j < nParticles; j++) {
+            size_t jStart = batchStart + j * ENSEMBLE_LANES;
+            #pragma omp simd
+            for (int lane = 0; lane < ENSEMBLE_LANES; lane++) {
+                float dx = px[jStart + lane] - px[iStart + lane];
+                float dy = py[jStart + lane] - py[iStart + lane];
+                float dz = pz[jStart + lane] - pz[iStart + lane];
+                float g = g0 * (kernel.*forceFactor)(dx * dx + dy * dy + dz * dz);
+                float gi = g * pm[jStart + lane];
+                float gj = g * pm[iStart + lane];
+                pax[iStart + lane] += gi * dx;
+                pay[iStart + lane] += gi * dy;
+                paz[iStart + lane] += gi * dz;
+                pax[jStart + lane] -= gj * dx;
+                pay[jStart + lane] -= gj * dy;
+                paz[jStart + lane] -= gj * dz;
+            }
+        }
+    }
+}
+
+// Advance every realization by one kick-drift-kick step; each thread takes whole batches
+void Ensemble::step(const float timestep) {
+    size_t batchSize = static_cast<size_t>(nParticles) * ENSEMBLE_LANES;
+    bool computeInitial = !accelerationsCurrent;
+    parallelFor(nBatches, nThreads, [&](size_t begin, size_t end) {
+        for (size_t batch = begin; batch < end; batch++) {
+            if (computeInitial) {
+                computeAccelerations(batch);
+            }
+            size_t batchStart = batch * batchSize;
+            for (size_t k = batchStart; k < batchStart + batchSize; k++) {
+                vx[k] += 0.5f * timestep * ax[k];
+                vy[k] += 0.5f * timestep * ay[k];
+                vz[k] += 0.5f * timestep * az[k];
+                x[k] += timestep * vx[k];
+                y[k] += timestep * vy[k];
+                z[k] += timestep * vz[k];
+            }
+            computeAccelerations(batch);
+            for (size_t k = batchStart; k < batchStart + batchSize; k++) {
+                vx[k] += 0.5f * timestep * ax[k];
+                vy[k] += 0.5f * timestep * ay[k];
+                vz[k] += 0.5f * timestep * az[k];
+            }
+        }
+    });
+    accelerationsCurrent = true;
+    time += timestep;
+}
+
+// Total (kinetic plus potential) energy of each realization
+std::vector<double> Ensemble::getEnergies() const {
+    std::vector<double> energies(nRealizations, 0);
+    parallelFor(nRealizations, nThreads, [&](size_t begin, size_t end) {
+        for (size_t realization = begin; realization < end; realization++) {
+            double energy = 0;
+            for (int i = 0; i < nParticles; i++) {
+                size_t iIndex = getIndex(realization, i);
+                energy += 0.5 * mass[iIndex] * (static_cast<double>(vx[iIndex]) * vx[iIndex] + static_cast<double>(vy[iIndex]) * vy[iIndex] + static_cast<double>(vz[iIndex]) * vz[iIndex]);
+                for (int j = i + 1; j < nParticles; j++) {
+                    size_t jIndex = getIndex(realization, j);
+                    float dx = x[jIndex] - x[iIndex];
+                    float dy = y[jIndex] - y[iIndex];
+                    float dz = z[jIndex] - z[iIndex];
+                    energy += static_cast<double>(G) * mass[iIndex] * mass[jIndex] * softening.potential(dx * dx + dy * dy + dz * dz);
+                }
+            }
+            energies[realization] = energy;
+        }
+    });
+    return energies;
+}
+
+// One row per realization: the time, the realization index (its seed is firstSeed plus the index), its total energy
+// and then mass, position and velocity of each particle
+std::string Ensemble::getLogHeader() const {
+    std::string header = "Time,realization,energy";
+    for (int i = 0; i < nParticles; i++) {
+        for (std::string field : {"mass", "x", "y", "z", "vx", "vy", "vz"}) {
+            header += "," + field + std::to_string(i);
+        }
+    }
+    return header + "\n";
+}
+
+void Ensemble::appendLogRows(CsvWriter& writer) const {
+    std::vector<double> energies = getEnergies();
+    for (int realization = 0; realization < nRealizations; realization++) {
+        writer.append(time);
+        writer.append(static_cast<float>(realization));
+        writer.append(static_cast<float>(energies[realization]));
+        for (int i = 0; i < nParticles; i++) {
+            size_t index = getIndex(realization, i);
+            for (const std::vector<float>* values : {&mass, &x, &y, &z, &vx, &vy, &vz}) {
+                writer.append((*values)[index]);
+            }
+        }
+        writer.endRow();
+    }
+}
+
+// Simulate every realization for 'duration', logging all of them to one csv every 'timestep'
+void Ensemble::simulate(const float duration, const float timestep) {
+    std::ofstream logFile;
+    CsvWriter writer;
+    if (log == true) {
+        logFile.open(logFileName);
+        if (!logFile.is_open()) {
+            std::cerr << "Failed to open the file: " << logFileName << std::endl;
+        }
+    }
+    if (logFile.is_open()) {
+        logFile << getLogHeader();
+        appendLogRows(writer);
+        logFile << writer.view();
+    }
+
+    int totalSteps = std::ceil(duration / timestep * (1 - 1e-6));
+    for (int i = 0; i < totalSteps; i++) {
+        step(timestep);
+        if (logFile.is_open()) {
+            writer.clear();
+            appendLogRows(writer);
+            logFile << writer.view();
+        }
+    }
+
+    if (logFile.is_open()) {
+        logFile.close();
+        std::cout << "Successfully logged to " << logFileName << std::endl;
+    }
+}
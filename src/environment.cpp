@@ -9,12 +9,23 @@
 #include <filesystem>
 #include <utility>
 #include <algorithm>
+#include <numeric>
+#include <cstdio>
+#include <unordered_map>
+#include <type_traits>
+#include <chrono>
 #include <yaml-cpp/yaml.h>
 
 #include "../include/environment.h"
 #include "../include/body.h"
 #include "../include/particle.h"
 #include "../include/octree.h"
+#include "../include/models.h"
+#include "../include/catalog.h"
+#include "../include/csvwriter.h"
+#include "../include/trajectory.h"
+#include "../include/kepler.h"
+#include "../include/parallel.h"
 
 
 namespace fs = std::filesystem;
@@ -81,9 +92,9 @@ inline int getLargestLabelNumber(const std::vector<std::string>& filenames, cons
     for (const std::string& filename : filenames) {
         size_t pos = filename.find(logFilePrefix);
         if (pos != std::string::npos) {
-            // Assuming "run" is followed immediately by the number and then ".csv"
-            size_t start = pos + 3; // Start of the number (after "run")
-            size_t end = filename.rfind(".csv"); // Find the start of ".csv"
+            // Assuming the prefix is followed immediately by the number and then the extension (".csv" or ".htrj")
+            size_t start = pos + logFilePrefix.size(); // Start of the number (after the prefix)
+            size_t end = filename.rfind('.'); // Find the start of the extension
 
             if (end != std::string::npos && end > start) {
                 std::string numberPart = filename.substr(start, end - start);
@@ -106,19 +117,27 @@ float getEuclidianDistance(std::array<float, 3> coords1, std::array<float, 3> co
     return sqrt(pow(coords1[0] - coords2[0], 2) + pow(coords1[1] - coords2[1], 2) + pow(coords1[2] - coords2[2], 2));
 }
 
+// Format a one-line progress report; the energy error is left out when it is not a number
+std::string formatProgress(int stepNumber, int totalSteps, float simTime, double elapsed, double energyError) {
+    double rate = elapsed > 0 ? stepNumber / elapsed : 0;
+    double eta = rate > 0 ? (totalSteps - stepNumber) / rate : 0;
+    char line[256];
+    int length = snprintf(line, sizeof(line), "step %d/%d  t=%g  %.1f steps/s  ETA %.1f s", stepNumber, totalSteps, simTime, rate, eta);
+    if (!std::isnan(energyError)) {
+        snprintf(line + length, sizeof(line) - length, "  dE/E=%.3e", energyError);
+    }
+    return std::string(line) + "\n";
+}
+
 std::array<float, 2> defaultXCoords = {0, 0};
 std::array<float, 2> defaultYCoords = {0, 0};
 std::array<float, 2> defaultZCoords = {0, 0};
 
 template <typename T>
 GravitationalEnvironment<T>::GravitationalEnvironment(const std::vector<std::shared_ptr<T>>& particlePtrs, const bool log, std::string logFilePrefix, std::string forceAlgorithm)
-    : particlePtrs(particlePtrs), log(log), time(0), nParticles(particlePtrs.size()), envOctree(defaultXCoords, defaultYCoords, defaultZCoords, true) {  
-    // Determine which algorithm to use
-    if (forceAlgorithm == "pair-wise") {
-        getForces = std::bind(&GravitationalEnvironment::getForcesPairWise, this, std::placeholders::_1);
-    } else {
-        getForces = std::bind(&GravitationalEnvironment::getForcesBarnesHut, this, std::placeholders::_1);
-    }
+    : forceAlgorithm(forceAlgorithm), theta(0.5), leafSize(1), multipoleOrder(0), openingCriterion("geometric"), forceAccuracy(0.005), interactionListInterval(0), interactionListMargin(0.1), interactionListAge(0), fullWalkCount(0), treeLayout("pointer"), particlePtrs(particlePtrs), log(log), time(0), nParticles(particlePtrs.size()), envOctree(defaultXCoords, defaultYCoords, defaultZCoords, true), octreeCurrent(false), forcesCached(false), tracerAccelerationsCurrent(false), diagnosticsInterval(0), stepCount(0), linkingLength(0), groupInterval(1), minGroupMembers(20), collisionMode("none"), restitution(1), nParticleIds(0), softening("none", 0), periodic(false), boxSize(0), boxMin(0), seed(0), nThreads(0), logFields({"mass", "x", "y", "z", "vx", "vy", "vz"}), outputBuffers(2), outputFraction(1), timestepping("fixed"), timestepEta(0.02), timestepLength(0), dtMin(0), dtMax(0), timestepGrowth(2), lastTimestep(0), outputFormat("csv"), trajectoryChunkSize(4096), keyframeInterval(16), verbosity("progress"), progressInterval(1), logFieldIds({0, 1, 2, 3, 4, 5, 6}), outputSubset(false), massesChanged(false), openingRule(GEOMETRIC) {  
+    // Determine which force algorithm and integrator to use
+    setIntegrator("euler");
 
     // Create a log file if we want one
     if (log == true) {
@@ -148,13 +167,9 @@ GravitationalEnvironment<T>::GravitationalEnvironment(const std::vector<std::sha
 // Constructor for config files
 template <typename T>
 GravitationalEnvironment<T>::GravitationalEnvironment(const std::string configFileName, const bool log, std::string logFilePrefix, std::string forceAlgorithm)
-    : log(log), time(0), envOctree(defaultXCoords, defaultYCoords, defaultZCoords, true) {
-    // Determine which algorithm to use
-    if (forceAlgorithm == "pair-wise") {
-        getForces = std::bind(&GravitationalEnvironment::getForcesPairWise, this, std::placeholders::_1);
-    } else {
-        getForces = std::bind(&GravitationalEnvironment::getForcesBarnesHut, this, std::placeholders::_1);
-    }
+    : forceAlgorithm(forceAlgorithm), theta(0.5), leafSize(1), multipoleOrder(0), openingCriterion("geometric"), forceAccuracy(0.005), interactionListInterval(0), interactionListMargin(0.1), interactionListAge(0), fullWalkCount(0), treeLayout("pointer"), log(log), time(0), envOctree(defaultXCoords, defaultYCoords, defaultZCoords, true), octreeCurrent(false), forcesCached(false), tracerAccelerationsCurrent(false), diagnosticsInterval(0), stepCount(0), linkingLength(0), groupInterval(1), minGroupMembers(20), collisionMode("none"), restitution(1), nParticleIds(0), softening("none", 0), periodic(false), boxSize(0), boxMin(0), seed(0), nThreads(0), logFields({"mass", "x", "y", "z", "vx", "vy", "vz"}), outputBuffers(2), outputFraction(1), timestepping("fixed"), timestepEta(0.02), timestepLength(0), dtMin(0), dtMax(0), timestepGrowth(2), lastTimestep(0), outputFormat("csv"), trajectoryChunkSize(4096), keyframeInterval(16), verbosity("progress"), progressInterval(1), logFieldIds({0, 1, 2, 3, 4, 5, 6}), outputSubset(false), massesChanged(false), openingRule(GEOMETRIC) {
+    // Determine which force algorithm and integrator to use
+    setIntegrator("euler");
 
     // Get particles
     loadParticlesFromConfig(configFileName);
@@ -182,24 +197,58 @@ GravitationalEnvironment<T>::GravitationalEnvironment(const std::string configFi
 }
 
 
-// Load a full environment from the configuration file
-template <typename T>
-void GravitationalEnvironment<T>::loadParticlesFromConfig(const std::string configFileName) {
+// Read a csv or binary catalog. Relative paths are resolved against the repository path; an empty format defaults
+// to csv for '.csv' files and binary otherwise, and binary files without columns default to 'defaultColumns'.
+static ParticleCatalog readCatalog(std::string fileName, std::string format, std::vector<std::string> columns, const std::vector<std::string>& defaultColumns, int nThreads, bool requireMass=true) {
+    if (!fs::path(fileName).is_absolute()) {
+        fileName = REPOPATH + "/" + fileName;
+    }
+    bool isCSV = fileName.size() >= 4 && fileName.substr(fileName.size() - 4) == ".csv";
+    if (format.empty()) {
+        format = isCSV ? "csv" : "binary";
+    }
 
-    // Get configuration map
-    std::map<std::string, std::map<std::string, std::string>> configMap = loadConfig(configFileName);
+    if (format == "csv") {
+        return loadCatalogCSV(fileName, columns, nThreads, requireMass);
+    } else if (format == "binary") {
+        return loadCatalogBinary(fileName, columns.empty() ? defaultColumns : columns, nThreads, requireMass);
+    }
+    throw std::invalid_argument("Invalid particle file format " + format + ".");
+}
 
-    // Grab the gloabl config params for the environment
-    std::map<std::string, std::string> globalConfigMap = configMap.at("global");
-    int nParticles = std::stoi(globalConfigMap.at("nParticles"));
+// Look up an optional key of a config block
+static std::string getConfigValue(const std::map<std::string, std::string>& configMap, const std::string& key) {
+    return configMap.find(key) != configMap.end() ? configMap.at(key) : "";
+}
+
+// Sample 'nParticles' particles from the property distributions of a configuration, drawing every random number
+// from 'seed'. Radii are left at zero.
+ParticleCatalog sampleParticles(const std::map<std::string, std::map<std::string, std::string>>& configMap, int nParticles, uint64_t seed, int nThreads) {
 
     // Generate distributions for each param
     std::map<std::string, std::vector<float>> envParams;
 
-    // Iterate through the configuration and sample particles according to config prescirption
+    // Phase-space models generate positions, velocities and masses jointly
+    for (auto const& [property, propertyDist] : configMap) {
+        if (property != "global" && isPhaseSpaceModel(propertyDist.at("dist"))) {
+            PhaseSpaceSample sample = samplePhaseSpaceModel(propertyDist, nParticles, seed, nThreads);
+            for (std::string coordinate : {"x", "y", "z", "vx", "vy", "vz", "mass"}) {
+                envParams[coordinate].resize(nParticles);
+            }
+            for (int i = 0; i < nParticles; i++) {
+                for (int k = 0; k < 3; k++) {
+                    envParams[std::string(1, "xyz"[k])][i] = sample.positions[i][k];
+                    envParams["v" + std::string(1, "xyz"[k])][i] = sample.velocities[i][k];
+                }
+                envParams["mass"][i] = sample.masses[i];
+            }
+        }
+    }
+
+    // Iterate through the configuration and sample particles according to config prescirption (overriding a model)
     for (auto const& [property, propertyDist] : configMap) {
 
-        if (property != "global") { // not the global configuarion field
+        if (property != "global" && !isPhaseSpaceModel(propertyDist.at("dist"))) { // not the global configuarion field
 
             // The type of distribution for the property
             std::string distType = propertyDist.at("dist");
@@ -210,62 +259,457 @@ void GravitationalEnvironment<T>::loadParticlesFromConfig(const std::string conf
             } else if (distType == "normal") { // Normal dist
                 float mu = std::stod(propertyDist.at("mu"));
                 float sigma = std::stod(propertyDist.at("sigma"));
-                std::normal_distribution<> normalDist(mu, sigma);
-                envParams[property] = sampleFromDistribution(nParticles, normalDist);
+                envParams[property] = sampleNormal(nParticles, mu, sigma, CounterRNG(seed, getStreamId(property)), nThreads);
             }  else if (distType == "uniform") { // Uniform dist
                 float min = std::stod(propertyDist.at("min"));
                 float max = std::stod(propertyDist.at("max"));
-                std::uniform_real_distribution<> uniformDist(min, max);
-                envParams[property] = sampleFromDistribution(nParticles, uniformDist);
+                envParams[property] = sampleUniform(nParticles, min, max, CounterRNG(seed, getStreamId(property)), nThreads);
             } else {
                 throw std::invalid_argument("Property " + property + " has an invalid distribution.");
             }
         }
     }
 
-    // Declare particle pointer vector
-    std::vector<std::array<float, 3>> positions(nParticles);
-    std::vector<std::array<float, 3>> velocities(nParticles);
+    ParticleCatalog catalog;
+    catalog.positions.resize(nParticles);
+    catalog.velocities.resize(nParticles);
+    catalog.masses.resize(nParticles);
+    catalog.radii.assign(nParticles, 0);
+    for (int i = 0; i < nParticles; i++) {
+        catalog.positions[i] = {envParams.at("x")[i], envParams.at("y")[i], envParams.at("z")[i]};
+        catalog.velocities[i] = {envParams.at("vx")[i], envParams.at("vy")[i], envParams.at("vz")[i]};
+        catalog.masses[i] = envParams.at("mass")[i];
+    }
+    return catalog;
+}
+
+// Initial conditions of a configuration with a fixed seed: read from its particle catalog, or sampled
+ParticleCatalog getInitialConditions(const std::map<std::string, std::map<std::string, std::string>>& configMap, uint64_t seed, int nThreads) {
+    const std::map<std::string, std::string>& globalConfigMap = configMap.at("global");
+    if (globalConfigMap.find("particleFile") != globalConfigMap.end()) {
+        return readCatalog(globalConfigMap.at("particleFile"), getConfigValue(globalConfigMap, "particleFormat"),
+                           parseColumnList(getConfigValue(globalConfigMap, "columns")), {"x", "y", "z", "vx", "vy", "vz", "mass"}, nThreads);
+    }
+    return sampleParticles(configMap, std::stoi(globalConfigMap.at("nParticles")), seed, nThreads);
+}
+
+// Load a full environment from the configuration file
+template <typename T>
+void GravitationalEnvironment<T>::loadParticlesFromConfig(const std::string configFileName) {
+
+    // Get configuration map
+    std::map<std::string, std::map<std::string, std::string>> configMap = loadConfig(configFileName);
+
+    // Grab the gloabl config params for the environment
+    std::map<std::string, std::string> globalConfigMap = configMap.at("global");
+    applyGlobalConfig(globalConfigMap);
+
+    // Massless tracers always come from a catalog; any mass column is ignored
+    if (globalConfigMap.find("tracerFile") != globalConfigMap.end()) {
+        ParticleCatalog tracers = readCatalog(globalConfigMap.at("tracerFile"), getConfigValue(globalConfigMap, "tracerFormat"),
+                                              parseColumnList(getConfigValue(globalConfigMap, "tracerColumns")), {"x", "y", "z", "vx", "vy", "vz"}, nThreads, false);
+        addTracers(tracers.positions, tracers.velocities);
+    }
+
+    // Continue from an external particle catalog instead of sampling
+    if (globalConfigMap.find("particleFile") != globalConfigMap.end()) {
+        loadParticlesFromCatalog(globalConfigMap);
+        return;
+    }
+    int nParticles = std::stoi(globalConfigMap.at("nParticles"));
+
+    // Without an explicit seed the run is not reproducible, but the seed drawn is kept in 'seed'
+    if (globalConfigMap.find("seed") != globalConfigMap.end()) {
+        seed = std::stoull(globalConfigMap.at("seed"));
+    } else {
+        seed = (static_cast<uint64_t>(rd()) << 32) | rd();
+    }
+
+    ParticleCatalog sample = sampleParticles(configMap, nParticles, seed, nThreads);
     for (int i = 0; i < nParticles; i++) {
+        particlePtrs.push_back(std::make_shared<T>(&sample.positions[i], &sample.velocities[i], sample.masses[i]));
+    }
+}
+
+
+// Construct a particle, passing the radius through to types that have one
+template <typename T>
+std::shared_ptr<T> makeParticle(const std::array<float, 3>* position, const std::array<float, 3>* velocity, float mass, float radius) {
+    if constexpr (std::is_constructible_v<T, const std::array<float, 3>*, const std::array<float, 3>*, float, float>) {
+        return std::make_shared<T>(position, velocity, mass, radius);
+    } else {
+        return std::make_shared<T>(position, velocity, mass);
+    }
+}
+
+// Load particles from the catalog named by 'particleFile' in the global config block
+template <typename T>
+void GravitationalEnvironment<T>::loadParticlesFromCatalog(const std::map<std::string, std::string>& globalConfigMap) {
+    ParticleCatalog catalog = readCatalog(globalConfigMap.at("particleFile"), getConfigValue(globalConfigMap, "particleFormat"),
+                                          parseColumnList(getConfigValue(globalConfigMap, "columns")), {"x", "y", "z", "vx", "vy", "vz", "mass"}, nThreads);
+
+    particlePtrs.reserve(particlePtrs.size() + catalog.masses.size());
+    for (size_t i = 0; i < catalog.masses.size(); i++) {
+        particlePtrs.push_back(makeParticle<T>(&catalog.positions[i], &catalog.velocities[i], catalog.masses[i], catalog.radii[i]));
+    }
+}
+
+// Apply the optional run settings from the 'global' block of a configuration
+template <typename T>
+void GravitationalEnvironment<T>::applyGlobalConfig(const std::map<std::string, std::string>& globalConfigMap) {
+    if (globalConfigMap.find("diagnosticsInterval") != globalConfigMap.end()) {
+        diagnosticsInterval = std::stoi(globalConfigMap.at("diagnosticsInterval"));
+    }
+    if (globalConfigMap.find("linkingLength") != globalConfigMap.end()) {
+        linkingLength = std::stof(globalConfigMap.at("linkingLength"));
+        if (linkingLength < 0) {
+            throw std::invalid_argument("The linking length must be non-negative.");
+        }
+    }
+    if (globalConfigMap.find("groupInterval") != globalConfigMap.end()) {
+        groupInterval = std::stoi(globalConfigMap.at("groupInterval"));
+        if (groupInterval < 1) {
+            throw std::invalid_argument("The group interval must be positive.");
+        }
+    }
+    if (globalConfigMap.find("minGroupMembers") != globalConfigMap.end()) {
+        minGroupMembers = std::stoi(globalConfigMap.at("minGroupMembers"));
+        if (minGroupMembers < 1) {
+            throw std::invalid_argument("The minimum group size must be positive.");
+        }
+    }
+    if (globalConfigMap.find("logFields") != globalConfigMap.end()) {
+        setLogFields(parseColumnList(globalConfigMap.at("logFields")));
+    }
+    if (globalConfigMap.find("logPrecision") != globalConfigMap.end()) {
+        std::string logPrecision = globalConfigMap.at("logPrecision");
+        if (logPrecision != "fixed" && logPrecision != "shortest") {
+            throw std::invalid_argument("Invalid log precision " + logPrecision + ".");
+        }
+        logWriter.shortest = logPrecision == "shortest";
+    }
+    if (globalConfigMap.find("verbosity") != globalConfigMap.end()) {
+        verbosity = globalConfigMap.at("verbosity");
+        if (verbosity != "silent" && verbosity != "progress" && verbosity != "full") {
+            throw std::invalid_argument("Invalid verbosity " + verbosity + ".");
+        }
+    }
+    if (globalConfigMap.find("progressInterval") != globalConfigMap.end()) {
+        progressInterval = std::stof(globalConfigMap.at("progressInterval"));
+    }
+    if (globalConfigMap.find("integrator") != globalConfigMap.end()) {
+        setIntegrator(globalConfigMap.at("integrator"));
+    }
+    if (globalConfigMap.find("timestepping") != globalConfigMap.end()) {
+        timestepping = globalConfigMap.at("timestepping");
+        if (timestepping != "fixed" && timestepping != "adaptive") {
+            throw std::invalid_argument("Invalid timestepping " + timestepping + ".");
+        }
+    }
+    if (globalConfigMap.find("timestepEta") != globalConfigMap.end()) {
+        timestepEta = std::stof(globalConfigMap.at("timestepEta"));
+    }
+    if (globalConfigMap.find("timestepLength") != globalConfigMap.end()) {
+        timestepLength = std::stof(globalConfigMap.at("timestepLength"));
+    }
+    if (globalConfigMap.find("dtMin") != globalConfigMap.end()) {
+        dtMin = std::stof(globalConfigMap.at("dtMin"));
+    }
+    if (globalConfigMap.find("dtMax") != globalConfigMap.end()) {
+        dtMax = std::stof(globalConfigMap.at("dtMax"));
+    }
+    if (globalConfigMap.find("timestepGrowth") != globalConfigMap.end()) {
+        timestepGrowth = std::stof(globalConfigMap.at("timestepGrowth"));
+    }
+    if (globalConfigMap.find("outputParticles") != globalConfigMap.end()) {
+        outputRanges.clear();
+        for (const std::string& range : parseColumnList(globalConfigMap.at("outputParticles"))) {
+            size_t dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            if (first < 0 || last < first) {
+                throw std::invalid_argument("Invalid output particle range " + range + ".");
+            }
+            outputRanges.push_back({first, last});
+        }
+    }
+    if (globalConfigMap.find("outputFraction") != globalConfigMap.end()) {
+        outputFraction = std::stof(globalConfigMap.at("outputFraction"));
+        if (outputFraction <= 0 || outputFraction > 1) {
+            throw std::invalid_argument("Output fraction must be in (0, 1].");
+        }
+    }
+    if (globalConfigMap.find("outputRegion") != globalConfigMap.end()) {
+        outputRegion.clear();
+        for (const std::string& bound : parseColumnList(globalConfigMap.at("outputRegion"))) {
+            outputRegion.push_back(std::stof(bound));
+        }
+        if (outputRegion.size() != 6) {
+            throw std::invalid_argument("Output region needs xmin,ymin,zmin,xmax,ymax,zmax.");
+        }
+    }
+    if (globalConfigMap.find("outputFormat") != globalConfigMap.end()) {
+        outputFormat = globalConfigMap.at("outputFormat");
+        if (outputFormat != "csv" && outputFormat != "trajectory") {
+            throw std::invalid_argument("Invalid output format " + outputFormat + ".");
+        }
+    }
+    if (globalConfigMap.find("trajectoryChunkSize") != globalConfigMap.end()) {
+        trajectoryChunkSize = std::stoi(globalConfigMap.at("trajectoryChunkSize"));
+    }
+    if (globalConfigMap.find("keyframeInterval") != globalConfigMap.end()) {
+        keyframeInterval = std::stoi(globalConfigMap.at("keyframeInterval"));
+    }
+    if (trajectoryChunkSize < 1 || keyframeInterval < 1) {
+        throw std::invalid_argument("Trajectory chunk size and keyframe interval must be at least 1.");
+    }
+    if (globalConfigMap.find("outputBuffers") != globalConfigMap.end()) {
+        outputBuffers = std::stoi(globalConfigMap.at("outputBuffers"));
+        if (outputBuffers < 1) {
+            throw std::invalid_argument("Output buffers must be at least 1.");
+        }
+    }
+    if (globalConfigMap.find("nThreads") != globalConfigMap.end()) {
+        nThreads = std::stoi(globalConfigMap.at("nThreads"));
+    }
+    if (globalConfigMap.find("theta") != globalConfigMap.end()) {
+        theta = std::stof(globalConfigMap.at("theta"));
+        if (theta < 0) {
+            throw std::invalid_argument("The opening angle theta must be non-negative.");
+        }
+    }
+    if (globalConfigMap.find("openingCriterion") != globalConfigMap.end()) {
+        openingCriterion = globalConfigMap.at("openingCriterion");
+        if (openingCriterion == "geometric") {
+            openingRule = GEOMETRIC;
+        } else if (openingCriterion == "salmon-warren") {
+            openingRule = SALMON_WARREN;
+        } else if (openingCriterion == "relative") {
+            openingRule = RELATIVE;
+        } else {
+            throw std::invalid_argument("Invalid opening criterion " + openingCriterion + ".");
+        }
+    }
+    if (globalConfigMap.find("forceAccuracy") != globalConfigMap.end()) {
+        forceAccuracy = std::stof(globalConfigMap.at("forceAccuracy"));
+        if (forceAccuracy <= 0) {
+            throw std::invalid_argument("forceAccuracy must be positive.");
+        }
+    }
+    if (globalConfigMap.find("leafSize") != globalConfigMap.end()) {
+        leafSize = std::stoi(globalConfigMap.at("leafSize"));
+        if (leafSize < 1) {
+            throw std::invalid_argument("leafSize must be at least 1.");
+        }
+    }
+    if (globalConfigMap.find("multipoleOrder") != globalConfigMap.end()) {
+        multipoleOrder = std::stoi(globalConfigMap.at("multipoleOrder"));
+        if (multipoleOrder != 0 && multipoleOrder != 2) {
+            throw std::invalid_argument("Invalid multipole order " + globalConfigMap.at("multipoleOrder") + ", expected 0 or 2.");
+        }
+    }
+    if (globalConfigMap.find("treeLayout") != globalConfigMap.end()) {
+        treeLayout = globalConfigMap.at("treeLayout");
+        if (treeLayout != "pointer" && treeLayout != "compact") {
+            throw std::invalid_argument("Invalid tree layout " + treeLayout + ".");
+        }
+    }
+    if (globalConfigMap.find("interactionListInterval") != globalConfigMap.end()) {
+        interactionListInterval = std::stoi(globalConfigMap.at("interactionListInterval"));
+        if (interactionListInterval < 0) {
+            throw std::invalid_argument("interactionListInterval must be non-negative.");
+        }
+    }
+    if (globalConfigMap.find("interactionListMargin") != globalConfigMap.end()) {
+        interactionListMargin = std::stof(globalConfigMap.at("interactionListMargin"));
+        if (interactionListMargin < 0 || interactionListMargin >= 1) {
+            throw std::invalid_argument("interactionListMargin must be in [0, 1).");
+        }
+    }
+    if (globalConfigMap.find("collisions") != globalConfigMap.end()) {
+        collisionMode = globalConfigMap.at("collisions");
+        if (collisionMode != "none" && collisionMode != "merge" && collisionMode != "bounce") {
+            throw std::invalid_argument("Invalid collision mode " + collisionMode + ".");
+        }
+    }
+    if (globalConfigMap.find("restitution") != globalConfigMap.end()) {
+        restitution = std::stof(globalConfigMap.at("restitution"));
+    }
+    if (globalConfigMap.find("softening") != globalConfigMap.end()) {
+        float softeningLength = globalConfigMap.find("softeningLength") != globalConfigMap.end() ? std::stof(globalConfigMap.at("softeningLength")) : 0;
+        softening = Softening(globalConfigMap.at("softening"), softeningLength);
+    }
+    if (globalConfigMap.find("boundary") != globalConfigMap.end()) {
+        std::string boundary = globalConfigMap.at("boundary");
+        if (boundary == "periodic") {
+            if (globalConfigMap.find("boxSize") == globalConfigMap.end()) {
+                throw std::invalid_argument("A periodic boundary requires 'boxSize'.");
+            }
+            boxSize = std::stof(globalConfigMap.at("boxSize"));
+            boxMin = globalConfigMap.find("boxMin") != globalConfigMap.end() ? std::stof(globalConfigMap.at("boxMin")) : 0;
+            if (ewaldTable == nullptr) {
+                ewaldTable = std::make_shared<EwaldTable>();
+            }
+            periodic = true;
+        } else if (boundary == "open") {
+            periodic = false;
+        } else {
+            throw std::invalid_argument("Invalid boundary " + boundary + ".");
+        }
+    }
+
+    // Adaptive steps need a length scale, which may come from the softening set above
+    if (timestepEta <= 0 || dtMin < 0 || dtMax < 0 || timestepGrowth < 1) {
+        throw std::invalid_argument("Invalid adaptive timestep bounds.");
+    }
+    if (integrator == "wisdom-holman" && periodic) {
+        throw std::invalid_argument("The Wisdom-Holman integrator needs open boundaries.");
+    }
+    if (interactionListInterval > 0 && periodic) {
+        // Wrapped particles would drag the refitted centers of mass across the box
+        throw std::invalid_argument("Interaction lists need open boundaries.");
+    }
+    if (forceAlgorithm == "dual-tree" && periodic) {
+        // The tidal terms of the local expansions would miss the gradient of the Ewald correction
+        throw std::invalid_argument("The dual-tree algorithm needs open boundaries.");
+    }
+    if (interactionListInterval > 0 && treeLayout == "compact") {
+        throw std::invalid_argument("Interaction lists need the pointer tree layout.");
+    }
+    if (timestepping == "adaptive" && timestepLength <= 0 && softening.length <= 0) {
+        throw std::invalid_argument("Adaptive timesteps need a timestepLength or a softening length.");
+    }
+
+    // Lists and trees built under the old settings are not reused
+    clearInteractionLists();
+    octreeCurrent = false;
+}
+
+
+// Add the force and potential energy of an interaction with strength Gmm at 'separation' (source - target), applying
+// the softening kernel and, in a periodic box, the minimum image and Ewald correction
+template <typename T>
+void GravitationalEnvironment<T>::accumulateInteraction(std::array<float, 3> separation, const float prop_to_force, std::array<float, 3>& force, float& potential) const {
+    applyMinimumImage(separation);
+    float r2 = separation[0] * separation[0] + separation[1] * separation[1] + separation[2] * separation[2];
+    float r_dep = softening.forceFactor(r2);
+    for (int k = 0; k < 3; k++) {
+        force[k] += prop_to_force * r_dep * separation[k];
+    }
+    potential += prop_to_force * softening.potential(r2);
+
+    // Contribution of the periodic images
+    if (periodic && r2 > 0) {
+        std::array<float, 3> correction = ewaldTable->forceCorrection(separation, boxSize);
+        for (int k = 0; k < 3; k++) {
+            force[k] += prop_to_force * correction[k];
+        }
+        potential += prop_to_force * ewaldTable->potentialCorrection(separation, boxSize);
+    }
+}
+
+// Add the quadrupole term of a node's expansion, with 'separation' running from the particle to the node's center of
+// mass: a = G (2.5 (s.Q.s) s / r^7 - Q s / r^5) and phi = -G (s.Q.s) / (2 r^5). Softening is left out, since only
+// distant nodes are expanded.
+template <typename T>
+void GravitationalEnvironment<T>::accumulateQuadrupole(const std::array<float, 3>& separation, const std::array<float, 6>& quadrupole, const float prop_to_force, std::array<float, 3>& force, float& potential) const {
+    float r2 = separation[0] * separation[0] + separation[1] * separation[1] + separation[2] * separation[2];
+    if (r2 == 0) {
+        return;
+    }
+    std::array<float, 3> qs = {quadrupole[0] * separation[0] + quadrupole[3] * separation[1] + quadrupole[4] * separation[2],
+                               quadrupole[3] * separation[0] + quadrupole[1] * separation[1] + quadrupole[5] * separation[2],
+                               quadrupole[4] * separation[0] + quadrupole[5] * separation[1] + quadrupole[2] * separation[2]};
+    float sqs = separation[0] * qs[0] + separation[1] * qs[1] + separation[2] * qs[2];
+    float r5Inv = 1 / (r2 * r2 * std::sqrt(r2));
+    for (int k = 0; k < 3; k++) {
+        force[k] += prop_to_force * r5Inv * (2.5f * sqs * separation[k] / r2 - qs[k]);
+    }
+    potential -= prop_to_force * 0.5f * sqs * r5Inv;
+}
 
-        // Populate positions and velocities
-        positions[i] = {envParams.at("x")[i], envParams.at("y")[i], envParams.at("z")[i]};
-        velocities[i] = {envParams.at("vx")[i], envParams.at("vy")[i], envParams.at("vz")[i]};
-        float mass = envParams.at("mass")[i];
+// Map a separation onto its nearest periodic image
+template <typename T>
+void GravitationalEnvironment<T>::applyMinimumImage(std::array<float, 3>& separation) const {
+    if (periodic) {
+        for (int k = 0; k < 3; k++) {
+            separation[k] -= boxSize * std::round(separation[k] / boxSize);
+        }
+    }
+}
 
-        // Create Particle instance with pointers to elements in the positions and velocities vectors
-        particlePtrs.push_back(std::make_shared<T>(&positions[i], &velocities[i], mass));
+// Wrap every particle back into the periodic box
+template <typename T>
+void GravitationalEnvironment<T>::wrapPositions() {
+    octreeCurrent = false;
+    for (int i = 0; i < nParticles; i++) {
+        for (int k = 0; k < 3; k++) {
+            float& x = particlePtrs[i]->position[k];
+            x = boxMin + std::fmod(x - boxMin, boxSize);
+            if (x < boxMin) {
+                x += boxSize;
+            }
+        }
+    }
+    for (std::array<float, 3>& position : tracerPositions) {
+        for (int k = 0; k < 3; k++) {
+            position[k] = boxMin + std::fmod(position[k] - boxMin, boxSize);
+            if (position[k] < boxMin) {
+                position[k] += boxSize;
+            }
+        }
     }
 }
 
+// Select the per-particle fields written to the log, in order
+template <typename T>
+void GravitationalEnvironment<T>::setLogFields(const std::vector<std::string>& fields) {
+    const std::vector<std::string> available = {"mass", "x", "y", "z", "vx", "vy", "vz", "ax", "ay", "az", "potential"};
+    logFieldIds.clear();
+    for (const std::string& field : fields) {
+        auto it = std::find(available.begin(), available.end(), field);
+        if (it == available.end()) {
+            throw std::invalid_argument("Invalid log field " + field + ".");
+        }
+        logFieldIds.push_back(it - available.begin());
+    }
+    logFields = fields;
+}
 
 template <typename T>
 // Get the forces in the environment
 std::vector<std::array<float, 3>> GravitationalEnvironment<T>::getForcesPairWise(const float timestep) {
     // A vector to hold the forces on each particle
     std::vector<std::array<float, 3>> forces(nParticles);
+    potentials.assign(nParticles, 0);
 
     // Iterate through and find each source contribution
     float prop_to_force;  // Gmm
-    float r_dep; // rhat // r^2
+    float pairPotential;
+    std::array<float, 3> pairForce;
+    std::array<float, 3> separation;
     for (int i = 0; i < nParticles; i++) {
         for (int j = i + 1; j < nParticles; j++) {
 
             // Only calculate Gmm
             prop_to_force = G * particlePtrs[i]->mass * particlePtrs[j]->mass;
 
+            // Separation from i to j
             for (int k = 0; k < 3; k++) {
+                separation[k] = particlePtrs[j]->position[k] - particlePtrs[i]->position[k];
+            }
 
-                // r-dependence
-                if (particlePtrs[i]->position[k] == particlePtrs[j]->position[k]){
-                    r_dep = 0;
-                } else {
-                    r_dep = (particlePtrs[i]->position[k] - particlePtrs[j]->position[k]) / abs(pow(particlePtrs[i]->position[k] - particlePtrs[j]->position[k], 3));
-                }
+            // The pair's potential energy is shared by both particles
+            pairForce = {0, 0, 0};
+            pairPotential = 0;
+            accumulateInteraction(separation, prop_to_force, pairForce, pairPotential);
+            potentials[i] += pairPotential;
+            potentials[j] += pairPotential;
 
-                // Update forces (opposite and equal)
-                forces[i][k] = -1 * prop_to_force * r_dep;
-                forces[j][k] = prop_to_force * r_dep;
+            // Update forces (opposite and equal)
+            for (int k = 0; k < 3; k++) {
+                forces[i][k] += pairForce[k];
+                forces[j][k] -= pairForce[k];
             }
         }
     }
@@ -273,71 +717,180 @@ std::vector<std::array<float, 3>> GravitationalEnvironment<T>::getForcesPairWise
     return forces;
 }
 
-// Calculate the net force on objPtr, using currOctPtr to navigate the tree (i.e. current node in the tree)
 template <typename T>
-std::array<float, 3> GravitationalEnvironment<T>::calculateForceBarnesHut(std::shared_ptr<T> objPtr, std::shared_ptr<Octree<T>> currOctPtr, std::array<float, 3> netForce, float theta) {
-    // If current node is a nullptr, return netForce
-    if (currOctPtr == nullptr) {
-        return netForce;
+// Get the forces and, into 'jerks', their time derivatives by direct summation. For a pair at separation dx moving
+// apart at dv, d/dt [g(r^2) dx] = g dv + 2 g'(r^2) (dx . dv) dx. The jerk leaves out the Ewald correction.
+std::vector<std::array<float, 3>> GravitationalEnvironment<T>::getForcesPairWiseWithJerks(const float timestep) {
+    std::vector<std::array<float, 3>> forces(nParticles);
+    jerks.assign(nParticles, {0, 0, 0});
+    potentials.assign(nParticles, 0);
+
+    float prop_to_force;  // Gmm
+    float pairPotential;
+    std::array<float, 3> pairForce;
+    std::array<float, 3> separation;
+    std::array<float, 3> relativeVelocity;
+    for (int i = 0; i < nParticles; i++) {
+        for (int j = i + 1; j < nParticles; j++) {
+            prop_to_force = G * particlePtrs[i]->mass * particlePtrs[j]->mass;
+            for (int k = 0; k < 3; k++) {
+                separation[k] = particlePtrs[j]->position[k] - particlePtrs[i]->position[k];
+                relativeVelocity[k] = particlePtrs[j]->velocity[k] - particlePtrs[i]->velocity[k];
+            }
+
+            pairForce = {0, 0, 0};
+            pairPotential = 0;
+            accumulateInteraction(separation, prop_to_force, pairForce, pairPotential);
+            potentials[i] += pairPotential;
+            potentials[j] += pairPotential;
+
+            applyMinimumImage(separation);
+            float r2 = separation[0] * separation[0] + separation[1] * separation[1] + separation[2] * separation[2];
+            float rv = separation[0] * relativeVelocity[0] + separation[1] * relativeVelocity[1] + separation[2] * relativeVelocity[2];
+            float g = softening.forceFactor(r2);
+            float dg = softening.forceFactorDerivative(r2);
+            for (int k = 0; k < 3; k++) {
+                float pairJerk = prop_to_force * (g * relativeVelocity[k] + 2 * dg * rv * separation[k]);
+                forces[i][k] += pairForce[k];
+                forces[j][k] -= pairForce[k];
+                jerks[i][k] += pairJerk;
+                jerks[j][k] -= pairJerk;
+            }
+        }
     }
-    
-    // If current node is an external node and the object node is not the current node, calculate the force
-    if (!(currOctPtr->internal) && (currOctPtr->objPtrs[0] != objPtr)) {
-        // Calculate force of the external node, and add it to net force and return        
-        float prop_to_force = G * objPtr->mass * currOctPtr->objPtrs[0]->mass;
-        float r_dep;
 
+    return forces;
+}
+
+template <typename T>
+// Get the forces, and into 'interactionAccelerations' the accelerations due to every body except the central one.
+// Only massive bodies are sources, so test particles cost one pass over the massive bodies each.
+std::vector<std::array<float, 3>> GravitationalEnvironment<T>::getForcesWisdomHolman(const float timestep) {
+    std::vector<std::array<float, 3>> forces(nParticles);
+    interactionAccelerations.assign(nParticles, {0, 0, 0});
+    potentials.assign(nParticles, 0);
+    int central = getCentralIndex();
+    float centralMass = particlePtrs[central]->mass;
+
+    std::vector<int> sources;
+    for (int j = 0; j < nParticles; j++) {
+        if (j != central && particlePtrs[j]->mass > 0) {
+            sources.push_back(j);
+        }
+    }
+
+    std::array<float, 3> separation;
+    for (int i = 0; i < nParticles; i++) {
+        if (i == central) {
+            continue;
+        }
+        T& particle = *particlePtrs[i];
+
+        // Pull of the central body, which the Kepler drift integrates exactly
         for (int k = 0; k < 3; k++) {
-            // r-dependence
-            if (objPtr->position[k] == currOctPtr->objPtrs[0]->position[k]){
-                r_dep = 0;
-            } else {
-                r_dep = (currOctPtr->objPtrs[0]->position[k] - objPtr->position[k]) / abs(pow(currOctPtr->objPtrs[0]->position[k] - objPtr->position[k], 3));
+            separation[k] = particlePtrs[central]->position[k] - particle.position[k];
+        }
+        float r2 = separation[0] * separation[0] + separation[1] * separation[1] + separation[2] * separation[2];
+        float g = softening.forceFactor(r2);
+        for (int k = 0; k < 3; k++) {
+            float pairForce = G * centralMass * particle.mass * g * separation[k];
+            forces[i][k] += pairForce;
+            forces[central][k] -= pairForce;
+        }
+        float pairPotential = G * centralMass * particle.mass * softening.potential(r2);
+        potentials[i] += pairPotential;
+        potentials[central] += pairPotential;
+
+        // Interactions; pairs of massive bodies are visited once, from their lower index
+        for (int j : sources) {
+            if (j == i || (j < i && particle.mass > 0)) {
+                continue;
+            }
+            for (int k = 0; k < 3; k++) {
+                separation[k] = particlePtrs[j]->position[k] - particle.position[k];
+            }
+            r2 = separation[0] * separation[0] + separation[1] * separation[1] + separation[2] * separation[2];
+            g = softening.forceFactor(r2);
+            for (int k = 0; k < 3; k++) {
+                interactionAccelerations[i][k] += G * particlePtrs[j]->mass * g * separation[k];
+                interactionAccelerations[j][k] -= G * particle.mass * g * separation[k];
             }
+            pairPotential = G * particlePtrs[j]->mass * particle.mass * softening.potential(r2);
+            potentials[i] += pairPotential;
+            potentials[j] += pairPotential;
+        }
+    }
 
-            // Update forces
-            netForce[k] += prop_to_force * r_dep;
-            return netForce;
+    for (int i = 0; i < nParticles; i++) {
+        if (i != central) {
+            for (int k = 0; k < 3; k++) {
+                forces[i][k] += particlePtrs[i]->mass * interactionAccelerations[i][k];
+            }
         }
     }
+    return forces;
+}
 
-    // Calculate width of region
-    float s = getEuclidianDistance({currOctPtr->xCoords[0], currOctPtr->yCoords[0], currOctPtr->zCoords[0]}, {currOctPtr->xCoords[1], currOctPtr->yCoords[1], currOctPtr->zCoords[1]});
+// Calculate the net force on objPtr, using currOctPtr to navigate the tree (i.e. current node in the tree).
+// The potential energy of objPtr is accumulated into 'potential' during the same walk.
+template <typename T>
+std::array<float, 3> GravitationalEnvironment<T>::calculateForceBarnesHut(std::shared_ptr<T> objPtr, std::shared_ptr<Octree<T>> currOctPtr, std::array<float, 3> netForce, float previousAcceleration, float& potential) {
+    // If current node is a nullptr, return netForce
+    if (currOctPtr == nullptr) {
+        return netForce;
+    }
 
-    // Calculate distance between currPtr and objPtr
-    float d = getEuclidianDistance(currOctPtr->centerOfMass, objPtr->position);
+    // External nodes that hold one object or objPtr itself are summed directly
+    bool external = !(currOctPtr->internal);
+    if (external && (currOctPtr->objPtrs.size() == 1 || std::find(currOctPtr->objPtrs.begin(), currOctPtr->objPtrs.end(), objPtr) != currOctPtr->objPtrs.end())) {
+        for (const std::shared_ptr<T>& otherPtr : currOctPtr->objPtrs) {
+            if (otherPtr != objPtr) {
+                float prop_to_force = G * objPtr->mass * otherPtr->mass;
+                std::array<float, 3> separation;
+                for (int k = 0; k < 3; k++) {
+                    separation[k] = otherPtr->position[k] - objPtr->position[k];
+                }
+                accumulateInteraction(separation, prop_to_force, netForce, potential);
+            }
+        }
+        return netForce;
+    }
 
-    // Calculate s / d
-    float ratio = s / d;
+    // Calculate separation between currPtr and objPtr (to the nearest image in a periodic box)
+    std::array<float, 3> separation;
+    for (int k = 0; k < 3; k++) {
+        separation[k] = currOctPtr->centerOfMass[k] - objPtr->position[k];
+    }
+    applyMinimumImage(separation);
 
-    // If ratio s / d is < theta, treat the node as a single body and calculate force from currPtr on objPtr; return netForce plus recursive call
-    if (ratio < theta) {
+    // If the opening criterion accepts the node, treat it as a single body and calculate force from currPtr on objPtr
+    if (acceptNode(*currOctPtr, objPtr->position, separation, previousAcceleration)) {
         float prop_to_force = G * objPtr->mass * (currOctPtr->totalMass);
-        float r_dep;
-
-        for (int k = 0; k < 3; k++) {
-            // r-dependence
-            if (objPtr->position[k] == currOctPtr->centerOfMass[k]){
-                r_dep = 0;
-            } else {
-                r_dep = (currOctPtr->centerOfMass[k] - objPtr->position[k]) / abs(pow(currOctPtr->centerOfMass[k] - objPtr->position[k], 3));
+        accumulateInteraction(separation, prop_to_force, netForce, potential);
+        if (multipoleOrder == 2) {
+            accumulateQuadrupole(separation, currOctPtr->quadrupole, G * objPtr->mass, netForce, potential);
+        }
+        return netForce;
+    } else if (external) { // An opened leaf is summed directly
+        for (const std::shared_ptr<T>& otherPtr : currOctPtr->objPtrs) {
+            float prop_to_force = G * objPtr->mass * otherPtr->mass;
+            for (int k = 0; k < 3; k++) {
+                separation[k] = otherPtr->position[k] - objPtr->position[k];
             }
-
-            // Update forces
-            netForce[k] += prop_to_force * r_dep;
+            accumulateInteraction(separation, prop_to_force, netForce, potential);
         }
         return netForce;
     } else { // Else, recursive call of calculateForceBarnesHut on all children and add them together to return sum of recursive calls
         std::array<float, 3> totalNetForces;
 
-        std::array<float, 3> child0Force = calculateForceBarnesHut(objPtr, currOctPtr->child0, {0, 0, 0}, theta);
-        std::array<float, 3> child1Force = calculateForceBarnesHut(objPtr, currOctPtr->child1, {0, 0, 0}, theta);
-        std::array<float, 3> child2Force = calculateForceBarnesHut(objPtr, currOctPtr->child2, {0, 0, 0}, theta);
-        std::array<float, 3> child3Force = calculateForceBarnesHut(objPtr, currOctPtr->child3, {0, 0, 0}, theta);
-        std::array<float, 3> child4Force = calculateForceBarnesHut(objPtr, currOctPtr->child4, {0, 0, 0}, theta);
-        std::array<float, 3> child5Force = calculateForceBarnesHut(objPtr, currOctPtr->child5, {0, 0, 0}, theta);
-        std::array<float, 3> child6Force = calculateForceBarnesHut(objPtr, currOctPtr->child6, {0, 0, 0}, theta);
-        std::array<float, 3> child7Force = calculateForceBarnesHut(objPtr, currOctPtr->child7, {0, 0, 0}, theta);
+        std::array<float, 3> child0Force = calculateForceBarnesHut(objPtr, currOctPtr->child0, {0, 0, 0}, previousAcceleration, potential);
+        std::array<float, 3> child1Force = calculateForceBarnesHut(objPtr, currOctPtr->child1, {0, 0, 0}, previousAcceleration, potential);
+        std::array<float, 3> child2Force = calculateForceBarnesHut(objPtr, currOctPtr->child2, {0, 0, 0}, previousAcceleration, potential);
+        std::array<float, 3> child3Force = calculateForceBarnesHut(objPtr, currOctPtr->child3, {0, 0, 0}, previousAcceleration, potential);
+        std::array<float, 3> child4Force = calculateForceBarnesHut(objPtr, currOctPtr->child4, {0, 0, 0}, previousAcceleration, potential);
+        std::array<float, 3> child5Force = calculateForceBarnesHut(objPtr, currOctPtr->child5, {0, 0, 0}, previousAcceleration, potential);
+        std::array<float, 3> child6Force = calculateForceBarnesHut(objPtr, currOctPtr->child6, {0, 0, 0}, previousAcceleration, potential);
+        std::array<float, 3> child7Force = calculateForceBarnesHut(objPtr, currOctPtr->child7, {0, 0, 0}, previousAcceleration, potential);
 
         for (int i = 0; i < 3; i++) {
             totalNetForces[i] = child0Force[i] + child1Force[i] + child2Force[i] + child3Force[i] + child4Force[i] + child5Force[i] + child6Force[i] + child7Force[i];
@@ -346,11 +899,50 @@ std::array<float, 3> GravitationalEnvironment<T>::calculateForceBarnesHut(std::s
     }
 }
 
+// Decide whether the tree walk may use a node's expansion for a particle at 'position', where 'separation' runs to the
+// node's center of mass. Without a previous acceleration the relative criterion falls back to the geometric one. A
+// tolerance below 1 tightens the criterion, scaling theta by it (and the relative force error by its square).
 template <typename T>
-std::vector<std::array<float, 3>> GravitationalEnvironment<T>::getForcesBarnesHut(const float timestep) {
+bool GravitationalEnvironment<T>::acceptNode(const Octree<T>& node, const std::array<float, 3>& position, const std::array<float, 3>& separation, float previousAcceleration, float tolerance) const {
+    std::array<float, 3> cellCenter = {(node.xCoords[0] + node.xCoords[1]) / 2, (node.yCoords[0] + node.yCoords[1]) / 2, (node.zCoords[0] + node.zCoords[1]) / 2};
+    std::array<float, 3> widths = {node.xCoords[1] - node.xCoords[0], node.yCoords[1] - node.yCoords[0], node.zCoords[1] - node.zCoords[0]};
+    return acceptCell(cellCenter, widths, node.totalMass, node.bmax, position, separation, previousAcceleration, tolerance);
+}
+
+// The opening criterion on the geometry and moments of a cell, shared by both tree layouts
+template <typename T>
+bool GravitationalEnvironment<T>::acceptCell(const std::array<float, 3>& cellCenter, const std::array<float, 3>& widths, float mass, float bmax, const std::array<float, 3>& position, const std::array<float, 3>& separation, float previousAcceleration, float tolerance) const {
+    float theta = tolerance * this->theta;
+    float d2 = separation[0] * separation[0] + separation[1] * separation[1] + separation[2] * separation[2];
 
-    // Clear the Octree
+    if (openingRule == SALMON_WARREN) {
+        // Every particle of the node lies within bmax of its center of mass, so this also keeps the particle outside
+        return bmax * bmax < theta * theta * d2;
+    }
+
+    if (openingRule == RELATIVE && previousAcceleration > 0) {
+        // Gadget-2: the leading error term G M l^2 / d^4 against the previous acceleration, and never for a particle
+        // inside the cell enlarged by 20%
+        float l = std::max({widths[0], widths[1], widths[2]});
+        std::array<float, 3> toCenter = {cellCenter[0] - position[0], cellCenter[1] - position[1], cellCenter[2] - position[2]};
+        applyMinimumImage(toCenter);
+        if (std::abs(toCenter[0]) < 0.6f * widths[0] && std::abs(toCenter[1]) < 0.6f * widths[1] && std::abs(toCenter[2]) < 0.6f * widths[2]) {
+            return false;
+        }
+        return G * mass * l * l < tolerance * tolerance * forceAccuracy * previousAcceleration * d2 * d2;
+    }
+
+    // Geometric: the cell diagonal against the distance to the center of mass
+    float s2 = widths[0] * widths[0] + widths[1] * widths[1] + widths[2] * widths[2];
+    return s2 < theta * theta * d2;
+}
+
+// Rebuild the environment octree around the current particle positions
+template <typename T>
+void GravitationalEnvironment<T>::buildOctree() {
+    // Clear the Octree, and the interaction lists that point into it
     envOctree.clearOctree();
+    clearInteractionLists();
 
     // Get the extreme coordinate locations
     std::array<float, 2> extremeXCoords = {static_cast<float>(particlePtrs[0]->position[0]), static_cast<float>(particlePtrs[0]->position[0])};
@@ -368,125 +960,1494 @@ std::vector<std::array<float, 3>> GravitationalEnvironment<T>::getForcesBarnesHu
         extremeZCoords[1] = std::max(extremeZCoords[1], static_cast<float>(particlePtrs[i]->position[2]));
     }
 
+    // A periodic box has a fixed domain instead
+    if (periodic) {
+        extremeXCoords = {boxMin, boxMin + boxSize};
+        extremeYCoords = {boxMin, boxMin + boxSize};
+        extremeZCoords = {boxMin, boxMin + boxSize};
+    }
+
     // Update the coordiantes of the octree
     envOctree.updateCoords(extremeXCoords, extremeYCoords, extremeZCoords);
+    envOctree.leafSize = leafSize;
 
     // Build the Octree
     envOctree.build(particlePtrs);
-
-    // Calculate the forces
-    std::vector<std::array<float, 3>> forces(nParticles); // Vector to hold the forces
-    float theta = 0.5;
-    std::shared_ptr<Octree<T>> octreePtr = std::make_shared<Octree<T>>(envOctree);
-    for (int i = 0; i < nParticles; i++) {
-        // Need to implement walking down the tree
-        forces[i] = calculateForceBarnesHut(particlePtrs[i], octreePtr, {0, 0, 0}, theta);
+    if (multipoleOrder == 2) {
+        envOctree.computeQuadrupoles();
     }
-    return forces;
+    if (openingRule == SALMON_WARREN || forceAlgorithm == "dual-tree") {
+        envOctree.computeBmax();
+    }
+    octreeCurrent = true;
 }
-    
 
+// Move the nodes of the environment octree to the current particle positions without rebuilding it, and update the
+// moments the walks use
 template <typename T>
-// Update each particle in the environment
+void GravitationalEnvironment<T>::refitOctree() {
+    envOctree.refit();
+    if (multipoleOrder == 2) {
+        envOctree.computeQuadrupoles();
+    }
+    if (openingRule == SALMON_WARREN || forceAlgorithm == "dual-tree") {
+        envOctree.computeBmax();
+    }
+    octreeCurrent = true;
+}
+
+template <typename T>
+void GravitationalEnvironment<T>::clearInteractionLists() {
+    interactionNodes.clear();
+    interactionParticles.clear();
+    interactionListAge = 0;
+}
+
+template <typename T>
+std::vector<std::array<float, 3>> GravitationalEnvironment<T>::getForcesBarnesHut(const float timestep) {
+
+    // Reuse the interaction lists of the last full walk while they are young enough and still cover the same particles
+    std::vector<std::array<float, 3>> forces(nParticles); // Vector to hold the forces
+    potentials.assign(nParticles, 0);
+    bool havePrevious = static_cast<int>(previousAccelerations.size()) == nParticles;
+    bool reuse = interactionListInterval > 0 && interactionListAge > 0 && interactionListAge < interactionListInterval && static_cast<int>(interactionNodes.size()) == nParticles;
+    if (reuse) {
+        refitOctree();
+        for (int i = 0; i < nParticles && reuse; i++) {
+            reuse = evaluateInteractionList(i, havePrevious ? previousAccelerations[i] : 0, true, forces[i], potentials[i]);
+        }
+        if (reuse) {
+            interactionListAge++;
+        } else {
+            forces.assign(nParticles, {0, 0, 0});
+            potentials.assign(nParticles, 0);
+        }
+    }
+
+    if (!reuse && treeLayout == "compact") {
+        // Walk the compact tree in tree order, so that consecutive walks share most of their nodes
+        buildCompactOctree();
+        fullWalkCount++;
+        parallelFor(nParticles, nThreads, [&](size_t begin, size_t end) {
+            for (size_t j = begin; j < end; j++) {
+                int i = compactOctree.order[j];
+                forces[i] = calculateForceCompact(i, havePrevious ? previousAccelerations[i] : 0, potentials[i]);
+            }
+        });
+    } else if (!reuse) {
+        // Build the Octree
+        buildOctree();
+        fullWalkCount++;
+
+        if (interactionListInterval > 0) {
+            // Record the lists with the tightened criterion, then sum them
+            interactionNodes.resize(nParticles);
+            interactionParticles.resize(nParticles);
+            for (int i = 0; i < nParticles; i++) {
+                recordInteractionList(i, &envOctree, havePrevious ? previousAccelerations[i] : 0);
+                evaluateInteractionList(i, 0, false, forces[i], potentials[i]);
+            }
+            interactionListAge = 1;
+        } else {
+            // Calculate the forces
+            std::shared_ptr<Octree<T>> octreePtr = std::make_shared<Octree<T>>(envOctree);
+            for (int i = 0; i < nParticles; i++) {
+                // Need to implement walking down the tree
+                forces[i] = calculateForceBarnesHut(particlePtrs[i], octreePtr, {0, 0, 0}, havePrevious ? previousAccelerations[i] : 0, potentials[i]);
+            }
+        }
+    }
+
+    // Keep the acceleration magnitudes for the relative criterion of the next walk
+    previousAccelerations.resize(nParticles);
+    for (int i = 0; i < nParticles; i++) {
+        float mass = particlePtrs[i]->mass;
+        previousAccelerations[i] = mass > 0 ? std::sqrt(forces[i][0] * forces[i][0] + forces[i][1] * forces[i][1] + forces[i][2] * forces[i][2]) / mass : 0;
+    }
+    return forces;
+}
+
+// Build the compact octree over the current particle positions, inside the box when it is periodic
+template <typename T>
+void GravitationalEnvironment<T>::buildCompactOctree() {
+    std::vector<std::array<float, 3>> positions(nParticles);
+    std::vector<float> masses(nParticles);
+    for (int i = 0; i < nParticles; i++) {
+        positions[i] = particlePtrs[i]->position;
+        masses[i] = particlePtrs[i]->mass;
+    }
+    compactOctree.leafSize = leafSize;
+    compactOctree.period = periodic ? boxSize : 0;
+    if (periodic) {
+        compactOctree.build(positions, masses, {boxMin + boxSize / 2, boxMin + boxSize / 2, boxMin + boxSize / 2}, boxSize / 2);
+    } else {
+        compactOctree.build(positions, masses);
+    }
+    if (multipoleOrder == 2) {
+        compactOctree.computeQuadrupoles();
+    }
+}
+
+template <typename T>
+void GravitationalEnvironment<T>::radiusQueries(const std::vector<std::array<float, 3>>& centers, float radius, int maxResults, std::vector<int>& indices, std::vector<int>& counts) {
+    buildCompactOctree();
+    compactOctree.radiusQueries(centers, radius, maxResults, indices, counts, nThreads);
+}
+
+template <typename T>
+void GravitationalEnvironment<T>::boxQueries(const std::vector<std::array<float, 3>>& lowers, const std::vector<std::array<float, 3>>& uppers, int maxResults, std::vector<int>& indices, std::vector<int>& counts) {
+    buildCompactOctree();
+    compactOctree.boxQueries(lowers, uppers, maxResults, indices, counts, nThreads);
+}
+
+template <typename T>
+void GravitationalEnvironment<T>::kNearestQueries(const std::vector<std::array<float, 3>>& centers, int k, std::vector<int>& indices, std::vector<float>& distances2) {
+    buildCompactOctree();
+    compactOctree.kNearestQueries(centers, k, indices, distances2, nThreads);
+}
+
+// Catalog the friends-of-friends groups of the massive particles at the current time, linked through radius queries
+// on the compact octree (tracers are left out)
+template <typename T>
+std::vector<GroupProperties> GravitationalEnvironment<T>::findGroups() {
+    if (linkingLength <= 0) {
+        throw std::invalid_argument("Group finding needs a positive linkingLength.");
+    }
+    buildCompactOctree();
+    std::vector<int> labels = findFriendsOfFriends(compactOctree, linkingLength, nThreads);
+    std::vector<std::array<float, 3>> velocities(nParticles);
+    for (int i = 0; i < nParticles; i++) {
+        velocities[i] = particlePtrs[i]->velocity;
+    }
+
+    // The tree keeps its particles in tree order; put them back in particle order
+    std::vector<std::array<float, 3>> positions(nParticles);
+    std::vector<float> masses(nParticles);
+    for (int slot = 0; slot < nParticles; slot++) {
+        positions[compactOctree.order[slot]] = compactOctree.positions[slot];
+        masses[compactOctree.order[slot]] = compactOctree.masses[slot];
+    }
+    return getGroupProperties(labels, positions, velocities, masses, minGroupMembers, compactOctree.period, time);
+}
+
+// Walk the compact octree for particle 'index' with an explicit stack, making the same decisions as
+// calculateForceBarnesHut: leaves that hold one particle or the particle itself, and opened leaves, are summed directly
+template <typename T>
+std::array<float, 3> GravitationalEnvironment<T>::calculateForceCompact(int index, float previousAcceleration, float& potential) const {
+    const T& particle = *particlePtrs[index];
+    uint32_t slot = compactOctree.slots[index];
+    std::array<float, 3> force = {0, 0, 0};
+    std::array<float, 3> separation;
+
+    std::array<uint32_t, 8 * CompactOctree::maxDepth + 8> stack;
+    int stackSize = 0;
+    if (!compactOctree.nodes.empty()) {
+        stack[stackSize++] = 0;
+    }
+    while (stackSize > 0) {
+        uint32_t n = stack[--stackSize];
+        const CompactNode& node = compactOctree.nodes[n];
+        bool leaf = node.childMask == 0;
+        bool direct = leaf && (node.end - node.begin == 1 || (node.begin <= slot && slot < node.end));
+        if (!direct) {
+            for (int k = 0; k < 3; k++) {
+                separation[k] = node.centerOfMass[k] - particle.position[k];
+            }
+            applyMinimumImage(separation);
+            float width = 2 * node.halfWidth;
+            if (acceptCell(node.center, {width, width, width}, node.mass, node.bmax, particle.position, separation, previousAcceleration)) {
+                accumulateInteraction(separation, G * particle.mass * node.mass, force, potential);
+                if (multipoleOrder == 2) {
+                    accumulateQuadrupole(separation, compactOctree.quadrupoles[n], G * particle.mass, force, potential);
+                }
+                continue;
+            }
+        }
+        if (leaf) {
+            for (uint32_t j = node.begin; j < node.end; j++) {
+                if (j != slot) {
+                    for (int k = 0; k < 3; k++) {
+                        separation[k] = compactOctree.positions[j][k] - particle.position[k];
+                    }
+                    accumulateInteraction(separation, G * particle.mass * compactOctree.masses[j], force, potential);
+                }
+            }
+            continue;
+        }
+        int nChildren = compactOctree.getChildCount(node);
+        for (int c = nChildren - 1; c >= 0; c--) {
+            stack[stackSize++] = node.firstChild + c;
+        }
+    }
+    return force;
+}
+
+// Walk the octree for particle 'index' as calculateForceBarnesHut does, but append the accepted nodes and the directly
+// summed particles to its interaction lists instead of summing them, with the criterion tightened by the margin
+template <typename T>
+void GravitationalEnvironment<T>::recordInteractionList(int index, const Octree<T>* node, float previousAcceleration) {
+    if (node == nullptr) {
+        return;
+    }
+    const T* objPtr = particlePtrs[index].get();
+    if (node == &envOctree) {
+        interactionNodes[index].clear();
+        interactionParticles[index].clear();
+    }
+
+    // External nodes that hold one object or the particle itself, and opened leaves, are summed directly
+    bool external = !(node->internal);
+    bool holdsParticle = external && std::find_if(node->objPtrs.begin(), node->objPtrs.end(), [&](const std::shared_ptr<T>& otherPtr) { return otherPtr.get() == objPtr; }) != node->objPtrs.end();
+    if (!holdsParticle && !(external && node->objPtrs.size() == 1)) {
+        std::array<float, 3> separation;
+        for (int k = 0; k < 3; k++) {
+            separation[k] = node->centerOfMass[k] - objPtr->position[k];
+        }
+        applyMinimumImage(separation);
+        if (acceptNode(*node, objPtr->position, separation, previousAcceleration, 1 - interactionListMargin)) {
+            interactionNodes[index].push_back(node);
+            return;
+        }
+    }
+    if (external) {
+        for (const std::shared_ptr<T>& otherPtr : node->objPtrs) {
+            if (otherPtr.get() != objPtr) {
+                interactionParticles[index].push_back(otherPtr.get());
+            }
+        }
+        return;
+    }
+
+    for (const Octree<T>* child : {node->child0.get(), node->child1.get(), node->child2.get(), node->child3.get(), node->child4.get(), node->child5.get(), node->child6.get(), node->child7.get()}) {
+        recordInteractionList(index, child, previousAcceleration);
+    }
+}
+
+// Sum the interaction lists of particle 'index' into 'force' and 'potential'. With 'checkCriterion', every stored node
+// must still pass the opening criterion at the refitted positions, and the sum stops with false at the first that does
+// not.
+template <typename T>
+bool GravitationalEnvironment<T>::evaluateInteractionList(int index, float previousAcceleration, bool checkCriterion, std::array<float, 3>& force, float& potential) const {
+    const T& particle = *particlePtrs[index];
+    std::array<float, 3> separation;
+    for (const Octree<T>* node : interactionNodes[index]) {
+        for (int k = 0; k < 3; k++) {
+            separation[k] = node->centerOfMass[k] - particle.position[k];
+        }
+        applyMinimumImage(separation);
+        if (checkCriterion && !acceptNode(*node, particle.position, separation, previousAcceleration)) {
+            return false;
+        }
+        accumulateInteraction(separation, G * particle.mass * node->totalMass, force, potential);
+        if (multipoleOrder == 2) {
+            accumulateQuadrupole(separation, node->quadrupole, G * particle.mass, force, potential);
+        }
+    }
+    for (const T* otherPtr : interactionParticles[index]) {
+        for (int k = 0; k < 3; k++) {
+            separation[k] = otherPtr->position[k] - particle.position[k];
+        }
+        accumulateInteraction(separation, G * particle.mass * otherPtr->mass, force, potential);
+    }
+    return true;
+}
+
+// Whether the cell of 'outer' encloses the cell of 'inner' (octree cells nest, so this holds for its ancestors)
+template <typename T>
+static bool containsCell(const Octree<T>& outer, const Octree<T>& inner) {
+    return outer.xCoords[0] <= inner.xCoords[0] && inner.xCoords[1] <= outer.xCoords[1] && outer.yCoords[0] <= inner.yCoords[0] && inner.yCoords[1] <= outer.yCoords[1] && outer.zCoords[0] <= inner.zCoords[0] && inner.zCoords[1] <= outer.zCoords[1];
+}
+
+// Walk the octree against itself for the particles of 'sink'. Pairs of cells whose bounding spheres (radius bmax about
+// the center of mass) satisfy (bmax_sink + bmax_source) < theta * d interact once, through the source's expansion
+// added as a first-order Taylor series to the sink's local expansion; other pairs split the larger cell, and pairs of
+// leaves are summed directly. Only the sink side is written, so disjoint sinks can be walked concurrently.
+template <typename T>
+void GravitationalEnvironment<T>::interactDualTree(Octree<T>* sink, const Octree<T>* source, const std::unordered_map<const T*, int>& indices, std::vector<std::array<float, 3>>& forces) {
+    if (source == nullptr || sink == nullptr) {
+        return;
+    }
+
+    std::array<const Octree<T>*, 8> sourceChildren = {source->child0.get(), source->child1.get(), source->child2.get(), source->child3.get(), source->child4.get(), source->child5.get(), source->child6.get(), source->child7.get()};
+    std::array<Octree<T>*, 8> sinkChildren = {sink->child0.get(), sink->child1.get(), sink->child2.get(), sink->child3.get(), sink->child4.get(), sink->child5.get(), sink->child6.get(), sink->child7.get()};
+
+    // Pairs of leaves, including a leaf with itself, are summed directly
+    if (!sink->internal && !source->internal) {
+        for (const std::shared_ptr<T>& objPtr : sink->objPtrs) {
+            int i = indices.at(objPtr.get());
+            for (const std::shared_ptr<T>& otherPtr : source->objPtrs) {
+                if (otherPtr != objPtr) {
+                    std::array<float, 3> separation;
+                    for (int k = 0; k < 3; k++) {
+                        separation[k] = otherPtr->position[k] - objPtr->position[k];
+                    }
+                    accumulateInteraction(separation, G * objPtr->mass * otherPtr->mass, forces[i], potentials[i]);
+                }
+            }
+        }
+        return;
+    }
+
+    // A cell with itself becomes every pair of its children
+    if (sink == source) {
+        for (Octree<T>* sinkChild : sinkChildren) {
+            for (const Octree<T>* sourceChild : sourceChildren) {
+                interactDualTree(sinkChild, sourceChild, indices, forces);
+            }
+        }
+        return;
+    }
+
+    // A source enclosing the sink is never accepted
+    bool enclosing = containsCell(*source, *sink);
+    if (!enclosing) {
+        std::array<float, 3> separation;
+        for (int k = 0; k < 3; k++) {
+            separation[k] = source->centerOfMass[k] - sink->centerOfMass[k];
+        }
+        applyMinimumImage(separation);
+        float d2 = separation[0] * separation[0] + separation[1] * separation[1] + separation[2] * separation[2];
+        float extent = sink->bmax + source->bmax;
+        if (extent * extent < theta * theta * d2) {
+            // Monopole (and quadrupole) field at the sink's center of mass, and the monopole's tidal tensor
+            // T_kl = -G M (g delta_kl + 2 g' s_k s_l), with g the softened force factor
+            std::array<float, 10>& local = sink->localExpansion;
+            std::array<float, 3> acceleration = {0, 0, 0};
+            accumulateInteraction(separation, G * source->totalMass, acceleration, local[0]);
+            if (multipoleOrder == 2) {
+                accumulateQuadrupole(separation, source->quadrupole, G, acceleration, local[0]);
+            }
+            float g = softening.forceFactor(d2);
+            float dg = softening.forceFactorDerivative(d2);
+            float gm = G * source->totalMass;
+            for (int k = 0; k < 3; k++) {
+                local[1 + k] += acceleration[k];
+                local[4 + k] -= gm * (g + 2 * dg * separation[k] * separation[k]);
+            }
+            local[7] -= gm * 2 * dg * separation[0] * separation[1];
+            local[8] -= gm * 2 * dg * separation[0] * separation[2];
+            local[9] -= gm * 2 * dg * separation[1] * separation[2];
+            return;
+        }
+    }
+
+    // Split the source when it encloses the sink, when the sink is a leaf, or when it is the larger cell
+    float sinkWidth = std::max({sink->xCoords[1] - sink->xCoords[0], sink->yCoords[1] - sink->yCoords[0], sink->zCoords[1] - sink->zCoords[0]});
+    float sourceWidth = std::max({source->xCoords[1] - source->xCoords[0], source->yCoords[1] - source->yCoords[0], source->zCoords[1] - source->zCoords[0]});
+    if (source->internal && (enclosing || !sink->internal || sourceWidth >= sinkWidth)) {
+        for (const Octree<T>* sourceChild : sourceChildren) {
+            interactDualTree(sink, sourceChild, indices, forces);
+        }
+    } else {
+        for (Octree<T>* sinkChild : sinkChildren) {
+            interactDualTree(sinkChild, source, indices, forces);
+        }
+    }
+}
+
+// Shift a parent's local expansion from 'origin' to this node's center of mass, add the node's own, and pass the sum
+// on to the children; leaves evaluate it at their particles
+template <typename T>
+void GravitationalEnvironment<T>::pushLocalExpansion(Octree<T>* node, std::array<float, 10> expansion, const std::array<float, 3>& origin, const std::unordered_map<const T*, int>& indices, std::vector<std::array<float, 3>>& forces) {
+    if (node == nullptr) {
+        return;
+    }
+
+    // phi(x + dx) = phi - a.dx - dx.T.dx / 2 and a(x + dx) = a + T.dx
+    auto shift = [](std::array<float, 10>& local, const std::array<float, 3>& dx) {
+        std::array<float, 3> tdx = {local[4] * dx[0] + local[7] * dx[1] + local[8] * dx[2],
+                                    local[7] * dx[0] + local[5] * dx[1] + local[9] * dx[2],
+                                    local[8] * dx[0] + local[9] * dx[1] + local[6] * dx[2]};
+        for (int k = 0; k < 3; k++) {
+            local[0] -= (local[1 + k] + 0.5f * tdx[k]) * dx[k];
+            local[1 + k] += tdx[k];
+        }
+    };
+
+    shift(expansion, {node->centerOfMass[0] - origin[0], node->centerOfMass[1] - origin[1], node->centerOfMass[2] - origin[2]});
+    for (int k = 0; k < 10; k++) {
+        expansion[k] += node->localExpansion[k];
+    }
+
+    if (!node->internal) {
+        for (const std::shared_ptr<T>& objPtr : node->objPtrs) {
+            int i = indices.at(objPtr.get());
+            std::array<float, 10> local = expansion;
+            shift(local, {objPtr->position[0] - node->centerOfMass[0], objPtr->position[1] - node->centerOfMass[1], objPtr->position[2] - node->centerOfMass[2]});
+            for (int k = 0; k < 3; k++) {
+                forces[i][k] += objPtr->mass * local[1 + k];
+            }
+            potentials[i] += objPtr->mass * local[0];
+        }
+        return;
+    }
+
+    for (Octree<T>* child : {node->child0.get(), node->child1.get(), node->child2.get(), node->child3.get(), node->child4.get(), node->child5.get(), node->child6.get(), node->child7.get()}) {
+        pushLocalExpansion(child, expansion, node->centerOfMass, indices, forces);
+    }
+}
+
+// Dual-tree force evaluation: the octree is cut into disjoint sink subtrees, and each is walked against the whole tree
+// on its own thread and then has its local expansions pushed down to its particles
+template <typename T>
+std::vector<std::array<float, 3>> GravitationalEnvironment<T>::getForcesDualTree(const float timestep) {
+    buildOctree();
+    std::vector<std::array<float, 3>> forces(nParticles);
+    potentials.assign(nParticles, 0);
+    if (nParticles == 0) {
+        return forces;
+    }
+
+    std::unordered_map<const T*, int> indices;
+    for (int i = 0; i < nParticles; i++) {
+        indices[particlePtrs[i].get()] = i;
+    }
+
+    // Open cells breadth first until there are enough sinks to share out. The cut does not depend on the thread count,
+    // so neither do the forces.
+    const size_t targetSinks = 256;
+    std::vector<Octree<T>*> sinks = {&envOctree};
+    bool opened = true;
+    while (sinks.size() < targetSinks && opened) {
+        opened = false;
+        std::vector<Octree<T>*> nextSinks;
+        for (Octree<T>* sink : sinks) {
+            if (!sink->internal) {
+                nextSinks.push_back(sink);
+                continue;
+            }
+            opened = true;
+            for (Octree<T>* child : {sink->child0.get(), sink->child1.get(), sink->child2.get(), sink->child3.get(), sink->child4.get(), sink->child5.get(), sink->child6.get(), sink->child7.get()}) {
+                if (child != nullptr) {
+                    nextSinks.push_back(child);
+                }
+            }
+        }
+        sinks = std::move(nextSinks);
+    }
+
+    parallelFor(sinks.size(), nThreads, [&](size_t begin, size_t end) {
+        for (size_t s = begin; s < end; s++) {
+            interactDualTree(sinks[s], &envOctree, indices, forces);
+            pushLocalExpansion(sinks[s], {}, sinks[s]->centerOfMass, indices, forces);
+        }
+    });
+    return forces;
+}
+
+template <typename T>
+// Update each particle in the environment
 void GravitationalEnvironment<T>::updateAll(const std::vector<std::array<float, 3>>& forces, const float timestep) {
     for (int i = 0; i < nParticles; i++){
         particlePtrs[i]->update(&(forces[i]), timestep);
     }
+    octreeCurrent = false;
+
+    // Particles leaving a periodic box re-enter on the opposite side
+    if (periodic) {
+        wrapPositions();
+    }
+}
+
+template <typename T>
+// Select the integrator, and the force engine it needs: Hermite always uses the direct-summation kernel with jerks,
+// and Wisdom-Holman a kernel that separates the central body's pull from the interactions
+void GravitationalEnvironment<T>::setIntegrator(const std::string& name) {
+    using namespace std::placeholders;
+    const double cbrt2 = std::cbrt(2.0);
+    if (name == "euler") {
+        integrate = std::bind(&GravitationalEnvironment::updateAll, this, _1, _2);
+    } else if (name == "leapfrog") {
+        integrate = std::bind(&GravitationalEnvironment::integrateLeapfrog, this, _1, _2);
+    } else if (name == "yoshida4") {
+        // Triple jump of Yoshida (1990)
+        double w1 = 1 / (2 - cbrt2);
+        integrate = std::bind(&GravitationalEnvironment::integrateComposition, this, _1, _2, std::vector<double>{w1, 1 - 2 * w1, w1});
+    } else if (name == "yoshida6") {
+        // Solution A of Yoshida (1990)
+        double w1 = -1.17767998417887, w2 = 0.235573213359357, w3 = 0.784513610477560;
+        double w0 = 1 - 2 * (w1 + w2 + w3);
+        integrate = std::bind(&GravitationalEnvironment::integrateComposition, this, _1, _2, std::vector<double>{w3, w2, w1, w0, w1, w2, w3});
+    } else if (name == "hermite") {
+        integrate = std::bind(&GravitationalEnvironment::integrateHermite, this, _1, _2);
+    } else if (name == "wisdom-holman") {
+        integrate = std::bind(&GravitationalEnvironment::integrateWisdomHolman, this, _1, _2);
+    } else {
+        throw std::invalid_argument("Invalid integrator " + name + ".");
+    }
+    integrator = name;
+    forcesCached = false;
+
+    if (name == "hermite") {
+        getForces = std::bind(&GravitationalEnvironment::getForcesPairWiseWithJerks, this, _1);
+    } else if (name == "wisdom-holman") {
+        getForces = std::bind(&GravitationalEnvironment::getForcesWisdomHolman, this, _1);
+    } else if (forceAlgorithm == "pair-wise") {
+        getForces = std::bind(&GravitationalEnvironment::getForcesPairWise, this, _1);
+    } else if (forceAlgorithm == "dual-tree") {
+        getForces = std::bind(&GravitationalEnvironment::getForcesDualTree, this, _1);
+    } else {
+        getForces = std::bind(&GravitationalEnvironment::getForcesBarnesHut, this, _1);
+    }
+}
+
+template <typename T>
+// Change every velocity by the given forces over 'timestep'
+void GravitationalEnvironment<T>::kick(const std::vector<std::array<float, 3>>& forces, const float timestep) {
+    for (int i = 0; i < nParticles; i++) {
+        T& particle = *particlePtrs[i];
+        for (int k = 0; k < 3; k++) {
+            particle.velocity[k] += forces[i][k] / particle.mass * timestep;
+        }
+    }
+}
+
+template <typename T>
+// Move every particle along its velocity for 'timestep'
+void GravitationalEnvironment<T>::drift(const float timestep) {
+    for (int i = 0; i < nParticles; i++) {
+        T& particle = *particlePtrs[i];
+        for (int k = 0; k < 3; k++) {
+            particle.position[k] += particle.velocity[k] * timestep;
+        }
+    }
+    octreeCurrent = false;
+    if (periodic) {
+        wrapPositions();
+    }
+}
+
+template <typename T>
+// Kick-drift-kick leapfrog (second order, symplectic). The closing kick's forces are those of the new positions, so
+// they are cached for the next step.
+void GravitationalEnvironment<T>::integrateLeapfrog(const std::vector<std::array<float, 3>>& forces, const float timestep) {
+    integrateComposition(forces, timestep, {1});
+}
+
+template <typename T>
+// Chain leapfrog substeps of 'weights[s] * timestep'. Symmetric weights summing to one compose a higher-order
+// symplectic map; each substep costs one force evaluation.
+void GravitationalEnvironment<T>::integrateComposition(const std::vector<std::array<float, 3>>& forces, const float timestep, const std::vector<double>& weights) {
+    std::vector<std::array<float, 3>> substepForces = forces;
+    for (double weight : weights) {
+        float h = weight * timestep;
+        kick(substepForces, 0.5f * h);
+        drift(h);
+        substepForces = getForces(h);
+        kick(substepForces, 0.5f * h);
+    }
+    cachedForces.swap(substepForces);
+    forcesCached = true;
+}
+
+template <typename T>
+// Fourth-order Hermite predictor-corrector (Makino & Aarseth 1992). 'forces' and 'jerks' are those at the start of
+// the step; the forces and jerks at the predicted state are kept for the next step.
+void GravitationalEnvironment<T>::integrateHermite(const std::vector<std::array<float, 3>>& forces, const float timestep) {
+    std::vector<std::array<float, 3>> jerks0 = jerks;
+    std::vector<std::array<float, 3>> positions0(nParticles);
+    std::vector<std::array<float, 3>> velocities0(nParticles);
+    float dt2 = timestep * timestep;
+    float dt3 = dt2 * timestep;
+
+    // Predict with the Taylor series in the acceleration and jerk
+    for (int i = 0; i < nParticles; i++) {
+        T& particle = *particlePtrs[i];
+        positions0[i] = particle.position;
+        velocities0[i] = particle.velocity;
+        for (int k = 0; k < 3; k++) {
+            float a = forces[i][k] / particle.mass;
+            float j = jerks0[i][k] / particle.mass;
+            particle.position[k] += particle.velocity[k] * timestep + a * dt2 / 2 + j * dt3 / 6;
+            particle.velocity[k] += a * timestep + j * dt2 / 2;
+        }
+    }
+
+    // Evaluate at the predicted state, then correct
+    std::vector<std::array<float, 3>> forces1 = getForces(timestep);
+    for (int i = 0; i < nParticles; i++) {
+        T& particle = *particlePtrs[i];
+        for (int k = 0; k < 3; k++) {
+            float a0 = forces[i][k] / particle.mass;
+            float a1 = forces1[i][k] / particle.mass;
+            float j0 = jerks0[i][k] / particle.mass;
+            float j1 = jerks[i][k] / particle.mass;
+            particle.velocity[k] = velocities0[i][k] + (a0 + a1) * timestep / 2 + (j0 - j1) * dt2 / 12;
+            particle.position[k] = positions0[i][k] + (velocities0[i][k] + particle.velocity[k]) * timestep / 2 + (a0 - a1) * dt2 / 12;
+        }
+    }
+    octreeCurrent = false;
+    if (periodic) {
+        wrapPositions();
+    }
+    cachedForces.swap(forces1);
+    forcesCached = true;
+}
+
+template <typename T>
+// Add massless tracers, which feel the massive particles but never act on them
+void GravitationalEnvironment<T>::addTracers(const std::vector<std::array<float, 3>>& positions, const std::vector<std::array<float, 3>>& velocities) {
+    tracerPositions.insert(tracerPositions.end(), positions.begin(), positions.end());
+    tracerVelocities.insert(tracerVelocities.end(), velocities.begin(), velocities.end());
+    tracerAccelerationsCurrent = false;
+}
+
+template <typename T>
+// Get the acceleration at a point by walking the octree of the massive particles, with the same opening criterion as
+// the Barnes-Hut force engine. Read-only, so tracers can walk the tree concurrently.
+std::array<float, 3> GravitationalEnvironment<T>::getAccelerationBarnesHut(const std::array<float, 3>& position, const Octree<T>* node, float previousAcceleration) const {
+    std::array<float, 3> acceleration = {0, 0, 0};
+    if (node == nullptr || (!node->internal && node->objPtrs.empty())) {
+        return acceleration;
+    }
+    float potential = 0;
+
+    std::array<float, 3> separation;
+    for (int k = 0; k < 3; k++) {
+        separation[k] = node->centerOfMass[k] - position[k];
+    }
+    applyMinimumImage(separation);
+    if (acceptNode(*node, position, separation, previousAcceleration)) {
+        accumulateInteraction(separation, G * node->totalMass, acceleration, potential);
+        if (multipoleOrder == 2) {
+            accumulateQuadrupole(separation, node->quadrupole, G, acceleration, potential);
+        }
+        return acceleration;
+    }
+
+    // Leaves are summed directly
+    if (!node->internal) {
+        for (const std::shared_ptr<T>& objPtr : node->objPtrs) {
+            for (int k = 0; k < 3; k++) {
+                separation[k] = objPtr->position[k] - position[k];
+            }
+            accumulateInteraction(separation, G * objPtr->mass, acceleration, potential);
+        }
+        return acceleration;
+    }
+
+    for (const Octree<T>* child : {node->child0.get(), node->child1.get(), node->child2.get(), node->child3.get(), node->child4.get(), node->child5.get(), node->child6.get(), node->child7.get()}) {
+        std::array<float, 3> childAcceleration = getAccelerationBarnesHut(position, child, previousAcceleration);
+        for (int k = 0; k < 3; k++) {
+            acceleration[k] += childAcceleration[k];
+        }
+    }
+    return acceleration;
+}
+
+template <typename T>
+// Evaluate the tracer accelerations in parallel batches: against the octree of the massive particles for Barnes-Hut,
+// and by direct summation over the massive particles otherwise
+void GravitationalEnvironment<T>::computeTracerAccelerations() {
+    std::vector<std::array<float, 3>> previous = std::move(tracerAccelerations);
+    tracerAccelerations.assign(tracerPositions.size(), {0, 0, 0});
+    bool useTree = forceAlgorithm != "pair-wise" && nParticles > 0;
+
+    // Reuse the tree of the last force evaluation when the particles have not moved since (the compact layout builds
+    // its own tree, so it never leaves one behind)
+    if (useTree && !octreeCurrent && interactionNodes.empty()) {
+        buildOctree();
+    } else if (useTree && !octreeCurrent) {
+        // Keep the tree the interaction lists point into
+        refitOctree();
+    }
+
+    parallelFor(tracerPositions.size(), nThreads, [&](size_t begin, size_t end) {
+        float potential = 0;
+        std::array<float, 3> separation;
+        for (size_t t = begin; t < end; t++) {
+            if (useTree) {
+                float previousAcceleration = previous.size() == tracerPositions.size() ? std::sqrt(previous[t][0] * previous[t][0] + previous[t][1] * previous[t][1] + previous[t][2] * previous[t][2]) : 0;
+                tracerAccelerations[t] = getAccelerationBarnesHut(tracerPositions[t], &envOctree, previousAcceleration);
+                continue;
+            }
+            for (int j = 0; j < nParticles; j++) {
+                for (int k = 0; k < 3; k++) {
+                    separation[k] = particlePtrs[j]->position[k] - tracerPositions[t][k];
+                }
+                accumulateInteraction(separation, G * particlePtrs[j]->mass, tracerAccelerations[t], potential);
+            }
+        }
+    });
+    tracerAccelerationsCurrent = true;
+}
+
+template <typename T>
+// Kick the tracers with their current accelerations
+void GravitationalEnvironment<T>::kickTracers(const float timestep) {
+    for (size_t t = 0; t < tracerPositions.size(); t++) {
+        for (int k = 0; k < 3; k++) {
+            tracerVelocities[t][k] += tracerAccelerations[t][k] * timestep;
+        }
+    }
+}
+
+template <typename T>
+// Drift the tracers along their velocities
+void GravitationalEnvironment<T>::driftTracers(const float timestep) {
+    for (size_t t = 0; t < tracerPositions.size(); t++) {
+        for (int k = 0; k < 3; k++) {
+            tracerPositions[t][k] += tracerVelocities[t][k] * timestep;
+        }
+    }
+    tracerAccelerationsCurrent = false;
+}
+
+template <typename T>
+// Get the index of the most massive particle, about which Wisdom-Holman orbits are solved
+int GravitationalEnvironment<T>::getCentralIndex() const {
+    int central = 0;
+    for (int i = 1; i < nParticles; i++) {
+        if (particlePtrs[i]->mass > particlePtrs[central]->mass) {
+            central = i;
+        }
+    }
+    return central;
+}
+
+template <typename T>
+// Mixed-variable symplectic step in democratic heliocentric coordinates (Duncan, Levison & Lee 1998): heliocentric
+// positions Q and barycentric velocities V. Half an interaction kick and half a jump (the drift of the central body's
+// reflex momentum) wrap an exact Kepler drift of every body about the central mass, so the Kepler motion costs no
+// truncation error and the step only has to resolve the much weaker interactions. Massless bodies are test particles.
+void GravitationalEnvironment<T>::integrateWisdomHolman(const std::vector<std::array<float, 3>>& forces, const float timestep) {
+    int central = getCentralIndex();
+    double centralMass = particlePtrs[central]->mass;
+    double mu = G * centralMass;
+
+    // Barycenter, which moves uniformly
+    double totalMass = 0;
+    std::array<double, 3> barycenter = {0, 0, 0};
+    std::array<double, 3> barycenterVelocity = {0, 0, 0};
+    for (int i = 0; i < nParticles; i++) {
+        const T& particle = *particlePtrs[i];
+        totalMass += particle.mass;
+        for (int k = 0; k < 3; k++) {
+            barycenter[k] += particle.mass * particle.position[k];
+            barycenterVelocity[k] += particle.mass * particle.velocity[k];
+        }
+    }
+    for (int k = 0; k < 3; k++) {
+        barycenter[k] /= totalMass;
+        barycenterVelocity[k] /= totalMass;
+    }
+
+    // Democratic heliocentric coordinates, with the first half kick
+    std::vector<std::array<double, 3>> Q(nParticles);
+    std::vector<std::array<double, 3>> V(nParticles);
+    for (int i = 0; i < nParticles; i++) {
+        for (int k = 0; k < 3; k++) {
+            Q[i][k] = particlePtrs[i]->position[k] - particlePtrs[central]->position[k];
+            V[i][k] = particlePtrs[i]->velocity[k] - barycenterVelocity[k] + 0.5 * timestep * interactionAccelerations[i][k];
+        }
+    }
+
+    // Jump, Kepler drift, jump
+    auto jump = [&](double h) {
+        std::array<double, 3> momentum = {0, 0, 0};
+        for (int i = 0; i < nParticles; i++) {
+            for (int k = 0; k < 3; k++) {
+                momentum[k] += i == central ? 0 : particlePtrs[i]->mass * V[i][k];
+            }
+        }
+        for (int i = 0; i < nParticles; i++) {
+            for (int k = 0; k < 3; k++) {
+                Q[i][k] += i == central ? 0 : h * momentum[k] / centralMass;
+            }
+        }
+    };
+    jump(0.5 * timestep);
+    for (int i = 0; i < nParticles; i++) {
+        if (i != central) {
+            keplerDrift(Q[i], V[i], mu, timestep);
+        }
+    }
+    jump(0.5 * timestep);
+
+    // Back to inertial coordinates: the central body sits where the barycenter requires
+    std::array<double, 3> weightedQ = {0, 0, 0};
+    std::array<double, 3> momentum = {0, 0, 0};
+    for (int i = 0; i < nParticles; i++) {
+        if (i != central) {
+            for (int k = 0; k < 3; k++) {
+                weightedQ[k] += particlePtrs[i]->mass * Q[i][k];
+                momentum[k] += particlePtrs[i]->mass * V[i][k];
+            }
+        }
+    }
+    std::array<double, 3> centralPosition;
+    for (int k = 0; k < 3; k++) {
+        centralPosition[k] = barycenter[k] + barycenterVelocity[k] * timestep - weightedQ[k] / totalMass;
+    }
+    for (int i = 0; i < nParticles; i++) {
+        T& particle = *particlePtrs[i];
+        for (int k = 0; k < 3; k++) {
+            if (i == central) {
+                particle.position[k] = centralPosition[k];
+                particle.velocity[k] = barycenterVelocity[k] - momentum[k] / centralMass;
+            } else {
+                particle.position[k] = centralPosition[k] + Q[i][k];
+                particle.velocity[k] = barycenterVelocity[k] + V[i][k];
+            }
+        }
+    }
+    octreeCurrent = false;
+
+    // Second half kick with the interactions at the new positions, whose forces serve the next step. The
+    // interactions conserve momentum, so the central body's velocity is unchanged.
+    std::vector<std::array<float, 3>> forces1 = getForces(timestep);
+    for (int i = 0; i < nParticles; i++) {
+        if (i != central) {
+            for (int k = 0; k < 3; k++) {
+                particlePtrs[i]->velocity[k] += 0.5f * timestep * interactionAccelerations[i][k];
+            }
+        }
+    }
+    cachedForces.swap(forces1);
+    forcesCached = true;
+}
+
+template <typename T>
+// Keep the accelerations of the latest force evaluation for the log
+void GravitationalEnvironment<T>::recordAccelerations(const std::vector<std::array<float, 3>>& forces) {
+    if (std::none_of(logFieldIds.begin(), logFieldIds.end(), [](int field) { return field >= 7 && field < 10; })) {
+        return;
+    }
+    accelerations.resize(forces.size());
+    for (size_t i = 0; i < forces.size(); i++) {
+        for (int k = 0; k < 3; k++) {
+            accelerations[i][k] = particlePtrs[i]->mass > 0 ? forces[i][k] / particlePtrs[i]->mass : 0;
+        }
+    }
 }
 
 template <typename T>
 // Take a step
-void GravitationalEnvironment<T>::step(const float timestep) {
+float GravitationalEnvironment<T>::step(const float timestep, Snapshot* snapshot) {
+
+    // The particles may have been moved from outside since the last evaluation
+    octreeCurrent = false;
 
     // Get the forces and upate everything
-    std::vector<std::array<float, 3>> forces = getForces(timestep);
-    updateAll(forces, timestep);
+    std::vector<std::array<float, 3>> forces;
+    if (forcesCached && cachedForces.size() == particlePtrs.size()) {
+        forces.swap(cachedForces);
+    } else {
+        forces = getForces(timestep);
+    }
+    forcesCached = false;
+    recordAccelerations(forces);
+    if (!tracerPositions.empty() && !tracerAccelerationsCurrent) {
+        computeTracerAccelerations();
+    }
+
+    // With adaptive timestepping, 'timestep' is only an upper limit (e.g. the time left to the next output). The
+    // growth limit follows the controller's own choice, so a step cut short to land on an output does not shrink the next.
+    float chosenTimestep = timestepping == "adaptive" ? chooseTimestep(forces) : timestep;
+    float dt = std::min(timestep, chosenTimestep);
+
+    // Output rows are taken here, so that accelerations and potentials match the logged positions
+    if (snapshot != nullptr) {
+        captureSnapshot(time, *snapshot);
+        massesChanged = false;
+    }
+
+    // The potentials from the force walk match the current positions and velocities, so record diagnostics before moving
+    // (unless simulate already recorded this state at the end of the previous run)
+    if (diagnosticsInterval > 0 && stepCount % diagnosticsInterval == 0 && (diagnostics.empty() || diagnostics.back().time != time)) {
+        diagnostics.push_back(getDiagnostics());
+    }
+    // Tracers take a kick-drift-kick step around the massive step, with the closing kick in the field of the moved
+    // massive particles
+    bool hasTracers = !tracerPositions.empty();
+    if (hasTracers) {
+        kickTracers(0.5f * dt);
+        driftTracers(dt);
+    }
+    integrate(forces, dt);
+    if (hasTracers) {
+        computeTracerAccelerations();
+        kickTracers(0.5f * dt);
+    }
+
+    // Resolve any overlapping bodies at their new positions. Merges move and remove bodies, which invalidates the
+    // cached forces, the tree and the interaction lists; bounces only change velocities, on which only the Hermite
+    // jerks cached with the forces depend.
+    if (collisionMode != "none" && resolveCollisions() > 0) {
+        if (collisionMode == "merge") {
+            forcesCached = false;
+            tracerAccelerationsCurrent = false;
+            octreeCurrent = false;
+            clearInteractionLists();
+        } else if (integrator == "hermite") {
+            forcesCached = false;
+        }
+    }
 
     // Update time
-    time += timestep;
+    time += dt;
+    stepCount++;
+    lastTimestep = chosenTimestep;
+    return dt;
+}
+
+template <typename T>
+// Pick a timestep from the largest acceleration: dt = eta * sqrt(length / |a|max), limited to [dtMin, dtMax] and to
+// 'timestepGrowth' times the previous step
+float GravitationalEnvironment<T>::chooseTimestep(const std::vector<std::array<float, 3>>& forces) const {
+    float maxAcceleration2 = 0;
+    for (size_t i = 0; i < forces.size(); i++) {
+        float mass = particlePtrs[i]->mass;
+        if (mass > 0) {
+            float force2 = forces[i][0] * forces[i][0] + forces[i][1] * forces[i][1] + forces[i][2] * forces[i][2];
+            maxAcceleration2 = std::max(maxAcceleration2, force2 / (mass * mass));
+        }
+    }
+
+    float length = timestepLength > 0 ? timestepLength : softening.length;
+    if (length <= 0) {
+        throw std::invalid_argument("Adaptive timesteps need a timestepLength or a softening length.");
+    }
+    float dt = maxAcceleration2 > 0 ? timestepEta * std::sqrt(length / std::sqrt(maxAcceleration2)) : INFINITY;
+    if (lastTimestep > 0) {
+        dt = std::min(dt, timestepGrowth * lastTimestep);
+    }
+    if (dtMax > 0) {
+        dt = std::min(dt, dtMax);
+    }
+    return std::max(dt, dtMin);
+}
+
+// Find overlapping pairs with an octree broad phase and resolve them according to 'collisionMode'. Each particle only
+// searches a sphere of its own radius plus the largest radius in the environment, so this stays O(N log N).
+// Returns the number of collisions resolved.
+template <typename T>
+int GravitationalEnvironment<T>::resolveCollisions() {
+
+    // Nothing can collide without at least two particles with a size
+    float maxRadius = 0;
+    for (int i = 0; i < nParticles; i++) {
+        maxRadius = std::max(maxRadius, getRadius(*particlePtrs[i]));
+    }
+    if (nParticles < 2 || maxRadius == 0) {
+        return 0;
+    }
+
+    // Broad phase on the compact octree, so that the force tree and any interaction lists pointing into it survive
+    // steps without collisions. Its radius queries wrap around a periodic box.
+    buildCompactOctree();
+    int nCollisions = 0;
+    std::vector<bool> merged(nParticles, false);
+    std::vector<int> candidates(64);
+    for (int i = 0; i < nParticles; i++) {
+        if (merged[i]) {
+            continue;
+        }
+        T& first = *particlePtrs[i];
+
+        int nCandidates = compactOctree.radiusQuery(first.position, getRadius(first) + maxRadius, candidates.data(), candidates.size());
+        if (nCandidates > static_cast<int>(candidates.size())) {
+            candidates.resize(2 * nCandidates);
+            compactOctree.radiusQuery(first.position, getRadius(first) + maxRadius, candidates.data(), candidates.size());
+        }
+        for (int c = 0; c < nCandidates; c++) {
+
+            // Each pair is handled once, by its lower index
+            int j = candidates[c];
+            if (j <= i || merged[j]) {
+                continue;
+            }
+            T& second = *particlePtrs[j];
+
+            // Narrow phase
+            std::array<float, 3> separation = {second.position[0] - first.position[0], second.position[1] - first.position[1], second.position[2] - first.position[2]};
+            applyMinimumImage(separation);
+            float distance = sqrt(separation[0] * separation[0] + separation[1] * separation[1] + separation[2] * separation[2]);
+            if (distance >= getRadius(first) + getRadius(second)) {
+                continue;
+            }
+            // A collision is counted when it changes something: a merge, or a bounce of an approaching pair
+            if (collisionMode == "merge") {
+                nCollisions++;
+                // Conserve mass, momentum and volume; the merged body sits at the pair's center of mass
+                float totalMass = first.mass + second.mass;
+                for (int k = 0; k < 3; k++) {
+                    first.position[k] += second.mass / totalMass * separation[k];
+                    first.velocity[k] = (first.mass * first.velocity[k] + second.mass * second.velocity[k]) / totalMass;
+                }
+                setRadius(first, cbrt(pow(getRadius(first), 3) + pow(getRadius(second), 3)));
+                first.mass = totalMass;
+                merged[j] = true;
+            } else if (distance > 0) {
+                // Hard-sphere bounce: exchange an impulse along the line of centers if the pair is approaching
+                std::array<float, 3> normal = {separation[0] / distance, separation[1] / distance, separation[2] / distance};
+                float approachSpeed = 0;
+                for (int k = 0; k < 3; k++) {
+                    approachSpeed += (second.velocity[k] - first.velocity[k]) * normal[k];
+                }
+                if (approachSpeed < 0) {
+                    nCollisions++;
+                    float impulse = -(1 + restitution) * approachSpeed / (1 / first.mass + 1 / second.mass);
+                    for (int k = 0; k < 3; k++) {
+                        first.velocity[k] -= impulse / first.mass * normal[k];
+                        second.velocity[k] += impulse / second.mass * normal[k];
+                    }
+                }
+            }
+        }
+    }
+
+    // Merged bodies can sit just outside a periodic box
+    if (periodic && collisionMode == "merge") {
+        wrapPositions();
+    }
+
+    // Compact the particle array, dropping the bodies that were absorbed; the others keep their IDs
+    if (collisionMode == "merge" && nCollisions > 0) {
+        if (particleIds.empty()) {
+            particleIds.resize(nParticles);
+            std::iota(particleIds.begin(), particleIds.end(), 0);
+            nParticleIds = nParticles;
+        }
+        int nKept = 0;
+        for (int i = 0; i < nParticles; i++) {
+            if (!merged[i]) {
+                particleIds[nKept] = particleIds[i];
+                particlePtrs[nKept++] = particlePtrs[i];
+            }
+        }
+        particlePtrs.resize(nKept);
+        particleIds.resize(nKept);
+        nParticles = nKept;
+        massesChanged = true;
+    }
+
+    return nCollisions;
+}
+
+// Compute the conserved quantities of the environment. The potential energy reuses the per-particle potentials from
+// the most recent force evaluation, so this is O(N) regardless of the force algorithm.
+template <typename T>
+EnvironmentDiagnostics GravitationalEnvironment<T>::getDiagnostics() const {
+    EnvironmentDiagnostics diag = {time, 0, 0, 0, {0, 0, 0}, {0, 0, 0}, 0};
+
+    for (int i = 0; i < nParticles; i++) {
+        const T& particle = *particlePtrs[i];
+        std::array<double, 3> p = {particle.mass * static_cast<double>(particle.velocity[0]),
+                                   particle.mass * static_cast<double>(particle.velocity[1]),
+                                   particle.mass * static_cast<double>(particle.velocity[2])};
+
+        diag.kineticEnergy += 0.5 * (p[0] * particle.velocity[0] + p[1] * particle.velocity[1] + p[2] * particle.velocity[2]);
+        for (int k = 0; k < 3; k++) {
+            diag.momentum[k] += p[k];
+        }
+
+        // L = r x p
+        diag.angularMomentum[0] += particle.position[1] * p[2] - particle.position[2] * p[1];
+        diag.angularMomentum[1] += particle.position[2] * p[0] - particle.position[0] * p[2];
+        diag.angularMomentum[2] += particle.position[0] * p[1] - particle.position[1] * p[0];
+    }
+
+    // Each pair's potential is stored on both of its particles
+    if (static_cast<int>(potentials.size()) == nParticles) {
+        for (float potential : potentials) {
+            diag.potentialEnergy += 0.5 * potential;
+        }
+    }
+
+    diag.totalEnergy = diag.kineticEnergy + diag.potentialEnergy;
+    diag.virialRatio = diag.potentialEnergy == 0 ? 0 : 2 * diag.kineticEnergy / std::abs(diag.potentialEnergy);
+    return diag;
+}
+
+// Get the relative drift of the total energy between the first and last recorded diagnostics (NaN if unavailable)
+template <typename T>
+double GravitationalEnvironment<T>::getEnergyError() const {
+    if (diagnostics.size() < 2 || diagnostics.front().totalEnergy == 0) {
+        return std::nan("");
+    }
+    return std::abs((diagnostics.back().totalEnergy - diagnostics.front().totalEnergy) / diagnostics.front().totalEnergy);
+}
+
+// Get the recorded diagnostics as a compact csv time series
+template <typename T>
+std::string GravitationalEnvironment<T>::getDiagnosticsLog() const {
+    std::string diagnosticsLog = "Time,kineticEnergy,potentialEnergy,totalEnergy,px,py,pz,Lx,Ly,Lz,virialRatio\n";
+    char line[512];
+    for (const EnvironmentDiagnostics& diag : diagnostics) {
+        snprintf(line, sizeof(line), "%g,%.10g,%.10g,%.10g,%.10g,%.10g,%.10g,%.10g,%.10g,%.10g,%.10g\n",
+                 diag.time, diag.kineticEnergy, diag.potentialEnergy, diag.totalEnergy,
+                 diag.momentum[0], diag.momentum[1], diag.momentum[2],
+                 diag.angularMomentum[0], diag.angularMomentum[1], diag.angularMomentum[2], diag.virialRatio);
+        diagnosticsLog += line;
+    }
+    return diagnosticsLog;
+}
+
+// Get the group catalogs as one csv table, a row per group per output time
+template <typename T>
+std::string GravitationalEnvironment<T>::getGroupLog() const {
+    std::string groupLog = "Time,group,nMembers,mass,x,y,z,vx,vy,vz,velocityDispersion\n";
+    char line[512];
+    for (const GroupProperties& group : groupCatalog) {
+        snprintf(line, sizeof(line), "%g,%d,%d,%.10g,%.10g,%.10g,%.10g,%.10g,%.10g,%.10g,%.10g\n",
+                 group.time, group.group, group.nMembers, group.mass,
+                 group.center[0], group.center[1], group.center[2],
+                 group.velocity[0], group.velocity[1], group.velocity[2], group.velocityDispersion);
+        groupLog += line;
+    }
+    return groupLog;
 }
 
 // Get log file header
 template <typename T>
 std::string GravitationalEnvironment<T>::getLogHeader() const {
-    std::string header = "Time,";
-
-    // Add header entries for each particle
-    for (int i=0; i < nParticles; i++) {
-        header += "mass" + std::to_string(i) + ",";
-        header += "x" + std::to_string(i) + ",";
-        header += "y" + std::to_string(i) + ",";
-        header += "z" + std::to_string(i) + ",";
-        header += "vx" + std::to_string(i) + ",";
-        header += "vy" + std::to_string(i) + ",";
-        if (i == nParticles - 1){
-            header += "vz" + std::to_string(i);
-        } else {
-            header += "vz" + std::to_string(i) + ",";
+    std::vector<int> ids = getOutputIds();
+    std::vector<int> slots = getParticleSlots();
+    std::string header = "Time";
+
+    // Add header entries for each particle, and for each tracer with a 't' before its index
+    for (int i : ids) {
+        std::string label = i >= 0 ? std::to_string(i) : "t" + std::to_string(-i - 1);
+        for (const std::string& field : logFields) {
+            header += "," + field + label;
         }
     }
+
+    // Without a mass column, the masses are written once on a comment line above the header
+    if (std::find(logFieldIds.begin(), logFieldIds.end(), 0) == logFieldIds.end()) {
+        std::vector<float> masses;
+        for (int i : ids) {
+            masses.push_back(i < 0 ? 0 : slots[i] < 0 ? NAN : particlePtrs[slots[i]]->mass);
+        }
+        header = getMassLine(masses) + header;
+    }
     return header + "\n";
 }
 
+// Format the comment line that carries the masses when they are not a logged field
 template <typename T>
-// Get the row of the logging csv
-std::string GravitationalEnvironment<T>::getStepLog() const {
-    
-    // Iterate through the particles and append the data to the logging string
-    std::string logLine = "";
-    for (auto partPrt : particlePtrs) {
+std::string GravitationalEnvironment<T>::getMassLine(const std::vector<float>& masses) const {
+    CsvWriter writer(logWriter.shortest);
+    writer.append(masses.data(), masses.size());
+    writer.endRow();
+    return "# mass," + std::string(writer.view());
+}
 
-        // Append mass
-        logLine += std::to_string(partPrt->mass) + ",";
+template <typename T>
+// Copy the selected fields of every particle into a snapshot
+void GravitationalEnvironment<T>::captureSnapshot(float rowTime, Snapshot& snapshot) const {
+    snapshot.time = rowTime;
+    std::vector<int> ids = getOutputIds();
+    std::vector<int> slots = getParticleSlots();
+    snapshot.values.resize(ids.size() * logFieldIds.size());
+    bool hasAccelerations = accelerations.size() == particlePtrs.size();
+    bool hasPotentials = potentials.size() == particlePtrs.size();
+
+    // Iterate through the selected particles and gather the fields; bodies absorbed in a merge are NaN
+    size_t index = 0;
+    for (int id : ids) {
+        if (id < 0) {
+            appendTracerFields(-id - 1, snapshot.values, index);
+            continue;
+        }
+        int i = slots[id];
+        if (i < 0) {
+            std::fill_n(snapshot.values.begin() + index, logFieldIds.size(), NAN);
+            index += logFieldIds.size();
+            continue;
+        }
+        const T& particle = *particlePtrs[i];
+        for (int field : logFieldIds) {
+            float value;
+            if (field == 0) {
+                value = particle.mass;
+            } else if (field < 4) {
+                value = particle.position[field - 1];
+            } else if (field < 7) {
+                value = particle.velocity[field - 4];
+            } else if (field < 10) {
+                value = hasAccelerations ? accelerations[i][field - 7] : 0;
+            } else {
+                value = hasPotentials ? potentials[i] : 0;
+            }
+            snapshot.values[index++] = value;
+        }
+    }
 
-        // Append position
-        logLine += std::to_string(partPrt->position[0]) + "," + std::to_string(partPrt->position[1]) + "," + std::to_string(partPrt->position[2]) + ",";
+    // After a merge, rows that do not log the masses are preceded by a fresh mass line
+    snapshot.masses.clear();
+    if (massesChanged && std::find(logFieldIds.begin(), logFieldIds.end(), 0) == logFieldIds.end()) {
+        for (int id : ids) {
+            snapshot.masses.push_back(id < 0 ? 0 : slots[id] < 0 ? NAN : particlePtrs[slots[id]]->mass);
+        }
+    }
+}
 
-        // Append velocity
-        logLine += std::to_string(partPrt->velocity[0]) + "," + std::to_string(partPrt->velocity[1]) + "," + std::to_string(partPrt->velocity[2]) + ",";
+template <typename T>
+// Write the selected fields of one tracer; tracers have no mass and no potential energy
+void GravitationalEnvironment<T>::appendTracerFields(int tracer, std::vector<float>& values, size_t& index) const {
+    bool hasAccelerations = tracerAccelerations.size() == tracerPositions.size();
+    for (int field : logFieldIds) {
+        float value = 0;
+        if (field >= 1 && field < 4) {
+            value = tracerPositions[tracer][field - 1];
+        } else if (field >= 4 && field < 7) {
+            value = tracerVelocities[tracer][field - 4];
+        } else if (field >= 7 && field < 10 && hasAccelerations) {
+            value = tracerAccelerations[tracer][field - 7];
+        }
+        values[index++] = value;
+    }
+}
+
+template <typename T>
+// Fix the particles written to the log from the output selection: ID ranges, a random tracer fraction and a region.
+// A particle is logged if it passes every criterion that is set.
+void GravitationalEnvironment<T>::selectOutputParticles() {
+    outputIds.clear();
+    outputSubset = !outputRanges.empty() || outputFraction < 1 || !outputRegion.empty();
+    if (!outputSubset) {
+        return;
+    }
+    CounterRNG rng(seed, getStreamId("outputFraction"));
+    CounterRNG tracerRng(seed, getStreamId("outputTracerFraction"));
+    auto isSelected = [&](int i, const std::array<float, 3>& position, float uniform) {
+        bool selected = outputRanges.empty();
+        for (const std::array<int, 2>& range : outputRanges) {
+            selected = selected || (i >= range[0] && i <= range[1]);
+        }
+        if (outputFraction < 1) {
+            selected = selected && uniform < outputFraction;
+        }
+        if (!outputRegion.empty()) {
+            for (int k = 0; k < 3; k++) {
+                selected = selected && position[k] >= outputRegion[k] && position[k] < outputRegion[k + 3];
+            }
+        }
+        return selected;
+    };
+    std::vector<int> slots = getParticleSlots();
+    for (int id = 0; id < static_cast<int>(slots.size()); id++) {
+        if (slots[id] >= 0 && isSelected(id, particlePtrs[slots[id]]->position, rng.uniform(id, 0))) {
+            outputIds.push_back(id);
+        }
     }
 
-    return logLine;
+    // Index ranges only name massive particles; tracers are chosen by fraction and region
+    for (int t = 0; t < static_cast<int>(tracerPositions.size()); t++) {
+        if (outputRanges.empty() && isSelected(-1, tracerPositions[t], tracerRng.uniform(t, 0))) {
+            outputIds.push_back(-t - 1);
+        }
+    }
+}
+
+template <typename T>
+// Get the IDs of the logged particles, with tracer t as -t - 1. Bodies absorbed in a merge keep their IDs, so the
+// columns stay the same for the whole run.
+std::vector<int> GravitationalEnvironment<T>::getOutputIds() const {
+    if (outputSubset) {
+        return outputIds;
+    }
+    std::vector<int> ids;
+    int nIds = particleIds.empty() ? particlePtrs.size() : nParticleIds;
+    for (int id = 0; id < nIds; id++) {
+        ids.push_back(id);
+    }
+    for (int t = 0; t < static_cast<int>(tracerPositions.size()); t++) {
+        ids.push_back(-t - 1);
+    }
+    return ids;
+}
+
+template <typename T>
+// Get the index of the particle with each ID, or -1 for the bodies absorbed in merges
+std::vector<int> GravitationalEnvironment<T>::getParticleSlots() const {
+    std::vector<int> slots(particleIds.empty() ? particlePtrs.size() : nParticleIds, -1);
+    for (int i = 0; i < static_cast<int>(particlePtrs.size()); i++) {
+        slots[particleIds.empty() ? i : particleIds[i]] = i;
+    }
+    return slots;
+}
+
+template <typename T>
+// Format a snapshot as a row of the logging csv
+void GravitationalEnvironment<T>::formatSnapshot(const Snapshot& snapshot, CsvWriter& writer) const {
+    writer.clear();
+    writer.append(snapshot.time);
+    writer.append(snapshot.values.data(), snapshot.values.size());
+    writer.endRow();
+}
+
+template <typename T>
+// Get the row of the logging csv
+std::string GravitationalEnvironment<T>::getStepLog() const {
+    Snapshot snapshot;
+    captureSnapshot(time, snapshot);
+    CsvWriter writer(logWriter.shortest);
+    formatSnapshot(snapshot, writer);
+    return std::string(writer.view());
 }
 
 template <typename T>
 // Run a simulation
 void GravitationalEnvironment<T>::simulate(const float duration, const float timestep) {
-    std::string logStr = getLogHeader();
-    std::cout << getLogHeader() + "\n";
 
-    // Get number of timesteps and take steps iteratively
-    float nTimesteps = duration / timestep;
-    for (int i = 0; i < nTimesteps; i++) {
+    // If logging, rows are written to the file as they are produced: either as csv or as a compressed trajectory
+    // next to where the csv would go
+    std::ofstream logFile;
+    std::unique_ptr<TrajectoryWriter> trajectory;
+    std::string outputFileName = logFileName;
+    if (log == true) {
+        if (outputFormat == "trajectory") {
+            outputFileName = logFileName.substr(0, logFileName.rfind(".csv")) + ".htrj";
+            try {
+                trajectory = std::make_unique<TrajectoryWriter>(outputFileName, logFields, trajectoryChunkSize, keyframeInterval);
+            } catch (const std::runtime_error& e) {
+                std::cerr << "Failed to open the file: " << outputFileName << std::endl;
+            }
+        } else {
+            logFile.open(logFileName);
+            if (!logFile.is_open()) {
+                std::cerr << "Failed to open the file: " << logFileName << std::endl;
+            }
+        }
+    }
+    bool echo = verbosity == "full";
+    bool writeRows = logFile.is_open() || trajectory || echo;
+    selectOutputParticles();
+    std::string header = getLogHeader();
+    massesChanged = false;
+    if (logFile.is_open()) {
+        logFile << header;
+    }
+    if (echo) {
+        std::cout << header;
+    }
+
+    // Rows are formatted and written on a writer thread while the next steps are taken; the simulation thread only
+    // copies the particle state into one of the snapshot buffers
+    AsyncWriter writer([&](const Snapshot& snapshot) {
+        if (trajectory) {
+            trajectory->writeStep(snapshot);
+        }
+        if (!snapshot.masses.empty() && (logFile.is_open() || echo)) {
+            std::string massLine = getMassLine(snapshot.masses);
+            if (logFile.is_open()) {
+                logFile << massLine;
+            }
+            if (echo) {
+                std::cout << massLine;
+            }
+        }
+        if (logFile.is_open() || echo) {
+            formatSnapshot(snapshot, logWriter);
+        }
+        if (logFile.is_open()) {
+            logFile << logWriter.view();
+        }
+        if (echo) {
+            std::cout << logWriter.view();
+        }
+    }, outputBuffers);
 
-        // If logging, append to log string
-        if (log == true) {
-            logStr += std::to_string(i * timestep);
-            logStr += getStepLog() + "\n";
+    // Progress lines are printed at most every 'progressInterval' seconds of wall time
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double lastProgress = 0;
+
+    // Get number of timesteps and take steps iteratively
+    // Outputs are 'timestep' apart (the last one may overshoot 'duration' by less than one interval). An adaptive run
+    // takes as many substeps as it needs between outputs, and the last one is cut short to land on the output time.
+    int totalSteps = std::ceil(duration / timestep * (1 - 1E-6));
+    float startTime = time;
+    for (int i = 0; i < totalSteps; i++) {
+        float outputTime = startTime + (i + 1) * timestep;
+
+        // Take a step, which fills the snapshot once the forces are known
+        Snapshot* snapshot = writeRows ? writer.acquire() : nullptr;
+        if (timestepping == "adaptive") {
+            float remaining = outputTime - time;
+            Snapshot* firstSnapshot = snapshot;
+            while (step(remaining, firstSnapshot) < remaining) {
+                firstSnapshot = nullptr;
+                remaining = outputTime - time;
+
+                // Rounding may leave the run on, just short of or past the output time
+                if (remaining <= 1E-6f * timestep) {
+                    break;
+                }
+            }
+        } else {
+            step(timestep, snapshot);
+        }
+        time = outputTime;
+        if (writeRows) {
+            writer.submit(snapshot);
+        }
+        if (linkingLength > 0 && (i + 1) % groupInterval == 0) {
+            std::vector<GroupProperties> groups = findGroups();
+            groupCatalog.insert(groupCatalog.end(), groups.begin(), groups.end());
         }
-        std::cout << i * timestep << ",\t" << getStepLog() << "\n";
 
-        // Take a step
-        step(timestep);
+        if (verbosity == "progress") {
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (elapsed - lastProgress >= progressInterval || i + 1 == totalSteps) {
+                std::cout << formatProgress(i + 1, totalSteps, time, elapsed, getEnergyError());
+                lastProgress = elapsed;
+            }
+        }
     }
-    // end state
-    if (log == true) {
-        logStr += std::to_string(nTimesteps * timestep) + ",";
-        logStr += getStepLog() + "\n";
+    // end state. The leapfrog family and Hermite leave the forces and potentials at the final positions cached; the
+    // other integrators need one more evaluation for logged accelerations or the final diagnostics row.
+    bool logsAccelerations = std::any_of(logFieldIds.begin(), logFieldIds.end(), [](int field) { return field >= 7; });
+    if ((writeRows && logsAccelerations) || diagnosticsInterval > 0) {
+        if (!forcesCached || cachedForces.size() != particlePtrs.size()) {
+            cachedForces = getForces(timestep);
+            forcesCached = true;
+        }
+        recordAccelerations(cachedForces);
+    }
+    if (diagnosticsInterval > 0) {
+        diagnostics.push_back(getDiagnostics());
+    }
+    if (writeRows) {
+        Snapshot* snapshot = writer.acquire();
+        captureSnapshot(time, *snapshot);
+        massesChanged = false;
+        writer.submit(snapshot);
+    }
+    writer.finish();
+
+    if (logFile.is_open() || trajectory) {
+        logFile.close();
+        if (trajectory) {
+            trajectory->close();
+        }
+        if (verbosity != "silent") {
+            std::cout << "Successfully logged to " + outputFileName + "\n";
+        }
     }
-    std::cout << nTimesteps * timestep << ",\t"  << getStepLog() << "\n";
 
+    // Diagnostics go to a companion file next to the particle log
+    if (log == true && diagnosticsInterval > 0) {
+        std::string diagnosticsFileName = logFileName.substr(0, logFileName.rfind(".csv")) + "_diagnostics.csv";
+        std::ofstream diagnosticsFile(diagnosticsFileName);
+        if (!diagnosticsFile.is_open()) {
+            std::cerr << "Failed to open the file: " << diagnosticsFileName << std::endl;
+        } else {
+            diagnosticsFile << getDiagnosticsLog();
+        }
+    }
 
-    // If logging, open file and write to it
-    if (log == true) {
-        std::ofstream logFile(logFileName);
-        if (!logFile.is_open()) {
-            std::cerr << "Failed to open the file: " << logFileName << std::endl;
+    // So do the group catalogs
+    if (log == true && linkingLength > 0) {
+        std::string groupFileName = logFileName.substr(0, logFileName.rfind(".csv")) + "_groups.csv";
+        std::ofstream groupFile(groupFileName);
+        if (!groupFile.is_open()) {
+            std::cerr << "Failed to open the file: " << groupFileName << std::endl;
         } else {
-            logFile << logStr;
-            std::cout << "Successfully logged to " + logFileName + "\n";
+            groupFile << getGroupLog();
         }
-        logFile.close();
     }
 }
 
@@ -494,6 +2455,15 @@ template <typename T>
 // Reset the environment
 void GravitationalEnvironment<T>::reset() {
     time = 0;
+    forcesCached = false;
+    tracerAccelerationsCurrent = false;
+    octreeCurrent = false;
+    lastTimestep = 0;
+    stepCount = 0;
+    diagnostics.clear();
+    groupCatalog.clear();
+    previousAccelerations.clear();
+    clearInteractionLists();
 }
 
 // Define classes for both 'Particle' and 'Body'
@@ -0,0 +1,151 @@
+#define _USE_MATH_DEFINES
+
+#include <array>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "../include/ewald.h"
+
+// Splitting parameter between the real- and reciprocal-space sums, and the number of images summed in each
+const double EWALD_ALPHA = 2.0;
+const int EWALD_IMAGES = 3;
+
+// The limit of the potential correction at zero separation
+const double EWALD_SELF_POTENTIAL = 2.8372975;
+
+
+// Correction to the Newtonian acceleration -x / |x|^3 of a target at x (box units) due to a unit source and all of
+// its periodic images
+std::array<double, 3> getEwaldForceCorrection(const std::array<double, 3>& x) {
+    std::array<double, 3> force = {0, 0, 0};
+    double r2 = x[0] * x[0] + x[1] * x[1] + x[2] * x[2];
+    if (r2 == 0) {
+        return force;
+    }
+
+    // Remove the direct term, which the force engines already include
+    double r = sqrt(r2);
+    for (int k = 0; k < 3; k++) {
+        force[k] += x[k] / (r2 * r);
+    }
+
+    for (int nx = -EWALD_IMAGES; nx <= EWALD_IMAGES; nx++) {
+        for (int ny = -EWALD_IMAGES; ny <= EWALD_IMAGES; ny++) {
+            for (int nz = -EWALD_IMAGES; nz <= EWALD_IMAGES; nz++) {
+
+                // Real-space sum
+                std::array<double, 3> dx = {x[0] - nx, x[1] - ny, x[2] - nz};
+                double dr = sqrt(dx[0] * dx[0] + dx[1] * dx[1] + dx[2] * dx[2]);
+                double val = erfc(EWALD_ALPHA * dr) + 2 * EWALD_ALPHA * dr / sqrt(M_PI) * exp(-EWALD_ALPHA * EWALD_ALPHA * dr * dr);
+                for (int k = 0; k < 3; k++) {
+                    force[k] -= dx[k] / (dr * dr * dr) * val;
+                }
+
+                // Reciprocal-space sum
+                int h2 = nx * nx + ny * ny + nz * nz;
+                if (h2 > 0) {
+                    double hdotx = x[0] * nx + x[1] * ny + x[2] * nz;
+                    double hval = 2.0 / h2 * exp(-M_PI * M_PI * h2 / (EWALD_ALPHA * EWALD_ALPHA)) * sin(2 * M_PI * hdotx);
+                    force[0] -= nx * hval;
+                    force[1] -= ny * hval;
+                    force[2] -= nz * hval;
+                }
+            }
+        }
+    }
+    return force;
+}
+
+// Correction to the Newtonian potential -1 / |x| (box units) of a unit source and all of its periodic images
+double getEwaldPotentialCorrection(const std::array<double, 3>& x) {
+    double r = sqrt(x[0] * x[0] + x[1] * x[1] + x[2] * x[2]);
+    if (r == 0) {
+        return EWALD_SELF_POTENTIAL;
+    }
+
+    double sum = 0;
+    for (int nx = -EWALD_IMAGES; nx <= EWALD_IMAGES; nx++) {
+        for (int ny = -EWALD_IMAGES; ny <= EWALD_IMAGES; ny++) {
+            for (int nz = -EWALD_IMAGES; nz <= EWALD_IMAGES; nz++) {
+
+                // Real-space sum
+                double dr = sqrt(pow(x[0] - nx, 2) + pow(x[1] - ny, 2) + pow(x[2] - nz, 2));
+                sum += erfc(EWALD_ALPHA * dr) / dr;
+
+                // Reciprocal-space sum
+                int h2 = nx * nx + ny * ny + nz * nz;
+                if (h2 > 0) {
+                    double hdotx = x[0] * nx + x[1] * ny + x[2] * nz;
+                    sum += 1 / (M_PI * h2) * exp(-M_PI * M_PI * h2 / (EWALD_ALPHA * EWALD_ALPHA)) * cos(2 * M_PI * hdotx);
+                }
+            }
+        }
+    }
+    return M_PI / (EWALD_ALPHA * EWALD_ALPHA) - sum + 1 / r;
+}
+
+
+// Constructor definition: tabulate the corrections over the octant [0, 1/2]^3
+EwaldTable::EwaldTable(int gridSize)
+    : gridSize(gridSize), table((gridSize + 1) * (gridSize + 1) * (gridSize + 1)) {
+
+    for (int i = 0; i <= gridSize; i++) {
+        for (int j = 0; j <= gridSize; j++) {
+            for (int k = 0; k <= gridSize; k++) {
+                std::array<double, 3> x = {0.5 * i / gridSize, 0.5 * j / gridSize, 0.5 * k / gridSize};
+                std::array<double, 3> force = getEwaldForceCorrection(x);
+                table[(i * (gridSize + 1) + j) * (gridSize + 1) + k] = {static_cast<float>(force[0]), static_cast<float>(force[1]), static_cast<float>(force[2]), static_cast<float>(getEwaldPotentialCorrection(x))};
+            }
+        }
+    }
+}
+
+// Trilinear interpolation of the table
+std::array<float, 4> EwaldTable::interpolate(const std::array<float, 3>& x) const {
+    std::array<int, 3> cell;
+    std::array<float, 3> frac;
+    for (int k = 0; k < 3; k++) {
+        float u = std::min(x[k] * 2 * gridSize, static_cast<float>(gridSize));
+        cell[k] = std::min(static_cast<int>(u), gridSize - 1);
+        frac[k] = u - cell[k];
+    }
+
+    std::array<float, 4> result = {0, 0, 0, 0};
+    for (int corner = 0; corner < 8; corner++) {
+        int di = (corner >> 2) & 1;
+        int dj = (corner >> 1) & 1;
+        int dk = corner & 1;
+        float weight = (di ? frac[0] : 1 - frac[0]) * (dj ? frac[1] : 1 - frac[1]) * (dk ? frac[2] : 1 - frac[2]);
+        const std::array<float, 4>& entry = table[((cell[0] + di) * (gridSize + 1) + cell[1] + dj) * (gridSize + 1) + cell[2] + dk];
+        for (int m = 0; m < 4; m++) {
+            result[m] += weight * entry[m];
+        }
+    }
+    return result;
+}
+
+std::array<float, 3> EwaldTable::forceCorrection(const std::array<float, 3>& separation, float boxSize) const {
+
+    // The table is in terms of the target relative to the source, in box units, folded into the first octant
+    std::array<float, 3> x;
+    for (int k = 0; k < 3; k++) {
+        x[k] = std::abs(separation[k]) / boxSize;
+    }
+    std::array<float, 4> entry = interpolate(x);
+
+    // Each component is odd in its own coordinate
+    std::array<float, 3> correction;
+    for (int k = 0; k < 3; k++) {
+        correction[k] = (separation[k] > 0 ? -entry[k] : entry[k]) / (boxSize * boxSize);
+    }
+    return correction;
+}
+
+float EwaldTable::potentialCorrection(const std::array<float, 3>& separation, float boxSize) const {
+    std::array<float, 3> x;
+    for (int k = 0; k < 3; k++) {
+        x[k] = std::abs(separation[k]) / boxSize;
+    }
+    return interpolate(x)[3] / boxSize;
+}
@@ -0,0 +1,159 @@
+#include <array>
+#include <vector>
+#include <atomic>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+#include "../include/groups.h"
+#include "../include/parallel.h"
+
+// Constructor: every element starts in its own set
+ConcurrentUnionFind::ConcurrentUnionFind(int n) : parents(n) {
+    for (int i = 0; i < n; i++) {
+        parents[i].store(i, std::memory_order_relaxed);
+    }
+}
+
+// Root of x's set. Parents only ever move to smaller indices in the same set, so a stale read just takes a longer
+// path, and the halving update may fail harmlessly.
+int ConcurrentUnionFind::find(int x) {
+    while (true) {
+        int parent = parents[x].load(std::memory_order_acquire);
+        if (parent == x) {
+            return x;
+        }
+        int grandparent = parents[parent].load(std::memory_order_acquire);
+        if (grandparent != parent) {
+            parents[x].compare_exchange_weak(parent, grandparent, std::memory_order_acq_rel);
+        }
+        x = grandparent;
+    }
+}
+
+// Merge the sets of a and b by pointing the larger root at the smaller; retry if another thread moved the root first
+void ConcurrentUnionFind::unite(int a, int b) {
+    while (true) {
+        a = find(a);
+        b = find(b);
+        if (a == b) {
+            return;
+        }
+        if (a < b) {
+            std::swap(a, b);
+        }
+        int expected = a;
+        if (parents[a].compare_exchange_strong(expected, b, std::memory_order_acq_rel)) {
+            return;
+        }
+    }
+}
+
+std::vector<int> findFriendsOfFriends(const CompactOctree& tree, float linkingLength, int nThreads) {
+    if (linkingLength <= 0) {
+        throw std::invalid_argument("The linking length must be positive.");
+    }
+    int nParticles = tree.order.size();
+    ConcurrentUnionFind sets(nParticles);
+
+    // Threads take contiguous runs of the tree order, so their queries touch nearby nodes
+    parallelFor(nParticles, nThreads, [&](size_t begin, size_t end) {
+        std::vector<int> friends(64);
+        for (size_t slot = begin; slot < end; slot++) {
+            int i = tree.order[slot];
+            int count = tree.radiusQuery(tree.positions[slot], linkingLength, friends.data(), friends.size());
+            if (count > static_cast<int>(friends.size())) {
+                friends.resize(2 * count);
+                tree.radiusQuery(tree.positions[slot], linkingLength, friends.data(), friends.size());
+            }
+            // Each pair is linked once, from its smaller index
+            for (int f = 0; f < count; f++) {
+                if (friends[f] > i) {
+                    sets.unite(i, friends[f]);
+                }
+            }
+        }
+    });
+
+    std::vector<int> labels(nParticles);
+    for (int i = 0; i < nParticles; i++) {
+        labels[i] = sets.find(i);
+    }
+    return labels;
+}
+
+std::vector<GroupProperties> getGroupProperties(const std::vector<int>& labels, const std::vector<std::array<float, 3>>& positions, const std::vector<std::array<float, 3>>& velocities, const std::vector<float>& masses, int minMembers, float period, double time) {
+    int nParticles = labels.size();
+
+    // Members of each label; the label is the smallest member, so it comes first
+    std::vector<int> sizes(nParticles, 0);
+    for (int label : labels) {
+        sizes[label]++;
+    }
+    std::vector<int> roots;
+    for (int i = 0; i < nParticles; i++) {
+        if (labels[i] == i && sizes[i] >= std::max(minMembers, 1)) {
+            roots.push_back(i);
+        }
+    }
+    std::stable_sort(roots.begin(), roots.end(), [&](int a, int b) { return sizes[a] > sizes[b]; });
+    std::vector<int> groupOf(nParticles, -1);
+    for (size_t g = 0; g < roots.size(); g++) {
+        groupOf[roots[g]] = g;
+    }
+
+    std::vector<GroupProperties> groups(roots.size());
+    std::vector<std::array<double, 3>> offsets(roots.size(), {0, 0, 0});
+    std::vector<double> weights(roots.size(), 0);
+    for (size_t g = 0; g < roots.size(); g++) {
+        groups[g] = {time, static_cast<int>(g), sizes[roots[g]], 0, {0, 0, 0}, {0, 0, 0}, 0};
+    }
+
+    // Massless members count with unit weight when the whole group is massless
+    auto getWeight = [&](int i, int g) { return groups[g].mass > 0 ? static_cast<double>(masses[i]) : 1.0; };
+    for (int i = 0; i < nParticles; i++) {
+        int g = groupOf[labels[i]];
+        if (g >= 0) {
+            groups[g].mass += masses[i];
+        }
+    }
+    for (int i = 0; i < nParticles; i++) {
+        int g = groupOf[labels[i]];
+        if (g < 0) {
+            continue;
+        }
+        double weight = getWeight(i, g);
+        const std::array<float, 3>& reference = positions[roots[g]];
+        for (int k = 0; k < 3; k++) {
+            double offset = positions[i][k] - reference[k];
+            if (period > 0) {
+                offset -= period * std::round(offset / period);
+            }
+            offsets[g][k] += weight * offset;
+            groups[g].velocity[k] += weight * velocities[i][k];
+        }
+        weights[g] += weight;
+    }
+    for (size_t g = 0; g < roots.size(); g++) {
+        for (int k = 0; k < 3; k++) {
+            groups[g].center[k] = positions[roots[g]][k] + offsets[g][k] / weights[g];
+            groups[g].velocity[k] /= weights[g];
+        }
+    }
+
+    // sigma^2 = sum m |v - v_cm|^2 / (3 M)
+    for (int i = 0; i < nParticles; i++) {
+        int g = groupOf[labels[i]];
+        if (g < 0) {
+            continue;
+        }
+        for (int k = 0; k < 3; k++) {
+            double dv = velocities[i][k] - groups[g].velocity[k];
+            groups[g].velocityDispersion += getWeight(i, g) * dv * dv;
+        }
+    }
+    for (size_t g = 0; g < roots.size(); g++) {
+        groups[g].velocityDispersion = std::sqrt(groups[g].velocityDispersion / (3 * weights[g]));
+    }
+    return groups;
+}
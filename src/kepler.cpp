@@ -0,0 +1,76 @@
+#include <array>
+#include <cmath>
+#include <stdexcept>
+
+#include "../include/kepler.h"
+
+std::array<double, 4> getStumpffFunctions(double x) {
+    std::array<double, 4> c;
+
+    // Series near zero, where the closed forms cancel catastrophically
+    if (std::abs(x) < 0.1) {
+        c[2] = 1.0 / 2 - x * (1.0 / 24 - x * (1.0 / 720 - x * (1.0 / 40320 - x / 3628800)));
+        c[3] = 1.0 / 6 - x * (1.0 / 120 - x * (1.0 / 5040 - x * (1.0 / 362880 - x / 39916800)));
+    } else if (x > 0) {
+        double root = std::sqrt(x);
+        c[2] = (1 - std::cos(root)) / x;
+        c[3] = (root - std::sin(root)) / (x * root);
+    } else {
+        double root = std::sqrt(-x);
+        c[2] = (1 - std::cosh(root)) / x;
+        c[3] = (root - std::sinh(root)) / (x * root);
+    }
+    c[0] = 1 - x * c[2];
+    c[1] = 1 - x * c[3];
+    return c;
+}
+
+void keplerDrift(std::array<double, 3>& position, std::array<double, 3>& velocity, double mu, double timestep) {
+    double r0 = std::sqrt(position[0] * position[0] + position[1] * position[1] + position[2] * position[2]);
+    if (r0 == 0 || timestep == 0) {
+        return;
+    }
+    double v2 = velocity[0] * velocity[0] + velocity[1] * velocity[1] + velocity[2] * velocity[2];
+    double eta0 = position[0] * velocity[0] + position[1] * velocity[1] + position[2] * velocity[2];
+    double beta = 2 * mu / r0 - v2;  // mu / a, negative on hyperbolic orbits
+    double zeta = mu - beta * r0;
+
+    // Solve r0 G1 + eta0 G2 + mu G3 = timestep for the universal anomaly s, where Gn = s^n cn(beta s^2)
+    double s = timestep / r0;
+    double g1 = 0, g2 = 0, g3 = 0, r = r0;
+    for (int iteration = 0; iteration < 100; iteration++) {
+        std::array<double, 4> c = getStumpffFunctions(beta * s * s);
+        double g0 = c[0];
+        g1 = s * c[1];
+        g2 = s * s * c[2];
+        g3 = s * s * s * c[3];
+        double f = r0 * g1 + eta0 * g2 + mu * g3 - timestep;
+        r = r0 * g0 + eta0 * g1 + mu * g2;  // df/ds
+        double fpp = eta0 * g0 + zeta * g1;
+        double root = std::sqrt(std::abs(16 * r * r - 20 * f * fpp));
+        double ds = 5 * f / (r + (r >= 0 ? root : -root));
+        s -= ds;
+        if (std::abs(ds) <= 1E-14 * std::abs(s)) {
+            break;
+        }
+        if (iteration == 99) {
+            throw std::runtime_error("Kepler solver did not converge.");
+        }
+    }
+
+    // Gauss f and g functions
+    std::array<double, 4> c = getStumpffFunctions(beta * s * s);
+    g1 = s * c[1];
+    g2 = s * s * c[2];
+    g3 = s * s * s * c[3];
+    r = r0 * c[0] + eta0 * g1 + mu * g2;
+    double f = 1 - mu * g2 / r0;
+    double g = timestep - mu * g3;
+    double fDot = -mu * g1 / (r * r0);
+    double gDot = 1 - mu * g2 / r;
+    for (int k = 0; k < 3; k++) {
+        double x = position[k];
+        position[k] = f * x + g * velocity[k];
+        velocity[k] = fDot * x + gDot * velocity[k];
+    }
+}
@@ -0,0 +1,290 @@
+#define _USE_MATH_DEFINES
+
+#include <array>
+#include <vector>
+#include <map>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+#include "../include/models.h"
+#include "../include/statistics.h"
+#include "../include/parallel.h"
+
+// Gravitational constant shared with the force engines
+extern float G;
+
+// Give up on a rejection sampler after this many draws (the acceptance rates here are all above 10%)
+const int MAX_REJECTION_DRAWS = 1000;
+
+
+bool isPhaseSpaceModel(const std::string& distType) {
+    return distType == "plummer" || distType == "hernquist" || distType == "king" || distType == "disk" || distType == "coldCollapse";
+}
+
+// Get an optional numeric parameter of a model block
+double getModelParam(const std::map<std::string, std::string>& modelConfig, const std::string& key, double defaultValue) {
+    return modelConfig.find(key) != modelConfig.end() ? std::stod(modelConfig.at(key)) : defaultValue;
+}
+
+// Uniformly distributed unit vector times 'length', from two uniform draws
+std::array<double, 3> getIsotropicVector(double length, double u1, double u2) {
+    double cosTheta = 2 * u1 - 1;
+    double sinTheta = sqrt(1 - cosTheta * cosTheta);
+    double phi = 2 * M_PI * u2;
+    return {length * sinTheta * cos(phi), length * sinTheta * sin(phi), length * cosTheta};
+}
+
+// Sample a speed in [0, vMax] with density proportional to 'density(v)' by rejection, using draws from 'draw' onward
+template <typename Density>
+double sampleSpeed(double vMax, Density density, const CounterRNG& rng, uint64_t index, uint32_t& draw) {
+
+    // Bound the density on a grid, with a safety margin
+    double densityMax = 0;
+    for (int i = 1; i <= 64; i++) {
+        densityMax = std::max(densityMax, density(vMax * i / 64.));
+    }
+    densityMax *= 1.2;
+
+    for (int attempt = 0; attempt < MAX_REJECTION_DRAWS; attempt++) {
+        double v = vMax * rng.uniform(index, draw++);
+        if (densityMax * rng.uniform(index, draw++) < density(v)) {
+            return v;
+        }
+    }
+    return 0;
+}
+
+// Isotropic Plummer sphere (Aarseth, Henon & Wielen 1974) in units G = M = a = 1
+void samplePlummer(const CounterRNG& rng, uint64_t index, std::array<double, 3>& position, std::array<double, 3>& velocity) {
+    uint32_t draw = 0;
+
+    // Radius from the inverse cumulative mass, cut at 10 scale radii
+    double r;
+    do {
+        double X = std::max(rng.uniform(index, draw++), 1E-12);
+        r = 1 / sqrt(pow(X, -2. / 3.) - 1);
+    } while (r > 10 && draw < MAX_REJECTION_DRAWS);
+    position = getIsotropicVector(r, rng.uniform(index, draw), rng.uniform(index, draw + 1));
+    draw += 2;
+
+    // Speed as a fraction q of the escape speed, from g(q) = q^2 (1 - q^2)^(7/2)
+    double q = sampleSpeed(1, [](double q) { return q * q * pow(1 - q * q, 3.5); }, rng, index, draw);
+    double escapeSpeed = sqrt(2.) * pow(1 + r * r, -0.25);
+    velocity = getIsotropicVector(q * escapeSpeed, rng.uniform(index, draw), rng.uniform(index, draw + 1));
+}
+
+// Isotropic Hernquist (1990) sphere in units G = M = a = 1, truncated at 'rMax'
+void sampleHernquist(const CounterRNG& rng, uint64_t index, double rMax, std::array<double, 3>& position, std::array<double, 3>& velocity) {
+    uint32_t draw = 0;
+
+    // M(r) = r^2 / (1 + r)^2, restricted to the mass inside rMax
+    double maxMass = rMax * rMax / ((1 + rMax) * (1 + rMax));
+    double sqrtX = sqrt(maxMass * rng.uniform(index, draw++));
+    double r = sqrtX / (1 - sqrtX);
+    position = getIsotropicVector(r, rng.uniform(index, draw), rng.uniform(index, draw + 1));
+    draw += 2;
+
+    // Speed from v^2 f(psi - v^2 / 2), with the isotropic distribution function as a function of q^2 = energy
+    double psi = 1 / (1 + r);
+    auto distributionFunction = [](double energy) {
+        if (energy <= 0) {
+            return 0.;
+        }
+        double q = sqrt(std::min(energy, 1 - 1E-12));
+        double q2 = q * q;
+        return (3 * asin(q) + q * sqrt(1 - q2) * (1 - 2 * q2) * (8 * q2 * q2 - 8 * q2 - 3)) / pow(1 - q2, 2.5);
+    };
+    double v = sampleSpeed(sqrt(2 * psi), [&](double v) { return v * v * distributionFunction(psi - v * v / 2); }, rng, index, draw);
+    velocity = getIsotropicVector(v, rng.uniform(index, draw), rng.uniform(index, draw + 1));
+}
+
+// Dimensionless density of a King model at potential W, relative to an arbitrary normalization
+double getKingDensity(double W) {
+    if (W <= 0) {
+        return 0;
+    }
+    return exp(W) * erf(sqrt(W)) - sqrt(4 * W / M_PI) * (1 + 2 * W / 3);
+}
+
+KingProfile getKingProfile(double W0) {
+    KingProfile profile;
+    double centralDensity = getKingDensity(W0);
+
+    // Integrate W'' + 2 W' / r = -9 rho(W) / rho(W0) outward with RK4, from the series solution near the center
+    double dr = 1E-3;
+    double r = dr;
+    double W = W0 - 1.5 * r * r;
+    double dW = -3 * r;
+    profile.radius.push_back(0);
+    profile.potential.push_back(W0);
+    profile.enclosedMass.push_back(0);
+
+    auto derivative = [&](double r, double W, double dW) {
+        return -9 * getKingDensity(W) / centralDensity - 2 * dW / r;
+    };
+    while (W > 0 && r < 1E4) {
+        profile.radius.push_back(r);
+        profile.potential.push_back(W);
+        profile.enclosedMass.push_back(-r * r * dW);
+
+        double k1W = dW;
+        double k1D = derivative(r, W, dW);
+        double k2W = dW + 0.5 * dr * k1D;
+        double k2D = derivative(r + 0.5 * dr, W + 0.5 * dr * k1W, k2W);
+        double k3W = dW + 0.5 * dr * k2D;
+        double k3D = derivative(r + 0.5 * dr, W + 0.5 * dr * k2W, k3W);
+        double k4W = dW + dr * k3D;
+        double k4D = derivative(r + dr, W + dr * k3W, k4W);
+        W += dr / 6 * (k1W + 2 * k2W + 2 * k3W + k4W);
+        dW += dr / 6 * (k1D + 2 * k2D + 2 * k3D + k4D);
+        r += dr;
+
+        // Coarser steps in the envelope
+        dr = std::min(1E-2, 1E-3 * std::max(1., r));
+    }
+
+    // Tidal radius, where W reaches zero
+    double previousW = profile.potential.back();
+    double previousR = profile.radius.back();
+    double tidalRadius = previousR + (r - previousR) * previousW / (previousW - W);
+    profile.radius.push_back(tidalRadius);
+    profile.potential.push_back(0);
+    profile.enclosedMass.push_back(std::max(profile.enclosedMass.back(), -tidalRadius * tidalRadius * dW));
+    return profile;
+}
+
+// Isotropic King model in the units of 'profile' (G = sigma = r0 = 1)
+void sampleKing(const KingProfile& profile, const CounterRNG& rng, uint64_t index, std::array<double, 3>& position, std::array<double, 3>& velocity) {
+    uint32_t draw = 0;
+
+    // Radius from the tabulated cumulative mass
+    double mass = profile.enclosedMass.back() * rng.uniform(index, draw++);
+    size_t upper = std::upper_bound(profile.enclosedMass.begin(), profile.enclosedMass.end(), mass) - profile.enclosedMass.begin();
+    upper = std::min(std::max(upper, static_cast<size_t>(1)), profile.radius.size() - 1);
+    double frac = (mass - profile.enclosedMass[upper - 1]) / (profile.enclosedMass[upper] - profile.enclosedMass[upper - 1]);
+    double r = profile.radius[upper - 1] + frac * (profile.radius[upper] - profile.radius[upper - 1]);
+    double W = std::max(0., profile.potential[upper - 1] + frac * (profile.potential[upper] - profile.potential[upper - 1]));
+    position = getIsotropicVector(r, rng.uniform(index, draw), rng.uniform(index, draw + 1));
+    draw += 2;
+
+    // Speed from v^2 (exp(W - v^2 / 2) - 1)
+    double v = sampleSpeed(sqrt(2 * W), [&](double v) { return v * v * (exp(W - v * v / 2) - 1); }, rng, index, draw);
+    velocity = getIsotropicVector(v, rng.uniform(index, draw), rng.uniform(index, draw + 1));
+}
+
+// Exponential disk with a sech^2 vertical profile, rotating about +z on circular orbits in its own potential (Freeman
+// 1970) plus Gaussian velocity noise. Units are physical.
+void sampleDisk(double totalMass, double scaleRadius, double scaleHeight, double dispersion, double rMax, const CounterRNG& rng, uint64_t index, std::array<double, 3>& position, std::array<double, 3>& velocity) {
+    uint32_t draw = 0;
+
+    // Solve (1 + x) exp(-x) = 1 - u for the radius x = R / Rd with Newton's method, restricted to R < rMax
+    double xMax = rMax / scaleRadius;
+    double u = (1 - (1 + xMax) * exp(-xMax)) * rng.uniform(index, draw++);
+    double x = 1;
+    for (int i = 0; i < 50; i++) {
+        double residual = 1 - (1 + x) * exp(-x) - u;
+        double step = residual / std::max(x * exp(-x), 1E-12);
+        x = std::min(std::max(x - step, 1E-8), xMax);
+        if (std::abs(step) < 1E-10) {
+            break;
+        }
+    }
+    double R = x * scaleRadius;
+    double phi = 2 * M_PI * rng.uniform(index, draw++);
+    double z = scaleHeight * atanh(std::min(std::max(2 * rng.uniform(index, draw++) - 1, -1 + 1E-12), 1 - 1E-12));
+    position = {R * cos(phi), R * sin(phi), z};
+
+    // Circular speed of the razor-thin exponential disk
+    double y = x / 2;
+    double surfaceDensity = totalMass / (2 * M_PI * scaleRadius * scaleRadius);
+    double vCircular2 = 4 * M_PI * G * surfaceDensity * scaleRadius * y * y * (std::cyl_bessel_i(0., y) * std::cyl_bessel_k(0., y) - std::cyl_bessel_i(1., y) * std::cyl_bessel_k(1., y));
+    double vCircular = sqrt(std::max(vCircular2, 0.));
+    velocity = {-vCircular * sin(phi) + dispersion * rng.normal(index, draw), vCircular * cos(phi) + dispersion * rng.normal(index, draw + 1), dispersion * rng.normal(index, draw + 2)};
+}
+
+// Uniform-density sphere with Gaussian velocities scaled to virial ratio 2K / |W| (0 is a cold collapse)
+void sampleColdCollapse(double radius, double sigma, const CounterRNG& rng, uint64_t index, std::array<double, 3>& position, std::array<double, 3>& velocity) {
+    double r = radius * cbrt(rng.uniform(index, 0));
+    position = getIsotropicVector(r, rng.uniform(index, 1), rng.uniform(index, 2));
+    velocity = {sigma * rng.normal(index, 3), sigma * rng.normal(index, 4), sigma * rng.normal(index, 5)};
+}
+
+PhaseSpaceSample samplePhaseSpaceModel(const std::map<std::string, std::string>& modelConfig, int nParticles, uint64_t seed, int nThreads) {
+    std::string distType = modelConfig.at("dist");
+    if (!isPhaseSpaceModel(distType)) {
+        throw std::invalid_argument("Unknown phase-space model " + distType + ".");
+    }
+
+    // Common parameters
+    double totalMass = std::stod(modelConfig.at("totalMass"));
+    double scaleRadius = getModelParam(modelConfig, "scaleRadius", 1);
+    CounterRNG rng(seed, getStreamId(distType));
+
+    // Unit conversion from the dimensionless models (G = M = a = 1) to physical units
+    double lengthUnit = scaleRadius;
+    double velocityUnit = sqrt(G * totalMass / scaleRadius);
+    KingProfile kingProfile;
+    if (distType == "king") {
+        kingProfile = getKingProfile(getModelParam(modelConfig, "W0", 6));
+        velocityUnit = sqrt(G * totalMass / (scaleRadius * kingProfile.enclosedMass.back()));
+    } else if (distType == "disk" || distType == "coldCollapse") {
+        lengthUnit = 1;
+        velocityUnit = 1;
+    }
+
+    // Model-specific parameters
+    double hernquistMaxRadius = getModelParam(modelConfig, "truncationRadius", 20 * scaleRadius) / scaleRadius;
+    double diskMaxRadius = getModelParam(modelConfig, "truncationRadius", 10 * scaleRadius);
+    double scaleHeight = getModelParam(modelConfig, "scaleHeight", 0.1 * scaleRadius);
+    double dispersion = getModelParam(modelConfig, "dispersion", 0);
+    double collapseSigma = sqrt(getModelParam(modelConfig, "virialRatio", 0) * G * totalMass / (5 * scaleRadius));
+
+    // Every particle is independent
+    PhaseSpaceSample sample;
+    sample.positions.resize(nParticles);
+    sample.velocities.resize(nParticles);
+    sample.masses.assign(nParticles, totalMass / nParticles);
+    parallelFor(nParticles, nThreads, [&](size_t begin, size_t end) {
+        std::array<double, 3> position;
+        std::array<double, 3> velocity;
+        for (size_t i = begin; i < end; i++) {
+            if (distType == "plummer") {
+                samplePlummer(rng, i, position, velocity);
+            } else if (distType == "hernquist") {
+                sampleHernquist(rng, i, hernquistMaxRadius, position, velocity);
+            } else if (distType == "king") {
+                sampleKing(kingProfile, rng, i, position, velocity);
+            } else if (distType == "disk") {
+                sampleDisk(totalMass, scaleRadius, scaleHeight, dispersion, diskMaxRadius, rng, i, position, velocity);
+            } else {
+                sampleColdCollapse(scaleRadius, collapseSigma, rng, i, position, velocity);
+            }
+            for (int k = 0; k < 3; k++) {
+                sample.positions[i][k] = position[k] * lengthUnit;
+                sample.velocities[i][k] = velocity[k] * velocityUnit;
+            }
+        }
+    });
+
+    // Move to the center-of-mass frame
+    std::array<double, 3> meanPosition = {0, 0, 0};
+    std::array<double, 3> meanVelocity = {0, 0, 0};
+    for (int i = 0; i < nParticles; i++) {
+        for (int k = 0; k < 3; k++) {
+            meanPosition[k] += sample.positions[i][k] / nParticles;
+            meanVelocity[k] += sample.velocities[i][k] / nParticles;
+        }
+    }
+    parallelFor(nParticles, nThreads, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            for (int k = 0; k < 3; k++) {
+                sample.positions[i][k] -= meanPosition[k];
+                sample.velocities[i][k] -= meanVelocity[k];
+            }
+        }
+    });
+
+    return sample;
+}
@@ -2,10 +2,12 @@
 #include <array>
 #include <memory>
 #include <iostream>
+#include <algorithm>
+#include <cmath>
 
 template <typename T>
-Octree<T>::Octree(std::array<float, 2>& xCoords, std::array<float, 2>& yCoords, std::array<float, 2>& zCoords, bool internal)
-    : totalMass(0), internal(internal), xCoords(xCoords), yCoords(yCoords), zCoords(zCoords) {};
+Octree<T>::Octree(std::array<float, 2>& xCoords, std::array<float, 2>& yCoords, std::array<float, 2>& zCoords, bool internal, int leafSize)
+    : totalMass(0), quadrupole({0, 0, 0, 0, 0, 0}), bmax(0), localExpansion(), internal(internal), leafSize(leafSize), xCoords(xCoords), yCoords(yCoords), zCoords(zCoords) {};
 
 // Recursively set every child to null in the tree, but preserving the tree
 template <typename T>
@@ -23,6 +25,9 @@ void Octree<T>::clearOctree() {
     // Clear the members
     objPtrs.clear();
     totalMass = 0;
+    quadrupole = {0, 0, 0, 0, 0, 0};
+    bmax = 0;
+    localExpansion.fill(0);
 }
 
 template <typename T>
@@ -102,62 +107,62 @@ void Octree<T>::insert(std::shared_ptr<T> objPtr) {
         if (xFlag & yFlag & zFlag) {
             if (child0 == nullptr) {
                 // Instantiate a new octree with the calculated coordinates
-                auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false);
+                auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false, leafSize);
                 child0 = std::move(newOctreePtr);
             }
             child0->insert(objPtr);
         } else if (!xFlag & yFlag & zFlag) {
             if (child1 == nullptr) {
                 // Instantiate a new octree with the calculated coordinates
-                auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false);
+                auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false, leafSize);
                 child1 = std::move(newOctreePtr);
             }
             child1->insert(objPtr);
         } else if (!xFlag & !yFlag & zFlag) {
             if (child2 == nullptr) {
                 // Instantiate a new octree with the calculated coordinates
-                auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false);
+                auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false, leafSize);
                 child2 = std::move(newOctreePtr);
             }
             child2->insert(objPtr);
         } else if (xFlag & !yFlag & zFlag) {
             if (child3 == nullptr) {
                 // Instantiate a new octree with the calculated coordinates
-                auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false);
+                auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false, leafSize);
                 child3 = std::move(newOctreePtr);
             }
             child3->insert(objPtr);
         } else if (xFlag & yFlag & !zFlag) {
             if (child4 == nullptr) {
                 // Instantiate a new octree with the calculated coordinates
-                auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false);
+                auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false, leafSize);
                 child4 = std::move(newOctreePtr);
             }
             child4->insert(objPtr);
         } else if (!xFlag & yFlag & !zFlag) {
             if (child5 == nullptr) {
                 // Instantiate a new octree with the calculated coordinates
-                auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false);
+                auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false, leafSize);
                 child5 = std::move(newOctreePtr);
             }
             child5->insert(objPtr);
         } else if (!xFlag & !yFlag & !zFlag) {
             if (child6 == nullptr) {
                 // Instantiate a new octree with the calculated coordinates
-                auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false);
+                auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false, leafSize);
                 child6 = std::move(newOctreePtr);
             }
             child6->insert(objPtr);
         } else if (xFlag & !yFlag & !zFlag) {
             if (child7 == nullptr) {
                 // Instantiate a new octree with the calculated coordinates
-                auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false);
+                auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false, leafSize);
                 child7 = std::move(newOctreePtr);
             }
             child7->insert(objPtr);
         }
 
-    } else if ((!internal) & (objPtrs.size() > 1)) {
+    } else if ((!internal) & (objPtrs.size() > static_cast<size_t>(leafSize))) {
         // This current node should now be internal
         internal = true;
         for (std::shared_ptr<T> currObjPtr : objPtrs) {
@@ -207,56 +212,56 @@ void Octree<T>::insert(std::shared_ptr<T> objPtr) {
             if (xFlag & yFlag & zFlag) {
                 if (child0 == nullptr) {
                     // Instantiate a new octree with the calculated coordinates
-                    auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false);
+                    auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false, leafSize);
                     child0 = std::move(newOctreePtr);
                 }
                 child0->insert(currObjPtr);
             } else if (!xFlag & yFlag & zFlag) {
                 if (child1 == nullptr) {
                     // Instantiate a new octree with the calculated coordinates
-                    auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false);
+                    auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false, leafSize);
                     child1 = std::move(newOctreePtr);
                 }
                 child1->insert(currObjPtr);
             } else if (!xFlag & !yFlag & zFlag) {
                 if (child2 == nullptr) {
                     // Instantiate a new octree with the calculated coordinates
-                    auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false);
+                    auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false, leafSize);
                     child2 = std::move(newOctreePtr);
                 }
                 child2->insert(currObjPtr);
             } else if (xFlag & !yFlag & zFlag) {
                 if (child3 == nullptr) {
                     // Instantiate a new octree with the calculated coordinates
-                    auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false);
+                    auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false, leafSize);
                     child3 = std::move(newOctreePtr);
                 }
                 child3->insert(currObjPtr);
             } else if (xFlag & yFlag & !zFlag) {
                 if (child4 == nullptr) {
                     // Instantiate a new octree with the calculated coordinates
-                    auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false);
+                    auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false, leafSize);
                     child4 = std::move(newOctreePtr);
                 }
                 child4->insert(currObjPtr);
             } else if (!xFlag & yFlag & !zFlag) {
                 if (child5 == nullptr) {
                     // Instantiate a new octree with the calculated coordinates
-                    auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false);
+                    auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false, leafSize);
                     child5 = std::move(newOctreePtr);
                 }
                 child5->insert(currObjPtr);
             } else if (!xFlag & !yFlag & !zFlag) {
                 if (child6 == nullptr) {
                     // Instantiate a new octree with the calculated coordinates
-                    auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false);
+                    auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false, leafSize);
                     child6 = std::move(newOctreePtr);
                 }
                 child6->insert(currObjPtr);
             } else if (xFlag & !yFlag & !zFlag) {
                 if (child7 == nullptr) {
                     // Instantiate a new octree with the calculated coordinates
-                    auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false);
+                    auto newOctreePtr = std::make_unique<Octree<T>>(xCoordsNew, yCoordsNew, zCoordsNew, false, leafSize);
                     child7 = std::move(newOctreePtr);
                 }
                 child7->insert(currObjPtr);
@@ -273,5 +278,97 @@ void Octree<T>::build(std::vector<std::shared_ptr<T>>& objPtrs) {
     }
 }
 
+// Add the traceless quadrupole moment m (3 d d^T - |d|^2 I) of a mass at offset d from the center of mass
+inline void addQuadrupole(std::array<float, 6>& quadrupole, float mass, const std::array<float, 3>& d) {
+    float d2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+    quadrupole[0] += mass * (3 * d[0] * d[0] - d2);
+    quadrupole[1] += mass * (3 * d[1] * d[1] - d2);
+    quadrupole[2] += mass * (3 * d[2] * d[2] - d2);
+    quadrupole[3] += mass * 3 * d[0] * d[1];
+    quadrupole[4] += mass * 3 * d[0] * d[2];
+    quadrupole[5] += mass * 3 * d[1] * d[2];
+}
+
+// Compute the quadrupole moment of every node about its center of mass, bottom up: leaves sum their objects, and
+// internal nodes shift the moments of their children with the parallel-axis theorem
+template <typename T>
+void Octree<T>::computeQuadrupoles() {
+    quadrupole = {0, 0, 0, 0, 0, 0};
+    if (!internal) {
+        for (const std::shared_ptr<T>& objPtr : objPtrs) {
+            addQuadrupole(quadrupole, objPtr->mass, {objPtr->position[0] - centerOfMass[0], objPtr->position[1] - centerOfMass[1], objPtr->position[2] - centerOfMass[2]});
+        }
+        return;
+    }
+
+    for (Octree<T>* child : {child0.get(), child1.get(), child2.get(), child3.get(), child4.get(), child5.get(), child6.get(), child7.get()}) {
+        if (child != nullptr) {
+            child->computeQuadrupoles();
+            for (int k = 0; k < 6; k++) {
+                quadrupole[k] += child->quadrupole[k];
+            }
+            addQuadrupole(quadrupole, child->totalMass, {child->centerOfMass[0] - centerOfMass[0], child->centerOfMass[1] - centerOfMass[1], child->centerOfMass[2] - centerOfMass[2]});
+        }
+    }
+}
+
+// Bound the extent of every node about its center of mass, bottom up: leaves measure their objects, and internal
+// nodes take the furthest child sphere
+template <typename T>
+void Octree<T>::computeBmax() {
+    bmax = 0;
+    if (!internal) {
+        for (const std::shared_ptr<T>& objPtr : objPtrs) {
+            float dx = objPtr->position[0] - centerOfMass[0];
+            float dy = objPtr->position[1] - centerOfMass[1];
+            float dz = objPtr->position[2] - centerOfMass[2];
+            bmax = std::max(bmax, std::sqrt(dx * dx + dy * dy + dz * dz));
+        }
+        return;
+    }
+
+    for (Octree<T>* child : {child0.get(), child1.get(), child2.get(), child3.get(), child4.get(), child5.get(), child6.get(), child7.get()}) {
+        if (child != nullptr) {
+            child->computeBmax();
+            float dx = child->centerOfMass[0] - centerOfMass[0];
+            float dy = child->centerOfMass[1] - centerOfMass[1];
+            float dz = child->centerOfMass[2] - centerOfMass[2];
+            bmax = std::max(bmax, child->bmax + std::sqrt(dx * dx + dy * dy + dz * dz));
+        }
+    }
+}
+
+// Recompute the mass and center of mass of every node from the current positions of its objects, bottom up, keeping
+// the topology (and cell bounds) of the tree as built
+template <typename T>
+void Octree<T>::refit() {
+    std::array<double, 3> weighted = {0, 0, 0};
+    double mass = 0;
+    if (!internal) {
+        for (const std::shared_ptr<T>& objPtr : objPtrs) {
+            for (int k = 0; k < 3; k++) {
+                weighted[k] += static_cast<double>(objPtr->mass) * objPtr->position[k];
+            }
+            mass += objPtr->mass;
+        }
+    } else {
+        for (Octree<T>* child : {child0.get(), child1.get(), child2.get(), child3.get(), child4.get(), child5.get(), child6.get(), child7.get()}) {
+            if (child != nullptr) {
+                child->refit();
+                for (int k = 0; k < 3; k++) {
+                    weighted[k] += static_cast<double>(child->totalMass) * child->centerOfMass[k];
+                }
+                mass += child->totalMass;
+            }
+        }
+    }
+
+    // Massless nodes keep the position of their first object, as on insertion
+    totalMass = mass;
+    for (int k = 0; k < 3; k++) {
+        centerOfMass[k] = mass > 0 ? weighted[k] / mass : (objPtrs.empty() ? 0 : objPtrs[0]->position[k]);
+    }
+}
+
 template class Octree<Particle>;
 template class Octree<Body>;
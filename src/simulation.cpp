@@ -2,13 +2,29 @@
 #include <array>
 #include <vector>
 #include <memory>
+#include <string>
 
 #include "../include/particle.h"
 #include "../include/body.h"
 #include "../include/environment.h"
+#include "../include/sweep.h"
 
-int main() {
-    GravitationalEnvironment<Body> defaultEnv("default.yaml", true);
+// Usage: HOOTSim [config.yaml]   or   HOOTSim --sweep sweep.yaml   (files are looked up in configs/)
+int main(int argc, char* argv[]) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+
+    // Run every point of a parameter sweep in this process
+    if (args.size() == 2 && args[0] == "--sweep") {
+        Sweep sweep(args[1]);
+        sweep.run();
+        return 0;
+    }
+    if (args.size() > 1 || (args.size() == 1 && args[0].rfind("--", 0) == 0)) {
+        std::cerr << "Usage: HOOTSim [config.yaml] | --sweep sweep.yaml" << std::endl;
+        return 1;
+    }
+
+    GravitationalEnvironment<Body> defaultEnv(args.empty() ? "default.yaml" : args[0], true);
 
     // Simulate
     defaultEnv.simulate(3, 0.5);
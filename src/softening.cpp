@@ -0,0 +1,31 @@
+#include <string>
+#include <stdexcept>
+
+#include "../include/softening.h"
+
+// Constructor definition
+Softening::Softening(std::string type, float length)
+    : type(type), length(length), length2(length * length), h(2.8 * length), hInv(0), h3Inv(0) {
+
+    if (type == "none") {
+        kernel = NONE;
+    } else if (type == "plummer") {
+        kernel = PLUMMER;
+    } else if (type == "spline") {
+        kernel = SPLINE;
+    } else {
+        throw std::invalid_argument("Invalid softening kernel " + type + ".");
+    }
+
+    // A zero-length kernel is Newtonian
+    if (kernel != NONE && length <= 0) {
+        if (length < 0) {
+            throw std::invalid_argument("Softening length must be non-negative.");
+        }
+        kernel = NONE;
+    }
+    if (kernel == SPLINE) {
+        hInv = 1 / h;
+        h3Inv = hInv * hInv * hInv;
+    }
+}
@@ -1,8 +1,86 @@
+#define _USE_MATH_DEFINES
+
+#include <cmath>
+
 #include "../include/statistics.h"
+#include "../include/parallel.h"
 
 std::random_device rd;
 std::mt19937 GENERATOR(rd());
 
+// Philox4x32 round constants
+const uint32_t PHILOX_M0 = 0xD2511F53;
+const uint32_t PHILOX_M1 = 0xCD9E8D57;
+const uint32_t PHILOX_W0 = 0x9E3779B9;
+const uint32_t PHILOX_W1 = 0xBB67AE85;
+
+std::array<uint32_t, 4> philox4x32(std::array<uint32_t, 4> counter, const std::array<uint32_t, 2>& key) {
+    std::array<uint32_t, 2> roundKey = key;
+    for (int round = 0; round < 10; round++) {
+        uint64_t product0 = static_cast<uint64_t>(PHILOX_M0) * counter[0];
+        uint64_t product1 = static_cast<uint64_t>(PHILOX_M1) * counter[2];
+        counter = {static_cast<uint32_t>(product1 >> 32) ^ counter[1] ^ roundKey[0], static_cast<uint32_t>(product1),
+                   static_cast<uint32_t>(product0 >> 32) ^ counter[3] ^ roundKey[1], static_cast<uint32_t>(product0)};
+        roundKey[0] += PHILOX_W0;
+        roundKey[1] += PHILOX_W1;
+    }
+    return counter;
+}
+
+// Constructor definition
+CounterRNG::CounterRNG(uint64_t seed, uint32_t stream)
+    : seed(seed), stream(stream) {};
+
+std::array<uint32_t, 4> CounterRNG::bits(uint64_t index, uint32_t draw) const {
+    return philox4x32({static_cast<uint32_t>(index), static_cast<uint32_t>(index >> 32), stream, draw},
+                      {static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)});
+}
+
+double CounterRNG::uniform(uint64_t index, uint32_t draw) const {
+    std::array<uint32_t, 4> words = bits(index, draw);
+
+    // 53 random bits
+    uint64_t mantissa = (static_cast<uint64_t>(words[0]) << 21) ^ (words[1] >> 11);
+    return mantissa * (1.0 / 9007199254740992.0);
+}
+
+double CounterRNG::normal(uint64_t index, uint32_t draw) const {
+    std::array<uint32_t, 4> words = bits(index, draw);
+
+    // Box-Muller, with u1 in (0, 1] so the log is finite
+    double u1 = (words[0] + 1.0) / 4294967296.0;
+    double u2 = words[1] / 4294967296.0;
+    return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+std::vector<float> sampleUniform(size_t n, float min, float max, const CounterRNG& rng, int nThreads) {
+    std::vector<float> samples(n);
+    parallelFor(n, nThreads, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            samples[i] = min + (max - min) * rng.uniform(i);
+        }
+    });
+    return samples;
+}
+
+std::vector<float> sampleNormal(size_t n, float mu, float sigma, const CounterRNG& rng, int nThreads) {
+    std::vector<float> samples(n);
+    parallelFor(n, nThreads, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            samples[i] = mu + sigma * rng.normal(i);
+        }
+    });
+    return samples;
+}
+
+uint32_t getStreamId(const std::string& name) {
+    uint32_t hash = 2166136261u;
+    for (char c : name) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+    }
+    return hash;
+}
+
 int dummyExecutable() {
     return 0;
 }
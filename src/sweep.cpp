@@ -0,0 +1,319 @@
+#include <iostream>
+#include <string>
+#include <array>
+#include <vector>
+#include <map>
+#include <memory>
+#include <cmath>
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+#include <algorithm>
+#include <numeric>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <yaml-cpp/yaml.h>
+
+#include "../include/sweep.h"
+#include "../include/environment.h"
+#include "../include/body.h"
+#include "../include/catalog.h"
+#include "../include/parallel.h"
+#include "../include/statistics.h"
+
+namespace fs = std::filesystem;
+extern std::string REPOPATH;
+
+// Global keys that, together with the property blocks, determine the initial conditions
+static const std::vector<std::string> initialConditionKeys = {"nParticles", "seed", "particleFile", "particleFormat", "columns"};
+
+
+// Values of a grid entry: a YAML list, or a single scalar
+static std::vector<std::string> getSweepValues(const YAML::Node& node) {
+    std::vector<std::string> values;
+    if (node.IsSequence()) {
+        for (const auto& value : node) {
+            values.push_back(value.as<std::string>());
+        }
+    } else {
+        values.push_back(node.as<std::string>());
+    }
+    return values;
+}
+
+// Overrides are keyed "block.key"
+static void checkOverrideKey(const std::string& key) {
+    size_t dot = key.find('.');
+    if (dot == std::string::npos || dot == 0 || dot == key.size() - 1) {
+        throw std::invalid_argument("Sweep override " + key + " must be of the form block.key.");
+    }
+}
+
+// Constructor: expand the grid and points into runs, and group the runs by initial conditions
+Sweep::Sweep(const std::string sweepFileName) : nInitialConditions(0), nWorkers(0), log(false), seed(0) {
+    std::string fullPath = REPOPATH + "/configs/" + sweepFileName;
+    std::map<std::string, std::string> settings;
+    std::vector<std::pair<std::string, std::vector<std::string>>> grid;
+    std::vector<std::map<std::string, std::string>> points;
+
+    try {
+        YAML::Node sweepFile = YAML::LoadFile(fullPath);
+        if (!sweepFile["sweep"] || !sweepFile["sweep"].IsMap()) {
+            throw std::invalid_argument("Sweep file " + sweepFileName + " has no 'sweep' block.");
+        }
+        for (const auto& element : sweepFile["sweep"]) {
+            settings[element.first.as<std::string>()] = element.second.as<std::string>();
+        }
+        if (sweepFile["grid"]) {
+            for (const auto& element : sweepFile["grid"]) {
+                grid.push_back({element.first.as<std::string>(), getSweepValues(element.second)});
+            }
+        }
+        if (sweepFile["points"]) {
+            for (const auto& pointNode : sweepFile["points"]) {
+                std::map<std::string, std::string> point;
+                for (const auto& element : pointNode) {
+                    point[element.first.as<std::string>()] = element.second.as<std::string>();
+                }
+                points.push_back(point);
+            }
+        }
+    } catch (const YAML::BadFile& e) {  // fail to open
+        std::cerr << "Failed to open YAML file: " << fullPath << std::endl;
+        throw;
+    } catch (const YAML::Exception& e) {  // issue parsing
+        std::cerr << "YAML parsing error: " << e.what() << std::endl;
+        throw;
+    }
+
+    for (std::string key : {"config", "duration", "timestep"}) {
+        if (settings.find(key) == settings.end()) {
+            throw std::invalid_argument("Sweep block is missing " + key + ".");
+        }
+    }
+    if (settings.find("workers") != settings.end()) {
+        nWorkers = std::stoi(settings.at("workers"));
+    }
+    if (settings.find("log") != settings.end()) {
+        log = settings.at("log") == "true";
+    }
+
+    // Every run starts from the same seed unless it overrides it, so that runs can share initial conditions
+    baseConfig = loadConfig(settings.at("config"));
+    if (baseConfig.at("global").find("seed") == baseConfig.at("global").end()) {
+        baseConfig["global"]["seed"] = std::to_string((static_cast<uint64_t>(rd()) << 32) | rd());
+    }
+    seed = std::stoull(baseConfig.at("global").at("seed"));
+    baseConfig["sweep"] = settings;
+
+    // Each point is crossed with every combination of the grid values, the first grid key varying slowest
+    if (points.empty()) {
+        points.push_back({});
+    }
+    for (const auto& [key, values] : grid) {
+        checkOverrideKey(key);
+        if (values.empty()) {
+            throw std::invalid_argument("Sweep grid entry " + key + " has no values.");
+        }
+        overrideKeys.push_back(key);
+    }
+    for (const std::map<std::string, std::string>& point : points) {
+        for (const auto& [key, value] : point) {
+            checkOverrideKey(key);
+            if (std::find(overrideKeys.begin(), overrideKeys.end(), key) == overrideKeys.end()) {
+                overrideKeys.push_back(key);
+            }
+        }
+        std::vector<size_t> combination(grid.size(), 0);
+        while (true) {
+            SweepRun sweepRun = {point, 0, 0, 0, 0, 0, "", ""};
+            for (size_t g = 0; g < grid.size(); g++) {
+                sweepRun.overrides[grid[g].first] = grid[g].second[combination[g]];
+            }
+            runs.push_back(sweepRun);
+
+            // Advance the combination like an odometer
+            int g = static_cast<int>(grid.size()) - 1;
+            while (g >= 0 && ++combination[g] == grid[g].second.size()) {
+                combination[g] = 0;
+                g--;
+            }
+            if (g < 0) {
+                break;
+            }
+        }
+    }
+
+    // Runs whose overrides leave the initial conditions alone share them
+    std::map<std::string, int> initialConditionIndices;
+    for (SweepRun& sweepRun : runs) {
+        std::string key = getInitialConditionsKey(getRunConfig(sweepRun));
+        if (initialConditionIndices.find(key) == initialConditionIndices.end()) {
+            initialConditionIndices[key] = nInitialConditions++;
+        }
+        sweepRun.initialConditions = initialConditionIndices.at(key);
+    }
+}
+
+// Base configuration with the overrides of one run applied; the run settings are in the 'sweep' block
+std::map<std::string, std::map<std::string, std::string>> Sweep::getRunConfig(const SweepRun& sweepRun) const {
+    std::map<std::string, std::map<std::string, std::string>> configMap = baseConfig;
+    for (const auto& [key, value] : sweepRun.overrides) {
+        size_t dot = key.find('.');
+        configMap[key.substr(0, dot)][key.substr(dot + 1)] = value;
+    }
+    return configMap;
+}
+
+// Everything the initial conditions depend on, as one string
+std::string Sweep::getInitialConditionsKey(const std::map<std::string, std::map<std::string, std::string>>& configMap) const {
+    std::string key;
+    for (const auto& [block, values] : configMap) {
+        if (block == "sweep") {
+            continue;
+        }
+        for (const auto& [name, value] : values) {
+            if (block != "global" || std::find(initialConditionKeys.begin(), initialConditionKeys.end(), name) != initialConditionKeys.end()) {
+                key += block + "." + name + "=" + value + "\n";
+            }
+        }
+    }
+    return key;
+}
+
+// Force interactions per step, N^2 for direct summation and about 8 log2 N per particle for a tree walk, times the
+// steps and the force evaluations the integrator makes per step
+double estimateRunCost(const std::map<std::string, std::map<std::string, std::string>>& configMap, int nParticles) {
+    const std::map<std::string, std::string>& settings = configMap.at("sweep");
+    const std::map<std::string, std::string>& globalConfigMap = configMap.at("global");
+    double nSteps = std::ceil(std::stod(settings.at("duration")) / std::stod(settings.at("timestep")));
+    bool pairWise = settings.find("forceAlgorithm") == settings.end() || settings.at("forceAlgorithm") == "pair-wise";
+    double interactions = pairWise ? static_cast<double>(nParticles) * nParticles : nParticles * std::log2(nParticles + 1.0) * 8;
+
+    double evaluations = 1;
+    if (globalConfigMap.find("integrator") != globalConfigMap.end()) {
+        std::string integrator = globalConfigMap.at("integrator");
+        evaluations = integrator == "yoshida4" ? 3 : integrator == "yoshida6" ? 7 : 1;
+    }
+    return nSteps * interactions * evaluations;
+}
+
+// Run every point of the sweep on a pool of workers and write the summary table
+void Sweep::run() {
+
+    // Number the sweep after the existing ones, scanning the data directory once
+    std::string dataPath = REPOPATH + "/data";
+    if (!fs::exists(dataPath)) {
+        fs::create_directory(dataPath);
+    }
+    std::vector<std::string> fileNames;
+    for (const auto& entry : fs::directory_iterator(dataPath)) {
+        if (fs::is_regular_file(entry.status())) {
+            fileNames.push_back(entry.path().filename().string());
+        }
+    }
+    std::string sweepName = dataPath + "/sweep" + std::to_string(getLargestLabelNumber(fileNames, "sweep") + 1);
+    summaryFileName = sweepName + ".csv";
+
+    // Load each set of initial conditions once; runs only read them
+    std::vector<std::shared_ptr<const ParticleCatalog>> initialConditions(nInitialConditions);
+    for (SweepRun& sweepRun : runs) {
+        std::map<std::string, std::map<std::string, std::string>> configMap = getRunConfig(sweepRun);
+        configMap.erase("sweep");
+        if (!initialConditions[sweepRun.initialConditions]) {
+            uint64_t runSeed = std::stoull(configMap.at("global").at("seed"));
+            initialConditions[sweepRun.initialConditions] = std::make_shared<const ParticleCatalog>(getInitialConditions(configMap, runSeed));
+        }
+    }
+
+    // Longest runs first, each handed to the next free worker
+    for (size_t r = 0; r < runs.size(); r++) {
+        runs[r].estimatedCost = estimateRunCost(getRunConfig(runs[r]), initialConditions[runs[r].initialConditions]->masses.size());
+        runs[r].logFileName = log ? sweepName + "_point" + std::to_string(r) + ".csv" : "";
+    }
+    std::vector<size_t> order(runs.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return runs[a].estimatedCost > runs[b].estimatedCost; });
+
+    std::atomic<size_t> nextRun(0);
+    auto worker = [&]() {
+        for (size_t k = nextRun++; k < order.size(); k = nextRun++) {
+            SweepRun& sweepRun = runs[order[k]];
+            try {
+                std::map<std::string, std::map<std::string, std::string>> configMap = getRunConfig(sweepRun);
+                std::map<std::string, std::string> settings = configMap.at("sweep");
+                if (configMap.at("global").find("tracerFile") != configMap.at("global").end()) {
+                    throw std::invalid_argument("Sweeps do not support tracerFile.");
+                }
+
+                const ParticleCatalog& catalog = *initialConditions[sweepRun.initialConditions];
+                std::vector<std::shared_ptr<Body>> particlePtrs;
+                for (size_t i = 0; i < catalog.masses.size(); i++) {
+                    particlePtrs.push_back(std::make_shared<Body>(&catalog.positions[i], &catalog.velocities[i], catalog.masses[i], catalog.radii[i]));
+                }
+                std::string forceAlgorithm = settings.find("forceAlgorithm") != settings.end() ? settings.at("forceAlgorithm") : "pair-wise";
+                GravitationalEnvironment<Body> env(particlePtrs, false, "run", forceAlgorithm);
+
+                // Runs are spread across the cores, so each is single-threaded and quiet unless configured otherwise
+                env.nThreads = 1;
+                env.verbosity = "silent";
+                env.applyGlobalConfig(configMap.at("global"));
+                if (log) {
+                    env.log = true;
+                    env.logFileName = sweepRun.logFileName;
+                }
+
+                float duration = std::stof(settings.at("duration"));
+                float timestep = std::stof(settings.at("timestep"));
+                sweepRun.nSteps = std::ceil(duration / timestep * (1 - 1e-6));
+                // The potential energy is that of the latest force evaluation, so evaluate the forces at both ends
+                env.getForces(timestep);
+                double initialEnergy = env.getDiagnostics().totalEnergy;
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                env.simulate(duration, timestep);
+                sweepRun.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                env.getForces(timestep);
+                sweepRun.energyError = std::abs((env.getDiagnostics().totalEnergy - initialEnergy) / initialEnergy);
+            } catch (const std::exception& e) {
+                sweepRun.error = e.what();
+            }
+        }
+    };
+    int nThreads = std::min(static_cast<size_t>(getThreadCount(nWorkers)), std::max(runs.size(), static_cast<size_t>(1)));
+    std::vector<std::thread> workers;
+    for (int t = 1; t < nThreads; t++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : workers) {
+        thread.join();
+    }
+
+    std::string summary = getSummary();
+    std::ofstream summaryFile(summaryFileName);
+    summaryFile << summary;
+    std::cout << summary;
+}
+
+// Summary table with one row per run, in the order of the sweep file
+std::string Sweep::getSummary() const {
+    auto quote = [](const std::string& value) { return value.find(',') == std::string::npos ? value : "\"" + value + "\""; };
+    std::string summary = "run";
+    for (const std::string& key : overrideKeys) {
+        summary += "," + key;
+    }
+    summary += ",initialConditions,estimatedCost,steps,seconds,energyError,error\n";
+
+    for (size_t r = 0; r < runs.size(); r++) {
+        const SweepRun& sweepRun = runs[r];
+        summary += std::to_string(r);
+        for (const std::string& key : overrideKeys) {
+            summary += "," + (sweepRun.overrides.find(key) != sweepRun.overrides.end() ? quote(sweepRun.overrides.at(key)) : "");
+        }
+        char row[256];
+        snprintf(row, sizeof(row), ",%d,%.6g,%d,%.6g,%.6g,", sweepRun.initialConditions, sweepRun.estimatedCost, sweepRun.nSteps, sweepRun.seconds, sweepRun.energyError);
+        summary += row + quote(sweepRun.error) + "\n";
+    }
+    return summary;
+}
@@ -0,0 +1,410 @@
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "../include/trajectory.h"
+#include "../include/catalog.h"
+
+// File layout: header (magic, version, chunk size, keyframe interval, field names), the column chunks of every step,
+// the index, and a trailer holding the index offset
+const char TRAJECTORY_MAGIC[4] = {'H', 'T', 'R', 'J'};
+const char INDEX_MAGIC[4] = {'H', 'T', 'R', 'I'};
+const uint32_t TRAJECTORY_VERSION = 1;
+const size_t MIN_MATCH = 4;
+
+void shuffleBytes(const uint8_t* source, size_t n, uint8_t* destination) {
+    for (size_t i = 0; i < n; i++) {
+        for (size_t k = 0; k < 4; k++) {
+            destination[k * n + i] = source[4 * i + k];
+        }
+    }
+}
+
+void unshuffleBytes(const uint8_t* source, size_t n, uint8_t* destination) {
+    for (size_t i = 0; i < n; i++) {
+        for (size_t k = 0; k < 4; k++) {
+            destination[4 * i + k] = source[k * n + i];
+        }
+    }
+}
+
+static uint32_t read32(const uint8_t* pointer) {
+    uint32_t value;
+    std::memcpy(&value, pointer, 4);
+    return value;
+}
+
+// Lengths of 15 or more continue in bytes of up to 255
+static void writeLength(std::vector<uint8_t>& out, size_t length) {
+    length -= 15;
+    while (length >= 255) {
+        out.push_back(255);
+        length -= 255;
+    }
+    out.push_back(length);
+}
+
+static size_t readLength(const uint8_t* source, size_t size, size_t& position) {
+    size_t length = 0;
+    uint8_t byte;
+    do {
+        if (position >= size) {
+            throw std::runtime_error("Corrupt compressed block.");
+        }
+        byte = source[position++];
+        length += byte;
+    } while (byte == 255);
+    return length;
+}
+
+// Each sequence is a token (literal length << 4 | match length - 4), the literals, a 16-bit offset and the match.
+// The last sequence has literals only.
+std::vector<uint8_t> compressLZ(const uint8_t* source, size_t size) {
+    std::vector<uint8_t> out;
+    out.reserve(size + size / 255 + 16);
+
+    // The hash table scales with the input (one entry per four bytes, between 2^8 and 2^14), so that clearing it
+    // never costs more than the data it indexes. Entries hold position + 1, with 0 for empty.
+    int hashBits = 8;
+    while (hashBits < 14 && (size_t(1) << hashBits) < size / 4) {
+        hashBits++;
+    }
+    std::vector<uint32_t> table(size_t(1) << hashBits, 0);
+    size_t anchor = 0;
+
+    auto emit = [&](size_t literalEnd, size_t offset, size_t matchLength) {
+        size_t literalLength = literalEnd - anchor;
+        uint8_t token = std::min<size_t>(literalLength, 15) << 4;
+        if (matchLength > 0) {
+            token |= std::min<size_t>(matchLength - MIN_MATCH, 15);
+        }
+        out.push_back(token);
+        if (literalLength >= 15) {
+            writeLength(out, literalLength);
+        }
+        out.insert(out.end(), source + anchor, source + literalEnd);
+        if (matchLength > 0) {
+            out.push_back(offset & 0xff);
+            out.push_back(offset >> 8);
+            if (matchLength - MIN_MATCH >= 15) {
+                writeLength(out, matchLength - MIN_MATCH);
+            }
+        }
+    };
+
+    // Find matches through a hash of the next four bytes
+    size_t i = 0;
+    while (i + MIN_MATCH <= size) {
+        uint32_t hash = (read32(source + i) * 2654435761u) >> (32 - hashBits);
+        int64_t candidate = static_cast<int64_t>(table[hash]) - 1;
+        table[hash] = i + 1;
+        if (candidate >= 0 && i - candidate <= 65535 && read32(source + candidate) == read32(source + i)) {
+            size_t length = MIN_MATCH;
+            while (i + length < size && source[candidate + length] == source[i + length]) {
+                length++;
+            }
+            emit(i, i - candidate, length);
+            i += length;
+            anchor = i;
+        } else {
+            i++;
+        }
+    }
+    emit(size, 0, 0);
+    return out;
+}
+
+std::vector<uint8_t> decompressLZ(const uint8_t* source, size_t size, size_t decompressedSize) {
+    std::vector<uint8_t> out;
+    out.reserve(decompressedSize);
+    size_t position = 0;
+    while (true) {
+        if (position >= size) {
+            throw std::runtime_error("Corrupt compressed block.");
+        }
+        uint8_t token = source[position++];
+
+        // Literals
+        size_t literalLength = token >> 4;
+        if (literalLength == 15) {
+            literalLength += readLength(source, size, position);
+        }
+        if (position + literalLength > size || out.size() + literalLength > decompressedSize) {
+            throw std::runtime_error("Corrupt compressed block.");
+        }
+        out.insert(out.end(), source + position, source + position + literalLength);
+        position += literalLength;
+        if (position == size) {
+            break;
+        }
+
+        // Match, copied byte by byte since it may overlap itself
+        if (position + 2 > size) {
+            throw std::runtime_error("Corrupt compressed block.");
+        }
+        size_t offset = source[position] | (source[position + 1] << 8);
+        position += 2;
+        size_t matchLength = (token & 15) + MIN_MATCH;
+        if ((token & 15) == 15) {
+            matchLength += readLength(source, size, position);
+        }
+        if (offset == 0 || offset > out.size() || out.size() + matchLength > decompressedSize) {
+            throw std::runtime_error("Corrupt compressed block.");
+        }
+        size_t start = out.size() - offset;
+        for (size_t k = 0; k < matchLength; k++) {
+            out.push_back(out[start + k]);
+        }
+    }
+    if (out.size() != decompressedSize) {
+        throw std::runtime_error("Corrupt compressed block.");
+    }
+    return out;
+}
+
+template <typename Value>
+static void writeValue(std::ofstream& file, const Value& value) {
+    file.write(reinterpret_cast<const char*>(&value), sizeof(Value));
+}
+
+// Constructor definition
+TrajectoryWriter::TrajectoryWriter(const std::string& fileName, const std::vector<std::string>& fields, uint32_t chunkSize, uint32_t keyframeInterval)
+    : file(fileName, std::ios::binary), fields(fields), chunkSize(chunkSize), keyframeInterval(keyframeInterval) {
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open trajectory file: " + fileName);
+    }
+    if (fields.empty() || chunkSize == 0 || keyframeInterval == 0) {
+        throw std::invalid_argument("A trajectory needs at least one field and positive chunk size and keyframe interval.");
+    }
+
+    // Header
+    file.write(TRAJECTORY_MAGIC, 4);
+    writeValue(file, TRAJECTORY_VERSION);
+    writeValue(file, chunkSize);
+    writeValue(file, keyframeInterval);
+    writeValue(file, static_cast<uint32_t>(fields.size()));
+    for (const std::string& field : fields) {
+        writeValue(file, static_cast<uint32_t>(field.size()));
+        file.write(field.data(), field.size());
+    }
+}
+
+TrajectoryWriter::~TrajectoryWriter() {
+    close();
+}
+
+// Append one output step; the snapshot values are particle-major, as gathered for the csv log
+void TrajectoryWriter::writeStep(const Snapshot& snapshot) {
+    size_t nFields = fields.size();
+    if (snapshot.values.size() % nFields != 0) {
+        throw std::invalid_argument("Snapshot size does not match the trajectory fields.");
+    }
+    uint32_t nParticles = snapshot.values.size() / nFields;
+
+    TrajectoryStep step;
+    step.time = snapshot.time;
+    step.nParticles = nParticles;
+    step.keyframe = steps.empty() || steps.size() % keyframeInterval == 0 || steps.back().nParticles != nParticles;
+
+    // Transpose to columns, and XOR against the previous output between keyframes
+    columnBits.resize(snapshot.values.size());
+    for (uint32_t i = 0; i < nParticles; i++) {
+        for (size_t f = 0; f < nFields; f++) {
+            std::memcpy(&columnBits[f * nParticles + i], &snapshot.values[i * nFields + f], 4);
+        }
+    }
+    std::vector<uint32_t> encoded = columnBits;
+    if (!step.keyframe) {
+        for (size_t k = 0; k < encoded.size(); k++) {
+            encoded[k] ^= previousBits[k];
+        }
+    }
+    previousBits.swap(columnBits);
+
+    // Shuffle and compress each chunk, keeping the raw words if compression does not pay off
+    size_t nChunks = (nParticles + chunkSize - 1) / chunkSize;
+    for (size_t f = 0; f < nFields; f++) {
+        for (size_t c = 0; c < nChunks; c++) {
+            size_t begin = c * chunkSize;
+            size_t count = std::min<size_t>(chunkSize, nParticles - begin);
+            shuffled.resize(4 * count);
+            shuffleBytes(reinterpret_cast<const uint8_t*>(&encoded[f * nParticles + begin]), count, shuffled.data());
+            std::vector<uint8_t> compressed = compressLZ(shuffled.data(), shuffled.size());
+
+            TrajectoryBlock block;
+            block.offset = file.tellp();
+            block.compressed = compressed.size() < shuffled.size();
+            const std::vector<uint8_t>& bytes = block.compressed ? compressed : shuffled;
+            block.size = bytes.size();
+            file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+            step.blocks.push_back(block);
+        }
+    }
+    steps.push_back(step);
+}
+
+// Write the index and trailer
+void TrajectoryWriter::close() {
+    if (!file.is_open()) {
+        return;
+    }
+    uint64_t indexOffset = file.tellp();
+    writeValue(file, static_cast<uint32_t>(steps.size()));
+    for (const TrajectoryStep& step : steps) {
+        writeValue(file, step.time);
+        writeValue(file, step.nParticles);
+        writeValue(file, step.keyframe);
+        for (const TrajectoryBlock& block : step.blocks) {
+            writeValue(file, block.offset);
+            writeValue(file, block.size);
+            writeValue(file, block.compressed);
+        }
+    }
+    writeValue(file, indexOffset);
+    file.write(INDEX_MAGIC, 4);
+    file.close();
+}
+
+// Bounds-checked reads from the mapped file
+template <typename Value>
+static Value readValue(const MappedFile& file, size_t& position) {
+    if (position + sizeof(Value) > file.size) {
+        throw std::runtime_error("Truncated trajectory file.");
+    }
+    Value value;
+    std::memcpy(&value, file.data + position, sizeof(Value));
+    position += sizeof(Value);
+    return value;
+}
+
+// Constructor definition: read the header and the index
+TrajectoryReader::TrajectoryReader(const std::string& fileName)
+    : file(std::make_unique<MappedFile>(fileName)) {
+    if (file->size < 24 || std::memcmp(file->data, TRAJECTORY_MAGIC, 4) != 0 || std::memcmp(file->data + file->size - 4, INDEX_MAGIC, 4) != 0) {
+        throw std::runtime_error("Not a trajectory file: " + fileName);
+    }
+    size_t position = 4;
+    if (readValue<uint32_t>(*file, position) != TRAJECTORY_VERSION) {
+        throw std::runtime_error("Unsupported trajectory version: " + fileName);
+    }
+    chunkSize = readValue<uint32_t>(*file, position);
+    readValue<uint32_t>(*file, position);
+    uint32_t nFields = readValue<uint32_t>(*file, position);
+    for (uint32_t f = 0; f < nFields; f++) {
+        uint32_t length = readValue<uint32_t>(*file, position);
+        if (position + length > file->size) {
+            throw std::runtime_error("Truncated trajectory file.");
+        }
+        fields.push_back(std::string(file->data + position, length));
+        position += length;
+    }
+
+    // Index
+    position = file->size - 12;
+    position = readValue<uint64_t>(*file, position);
+    uint32_t nSteps = readValue<uint32_t>(*file, position);
+    steps.resize(nSteps);
+    for (TrajectoryStep& step : steps) {
+        step.time = readValue<float>(*file, position);
+        step.nParticles = readValue<uint32_t>(*file, position);
+        step.keyframe = readValue<uint8_t>(*file, position);
+        size_t nChunks = (step.nParticles + chunkSize - 1) / chunkSize;
+        step.blocks.resize(nFields * nChunks);
+        for (TrajectoryBlock& block : step.blocks) {
+            block.offset = readValue<uint64_t>(*file, position);
+            block.size = readValue<uint32_t>(*file, position);
+            block.compressed = readValue<uint8_t>(*file, position);
+            if (block.offset + block.size > file->size) {
+                throw std::runtime_error("Truncated trajectory file.");
+            }
+        }
+    }
+}
+
+TrajectoryReader::~TrajectoryReader() = default;
+
+size_t TrajectoryReader::getNSteps() const {
+    return steps.size();
+}
+
+float TrajectoryReader::getTime(size_t step) const {
+    return steps.at(step).time;
+}
+
+uint32_t TrajectoryReader::getNParticles(size_t step) const {
+    return steps.at(step).nParticles;
+}
+
+const std::vector<std::string>& TrajectoryReader::getFields() const {
+    return fields;
+}
+
+// Get the first step at or after 'time' (the number of steps if there is none)
+size_t TrajectoryReader::findStep(float time) const {
+    auto it = std::lower_bound(steps.begin(), steps.end(), time, [](const TrajectoryStep& step, float t) {
+        return step.time < t;
+    });
+    return it - steps.begin();
+}
+
+// Decompress and unshuffle one chunk of 'count' words
+std::vector<uint32_t> TrajectoryReader::decodeBlock(const TrajectoryBlock& block, size_t count) const {
+    const uint8_t* source = reinterpret_cast<const uint8_t*>(file->data + block.offset);
+    std::vector<uint8_t> shuffled;
+    if (block.compressed) {
+        shuffled = decompressLZ(source, block.size, 4 * count);
+    } else {
+        if (block.size != 4 * count) {
+            throw std::runtime_error("Corrupt trajectory block.");
+        }
+        shuffled.assign(source, source + block.size);
+    }
+    std::vector<uint32_t> words(count);
+    unshuffleBytes(shuffled.data(), count, reinterpret_cast<uint8_t*>(words.data()));
+    return words;
+}
+
+// Read a field of the particles [begin, end) at a step
+std::vector<float> TrajectoryReader::readField(size_t step, const std::string& field, size_t begin, size_t end) const {
+    if (step >= steps.size()) {
+        throw std::out_of_range("Trajectory step " + std::to_string(step) + " out of range.");
+    }
+    auto fieldIt = std::find(fields.begin(), fields.end(), field);
+    if (fieldIt == fields.end()) {
+        throw std::invalid_argument("Trajectory has no field " + field + ".");
+    }
+    size_t f = fieldIt - fields.begin();
+    size_t nParticles = steps[step].nParticles;
+    end = std::min(end, nParticles);
+    if (begin > end) {
+        throw std::out_of_range("Invalid particle range.");
+    }
+
+    // Deltas chain back to the latest keyframe, which always has the same particle count
+    size_t keyframe = step;
+    while (!steps[keyframe].keyframe) {
+        keyframe--;
+    }
+
+    std::vector<float> values(end - begin);
+    size_t nChunks = (nParticles + chunkSize - 1) / chunkSize;
+    for (size_t c = begin / chunkSize; c * chunkSize < end; c++) {
+        size_t chunkBegin = c * chunkSize;
+        size_t count = std::min<size_t>(chunkSize, nParticles - chunkBegin);
+        std::vector<uint32_t> bits = decodeBlock(steps[keyframe].blocks[f * nChunks + c], count);
+        for (size_t s = keyframe + 1; s <= step; s++) {
+            std::vector<uint32_t> delta = decodeBlock(steps[s].blocks[f * nChunks + c], count);
+            for (size_t k = 0; k < count; k++) {
+                bits[k] ^= delta[k];
+            }
+        }
+        for (size_t i = std::max(begin, chunkBegin); i < std::min(end, chunkBegin + count); i++) {
+            std::memcpy(&values[i - begin], &bits[i - chunkBegin], 4);
+        }
+    }
+    return values;
+}
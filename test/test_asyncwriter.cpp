@@ -0,0 +1,58 @@
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#include "../include/doctest.h"
+#include "../include/asyncwriter.h"
+
+TEST_CASE("SPSC Queue") {
+    SpscQueue<int> queue(2);
+    int item;
+    CHECK(queue.pop(item) == false);
+    CHECK(queue.push(1));
+    CHECK(queue.push(2));
+    CHECK(queue.push(3) == false);
+    CHECK(queue.pop(item));
+    CHECK(item == 1);
+    CHECK(queue.push(3));
+    CHECK(queue.pop(item));
+    CHECK(item == 2);
+    CHECK(queue.pop(item));
+    CHECK(item == 3);
+    CHECK(queue.pop(item) == false);
+}
+
+TEST_CASE("Async Writer") {
+    // A slow encoder forces the producer to wait on the two buffers; every snapshot still arrives in order
+    std::vector<float> times;
+    std::vector<size_t> sizes;
+    {
+        AsyncWriter writer([&](const Snapshot& snapshot) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            times.push_back(snapshot.time);
+            sizes.push_back(snapshot.values.size());
+        }, 2);
+        for (int i = 0; i < 20; i++) {
+            Snapshot* snapshot = writer.acquire();
+            snapshot->time = i;
+            snapshot->values.assign(i, 1.0f);
+            writer.submit(snapshot);
+        }
+        writer.finish();
+    }
+    CHECK(times.size() == 20);
+    for (int i = 0; i < 20; i++) {
+        CHECK(times[i] == i);
+        CHECK(sizes[i] == i);
+    }
+
+    // The destructor drains pending snapshots
+    int count = 0;
+    {
+        AsyncWriter writer([&](const Snapshot&) { count++; }, 1);
+        for (int i = 0; i < 5; i++) {
+            writer.submit(writer.acquire());
+        }
+    }
+    CHECK(count == 5);
+}
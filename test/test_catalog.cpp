@@ -0,0 +1,86 @@
+#include <array>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+
+#include "../include/doctest.h"
+#include "../include/catalog.h"
+
+// Write a file to the temporary directory and return its path
+std::string writeTemporaryFile(const std::string& name, const std::string& contents) {
+    std::string path = (std::filesystem::temp_directory_path() / name).string();
+    std::ofstream file(path, std::ios::binary);
+    file << contents;
+    return path;
+}
+
+TEST_CASE("Parse Column List") {
+    CHECK(parseColumnList("x,y, z ,mass") == std::vector<std::string>{"x", "y", "z", "mass"});
+    CHECK(parseColumnList("x,,mass") == std::vector<std::string>{"x", "", "mass"});
+    CHECK(parseColumnList("").empty());
+}
+
+TEST_CASE("Load CSV Catalog") {
+
+    // Header names columns (including one to skip), with blank lines, whitespace and Windows line endings
+    std::string path = writeTemporaryFile("hootsim_catalog.csv", "id,mass,x,y,z,vx\r\n7,2.5,1,2,3,-4\r\n\r\n8, 1e3 ,+0.5,-1.5E-2,3,0\n");
+    ParticleCatalog catalog = loadCatalogCSV(path, {});
+    REQUIRE(catalog.masses.size() == 2);
+    CHECK(catalog.masses[0] == 2.5);
+    CHECK(catalog.positions[0] == std::array<float, 3>{1, 2, 3});
+    CHECK(catalog.velocities[0] == std::array<float, 3>{-4, 0, 0});
+    CHECK(catalog.masses[1] == 1000);
+    CHECK(catalog.positions[1][1] == doctest::Approx(-0.015));
+    CHECK(catalog.radii[1] == 0);
+
+    // Without a header the columns must be given
+    std::string noHeader = writeTemporaryFile("hootsim_noheader.csv", "1,2,3,4\n5,6,7,8\n");
+    CHECK_THROWS_AS(loadCatalogCSV(noHeader, {}), std::invalid_argument);
+    ParticleCatalog mapped = loadCatalogCSV(noHeader, parseColumnList("x,y,z,mass"));
+    CHECK(mapped.masses == std::vector<float>{4, 8});
+
+    // Errors
+    CHECK_THROWS_AS(loadCatalogCSV(noHeader, parseColumnList("x,y,vz,mass")), std::invalid_argument);
+    std::string malformed = writeTemporaryFile("hootsim_malformed.csv", "x,y,z,mass\n1,2,three,4\n");
+    CHECK_THROWS_AS(loadCatalogCSV(malformed, {}), std::invalid_argument);
+    std::string shortLine = writeTemporaryFile("hootsim_short.csv", "x,y,z,mass\n1,2,3\n");
+    CHECK_THROWS_AS(loadCatalogCSV(shortLine, {}), std::invalid_argument);
+    CHECK_THROWS_AS(loadCatalogCSV("/invalid/path/catalog.csv", {}), std::runtime_error);
+}
+
+TEST_CASE("Parallel CSV Parsing Matches Serial") {
+    std::string contents = "x,y,z,vx,vy,vz,mass\n";
+    for (int i = 0; i < 20000; i++) {
+        contents += std::to_string(i) + ",0.25," + std::to_string(-i * 0.5) + ",1,2,3," + std::to_string(i + 1) + "\n";
+    }
+    std::string path = writeTemporaryFile("hootsim_large.csv", contents);
+
+    ParticleCatalog serial = loadCatalogCSV(path, {}, 1);
+    ParticleCatalog parallel = loadCatalogCSV(path, {}, 6);
+    CHECK(serial.masses.size() == 20000);
+    CHECK(serial.positions == parallel.positions);
+    CHECK(serial.masses == parallel.masses);
+    CHECK(parallel.positions[12345][0] == 12345);
+    CHECK(parallel.masses[19999] == 20000);
+}
+
+TEST_CASE("Load Binary Catalog") {
+    std::vector<float> records = {1, 2, 3, 10, 0.5, 4, 5, 6, 20, 0.25};
+    std::string path = writeTemporaryFile("hootsim_catalog.bin", std::string(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(float)));
+
+    ParticleCatalog catalog = loadCatalogBinary(path, parseColumnList("x,y,z,mass,radius"));
+    REQUIRE(catalog.masses.size() == 2);
+    CHECK(catalog.positions[1] == std::array<float, 3>{4, 5, 6});
+    CHECK(catalog.masses[1] == 20);
+    CHECK(catalog.radii[0] == 0.5);
+    CHECK(catalog.velocities[0] == std::array<float, 3>{0, 0, 0});
+
+    // The file must hold whole records
+    CHECK_THROWS_AS(loadCatalogBinary(path, parseColumnList("x,y,z,mass")), std::invalid_argument);
+
+    // Empty files are empty catalogs
+    std::string empty = writeTemporaryFile("hootsim_empty.bin", "");
+    CHECK(loadCatalogBinary(empty, parseColumnList("x,y,z,mass")).masses.empty());
+}
@@ -0,0 +1,183 @@
+#include <array>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+#include "../include/doctest.h"
+#include "../include/compactoctree.h"
+#include "../include/statistics.h"
+
+TEST_CASE("Compact Octree Layout") {
+    CHECK(sizeof(CompactNode) == 64);
+    CHECK(alignof(CompactNode) == 64);
+
+    // A few particles in distinct octants, one pair sharing an octant
+    std::vector<std::array<float, 3>> positions = {{5, 5, 6}, {-2.5, -2.5, 6}, {-7.5, -7.5, 6}, {4, -3, -2}, {-1, 2, -8}};
+    std::vector<float> masses = {1, 2, 3, 4, 5};
+    CompactOctree tree(1);
+    tree.build(positions, masses);
+
+    // The root holds everything, with the total mass and center of mass
+    const CompactNode& root = tree.nodes[0];
+    CHECK(root.begin == 0);
+    CHECK(root.end == 5);
+    CHECK(root.mass == doctest::Approx(15));
+    std::array<float, 3> centerOfMass = {0, 0, 0};
+    for (int i = 0; i < 5; i++) {
+        for (int k = 0; k < 3; k++) {
+            centerOfMass[k] += masses[i] * positions[i][k] / 15;
+        }
+    }
+    for (int k = 0; k < 3; k++) {
+        CHECK(root.centerOfMass[k] == doctest::Approx(centerOfMass[k]));
+    }
+
+    // Every leaf holds one particle, its range points at it in the sorted copy, and the slots invert the order
+    int nLeaves = 0;
+    for (const CompactNode& node : tree.nodes) {
+        if (node.childMask == 0) {
+            nLeaves++;
+            CHECK(node.end - node.begin == 1);
+            CHECK(tree.positions[node.begin] == node.centerOfMass);
+            CHECK(node.bmax == 0);
+        } else {
+            // Children are contiguous and partition the parent's range
+            int nChildren = tree.getChildCount(node);
+            CHECK(tree.nodes[node.firstChild].begin == node.begin);
+            CHECK(tree.nodes[node.firstChild + nChildren - 1].end == node.end);
+            for (int c = 0; c < nChildren; c++) {
+                const CompactNode& child = tree.nodes[node.firstChild + c];
+                CHECK(child.halfWidth == doctest::Approx(node.halfWidth / 2));
+                CHECK(child.depth == node.depth + 1);
+                CHECK(child.bmax <= node.bmax);
+            }
+        }
+    }
+    CHECK(nLeaves == 5);
+    for (int i = 0; i < 5; i++) {
+        CHECK(tree.order[tree.slots[i]] == i);
+        CHECK(tree.positions[tree.slots[i]] == positions[i]);
+        CHECK(tree.masses[tree.slots[i]] == masses[i]);
+    }
+
+    // Leaves hold up to leafSize particles, and coincident particles stop at the depth limit
+    std::vector<std::array<float, 3>> crowded(20, {1, 1, 1});
+    crowded.push_back({-1, -1, -1});
+    CompactOctree bucketTree(4);
+    bucketTree.build(crowded, std::vector<float>(21, 1));
+    for (const CompactNode& node : bucketTree.nodes) {
+        CHECK((node.childMask != 0 || node.end - node.begin <= 4 || node.depth == CompactOctree::maxDepth));
+    }
+
+    // The root quadrupole matches a direct sum over the particles
+    tree.computeQuadrupoles();
+    REQUIRE(tree.quadrupoles.size() == tree.nodes.size());
+    float qxy = 0;
+    for (int i = 0; i < 5; i++) {
+        qxy += masses[i] * 3 * (positions[i][0] - centerOfMass[0]) * (positions[i][1] - centerOfMass[1]);
+    }
+    CHECK(tree.quadrupoles[0][3] == doctest::Approx(qxy).epsilon(1E-4));
+
+    CHECK_THROWS_AS(CompactOctree(0), std::invalid_argument);
+    CHECK_THROWS_AS(tree.build(positions, {1, 2}), std::invalid_argument);
+}
+
+TEST_CASE("Compact Octree Queries") {
+    // Random particles in a unit cube, against brute force
+    CounterRNG rng(7);
+    std::vector<std::array<float, 3>> positions(500);
+    for (int i = 0; i < 500; i++) {
+        positions[i] = {static_cast<float>(rng.uniform(i, 0)), static_cast<float>(rng.uniform(i, 1)), static_cast<float>(rng.uniform(i, 2))};
+    }
+    CompactOctree tree(4);
+    tree.build(positions, std::vector<float>(500, 1));
+
+    auto getDistance2 = [&](const std::array<float, 3>& a, const std::array<float, 3>& b, float period) {
+        float distance2 = 0;
+        for (int k = 0; k < 3; k++) {
+            float d = b[k] - a[k];
+            if (period > 0) {
+                d -= period * std::round(d / period);
+            }
+            distance2 += d * d;
+        }
+        return distance2;
+    };
+
+    std::vector<std::array<float, 3>> centers = {{0.5, 0.5, 0.5}, {0.02, 0.97, 0.1}, {1.3, 0.2, 0.4}};
+    for (const std::array<float, 3>& center : centers) {
+        // Radius query: the same set as brute force
+        std::vector<int> expected;
+        for (int i = 0; i < 500; i++) {
+            if (getDistance2(center, positions[i], 0) <= 0.2f * 0.2f) {
+                expected.push_back(i);
+            }
+        }
+        std::vector<int> found(500);
+        int count = tree.radiusQuery(center, 0.2, found.data(), 500);
+        found.resize(count);
+        std::sort(found.begin(), found.end());
+        CHECK(found == expected);
+
+        // A small buffer keeps the first results and still reports the full count
+        std::vector<int> truncated(3);
+        CHECK(tree.radiusQuery(center, 0.2, truncated.data(), 3) == count);
+
+        // k nearest: the brute-force distances in order
+        std::vector<float> distances2(500);
+        for (int i = 0; i < 500; i++) {
+            distances2[i] = getDistance2(center, positions[i], 0);
+        }
+        std::vector<float> sortedDistances2 = distances2;
+        std::sort(sortedDistances2.begin(), sortedDistances2.end());
+        std::vector<int> nearest(8);
+        std::vector<float> nearestDistances2(8);
+        CHECK(tree.kNearest(center, 8, nearest.data(), nearestDistances2.data()) == 8);
+        for (int j = 0; j < 8; j++) {
+            CHECK(nearestDistances2[j] == doctest::Approx(sortedDistances2[j]));
+            CHECK(distances2[nearest[j]] == doctest::Approx(sortedDistances2[j]));
+        }
+    }
+
+    // Box query
+    std::vector<int> inBox(500);
+    int boxCount = tree.boxQuery({0.1, 0.2, 0.3}, {0.4, 0.6, 0.5}, inBox.data(), 500);
+    int expectedBoxCount = 0;
+    for (const std::array<float, 3>& position : positions) {
+        expectedBoxCount += 0.1f <= position[0] && position[0] <= 0.4f && 0.2f <= position[1] && position[1] <= 0.6f && 0.3f <= position[2] && position[2] <= 0.5f;
+    }
+    CHECK(boxCount == expectedBoxCount);
+    CHECK(boxCount > 0);
+
+    // Batched queries match the single ones, and fill missing neighbors
+    std::vector<int> indices(centers.size() * 600);
+    std::vector<int> counts(centers.size());
+    tree.radiusQueries(centers, 0.2, 600, indices, counts, 2);
+    for (size_t q = 0; q < centers.size(); q++) {
+        std::vector<int> single(600);
+        CHECK(counts[q] == tree.radiusQuery(centers[q], 0.2, single.data(), 600));
+        CHECK(std::equal(single.begin(), single.begin() + counts[q], indices.begin() + q * 600));
+    }
+    std::vector<float> distances2(centers.size() * 600);
+    tree.kNearestQueries(centers, 600, indices, distances2, 2);
+    CHECK(indices[599] == -1);
+    CHECK(std::isinf(distances2[599]));
+    CHECK(indices[499] >= 0);
+    tree.boxQueries({{0.1, 0.2, 0.3}}, {{0.4, 0.6, 0.5}}, 600, indices, counts);
+    CHECK(counts[0] == boxCount);
+    std::vector<int> smallCounts(1);
+    CHECK_THROWS_AS(tree.radiusQueries(centers, 0.2, 600, indices, smallCounts), std::invalid_argument);
+
+    // With a period, queries see the images across the box
+    CompactOctree periodicTree(4);
+    periodicTree.period = 1;
+    periodicTree.build(positions, std::vector<float>(500, 1), {0.5, 0.5, 0.5}, 0.5);
+    int expectedCount = 0;
+    for (const std::array<float, 3>& position : positions) {
+        expectedCount += getDistance2({0.02, 0.97, 0.1}, position, 1) <= 0.2f * 0.2f;
+    }
+    std::vector<int> wrapped(500);
+    CHECK(periodicTree.radiusQuery({0.02, 0.97, 0.1}, 0.2, wrapped.data(), 500) == expectedCount);
+    CHECK(expectedCount > tree.radiusQuery({0.02, 0.97, 0.1}, 0.2, wrapped.data(), 500));
+}
@@ -0,0 +1,53 @@
+#include <string>
+#include <cstdio>
+
+#include "../include/doctest.h"
+#include "../include/csvwriter.h"
+
+TEST_CASE("CsvWriter Fixed Formatting") {
+    CsvWriter writer;
+
+    // Matches std::to_string for floats
+    float values[] = {1E10, -0.0208572, 3};
+    writer.append(0.5);
+    writer.append(values, 3);
+    writer.endRow();
+    CHECK(writer.view() == "0.500000," + std::to_string(values[0]) + "," + std::to_string(values[1]) + ",3.000000\n");
+
+    // The buffer is reused for the next row
+    writer.clear();
+    writer.append(2);
+    writer.endRow();
+    CHECK(writer.view() == "2.000000\n");
+
+    // Empty rows are just a newline
+    writer.clear();
+    writer.endRow();
+    CHECK(writer.view() == "\n");
+}
+
+TEST_CASE("CsvWriter Shortest Formatting") {
+    CsvWriter writer(true);
+    writer.append(0.1f);
+    writer.append(1E-20f);
+    writer.append(123456.79f);
+    writer.endRow();
+    CHECK(writer.view() == "0.1,1e-20,123456.79\n");
+
+    // Shortest output round-trips exactly
+    float value = 0.0208572f;
+    writer.clear();
+    writer.append(value);
+    float parsed;
+    sscanf(std::string(writer.view()).c_str(), "%f", &parsed);
+    CHECK(parsed == value);
+}
+
+TEST_CASE("CsvWriter Grows") {
+    CsvWriter writer;
+    for (int i = 0; i < 10000; i++) {
+        writer.append(-3.4E38f);
+    }
+    writer.endRow();
+    CHECK(writer.view().size() == 10000 * (std::to_string(-3.4E38f).size() + 1));
+}
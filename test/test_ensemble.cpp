@@ -0,0 +1,78 @@
+#include <vector>
+#include <array>
+#include <map>
+#include <memory>
+#include <string>
+#include <fstream>
+#include <cmath>
+
+#include "../include/doctest.h"
+#include "../include/ensemble.h"
+#include "../include/environment.h"
+#include "../include/particle.h"
+
+TEST_CASE("Ensemble Matches Separate Environments") {
+    // 11 realizations fill one batch and part of a second
+    Ensemble ensemble("ensemble.yaml", 100, 11, false);
+    CHECK(ensemble.nParticles == 3);
+    CHECK(ensemble.nBatches == 2);
+    std::vector<double> initialEnergies = ensemble.getEnergies();
+    for (int i = 0; i < 200; i++) {
+        ensemble.step(0.01);
+    }
+    CHECK(ensemble.time == doctest::Approx(2));
+
+    // Each realization follows the same trajectory as a leapfrog environment sampled with its seed
+    std::map<std::string, std::map<std::string, std::string>> configMap = loadConfig("ensemble.yaml");
+    std::vector<double> energies = ensemble.getEnergies();
+    for (int realization : {0, 7, 8, 10}) {
+        ParticleCatalog sample = sampleParticles(configMap, 3, 100 + realization);
+        std::vector<std::shared_ptr<Particle>> particlePtrs;
+        for (int i = 0; i < 3; i++) {
+            particlePtrs.push_back(std::make_shared<Particle>(&sample.positions[i], &sample.velocities[i], sample.masses[i]));
+        }
+        GravitationalEnvironment<Particle> env(particlePtrs, false);
+        env.applyGlobalConfig({{"integrator", "leapfrog"}, {"softening", "plummer"}, {"softeningLength", "0.1"}, {"diagnosticsInterval", "1"}});
+        for (int i = 0; i < 200; i++) {
+            env.step(0.01);
+        }
+        for (int i = 0; i < 3; i++) {
+            CHECK(ensemble.getMass(realization, i) == sample.masses[i]);
+            CHECK(getEuclidianDistance(ensemble.getPosition(realization, i), particlePtrs[i]->position) < 1E-3);
+            CHECK(getEuclidianDistance(ensemble.getVelocity(realization, i), particlePtrs[i]->velocity) < 1E-3);
+        }
+        CHECK(energies[realization] == doctest::Approx(env.getDiagnostics().totalEnergy).epsilon(1E-3));
+        CHECK(energies[realization] == doctest::Approx(initialEnergies[realization]).epsilon(1E-2));
+    }
+
+    // A realization depends only on its seed, not on the rest of the ensemble or the thread count
+    Ensemble shifted("ensemble.yaml", 107, 2, false);
+    shifted.nThreads = 1;
+    for (int i = 0; i < 200; i++) {
+        shifted.step(0.01);
+    }
+    for (int i = 0; i < 3; i++) {
+        CHECK(shifted.getPosition(0, i) == ensemble.getPosition(7, i));
+    }
+
+    CHECK_THROWS_AS(Ensemble("ensemble.yaml", 0, 0, false), std::invalid_argument);
+    CHECK_THROWS_AS(Ensemble("catalog.yaml", 0, 4, false), std::invalid_argument);
+}
+
+TEST_CASE("Ensemble Log") {
+    Ensemble ensemble("ensemble.yaml", 0, 3, true, "ensemble_test");
+    std::string header = ensemble.getLogHeader();
+    CHECK(header.substr(0, 38) == "Time,realization,energy,mass0,x0,y0,z0");
+    CHECK(header.find("vz2\n") != std::string::npos);
+
+    ensemble.simulate(0.1, 0.05);
+    std::ifstream logFile(ensemble.logFileName);
+    std::string line;
+    int nLines = 0;
+    while (std::getline(logFile, line)) {
+        nLines++;
+    }
+
+    // The header and one row per realization at t = 0, 0.05 and 0.1
+    CHECK(nLines == 1 + 3 * 3);
+}
@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <array>
 #include <vector>
 #include <random>
+#include <map>
 #include <sstream>
 #include <iostream>
 #include <math.h>
@@ -8,6 +10,7 @@
 #include "../include/doctest.h" 
 #include "../include/particle.h"
 #include "../include/environment.h"
+#include "../include/trajectory.h"
 
 
 //////////// SETUP TESTABLE INSTANCES ////////////
@@ -36,6 +39,30 @@ GravitationalEnvironment<Particle> env1(particles, true);
 GravitationalEnvironment<Particle> env2(particles, true, "funPrefix");
 
 
+// Particles of a Plummer sphere (configs/plummer.yaml) sampled from 'seed'
+std::vector<std::shared_ptr<Particle>> getPlummerParticles(int nParticles, uint64_t seed) {
+    std::map<std::string, std::map<std::string, std::string>> configMap = loadConfig("plummer.yaml");
+    ParticleCatalog sample = sampleParticles(configMap, nParticles, seed);
+    std::vector<std::shared_ptr<Particle>> particlePtrs;
+    for (int i = 0; i < nParticles; i++) {
+        particlePtrs.push_back(std::make_shared<Particle>(&sample.positions[i], &sample.velocities[i], sample.masses[i]));
+    }
+    return particlePtrs;
+}
+
+// Relative force errors against a reference (e.g. direct summation), in increasing order
+std::vector<float> getForceErrors(const std::vector<std::array<float, 3>>& forces, const std::vector<std::array<float, 3>>& reference) {
+    std::vector<float> errors;
+    for (size_t i = 0; i < forces.size(); i++) {
+        errors.push_back(getEuclidianDistance(forces[i], reference[i]) / getEuclidianDistance(reference[i], {0, 0, 0}));
+    }
+    std::sort(errors.begin(), errors.end());
+    return errors;
+}
+
+float getMedianForceError(const std::vector<std::array<float, 3>>& forces, const std::vector<std::array<float, 3>>& reference) {
+    return getForceErrors(forces, reference)[forces.size() / 2];
+}
 
 //////////// TEST CASES ////////////
 TEST_CASE("Environment Initialization") {
@@ -293,4 +320,815 @@ TEST_CASE("Barnes-Hut Algorithm Force Calculation") {
     CHECK(forces[2][1] - (-1 * _G * -7 / 48.) < 1E-7);
     CHECK(forces[2][2] - (-1 * _G * -7 / 48.) < 1E-7);
 
-}
\ No newline at end of file
+}
+
+TEST_CASE("Environment Diagnostics") {
+
+    // Two particles on a circular orbit about their center of mass
+    float diagMass = 1E10;
+    float separation = 4;
+    float orbitalSpeed = sqrt(_G * diagMass / (2 * separation));
+    std::array<float, 3> diag_pos1 = {-separation / 2, 0, 0};
+    std::array<float, 3> diag_pos2 = {separation / 2, 0, 0};
+    std::array<float, 3> diag_velo1 = {0, -orbitalSpeed, 0};
+    std::array<float, 3> diag_velo2 = {0, orbitalSpeed, 0};
+    auto diag1Ptr = std::make_shared<Particle>(&diag_pos1, &diag_velo1, diagMass);
+    auto diag2Ptr = std::make_shared<Particle>(&diag_pos2, &diag_velo2, diagMass);
+    std::vector<std::shared_ptr<Particle>> diagParticles = {diag1Ptr, diag2Ptr};
+
+    for (std::string algorithm : {"pair-wise", "Barnes-Hut"}) {
+        GravitationalEnvironment<Particle> diagEnv(diagParticles, false, "run", algorithm);
+        diagEnv.diagnosticsInterval = 2;
+        diagEnv.getForces(0);
+        EnvironmentDiagnostics diag = diagEnv.getDiagnostics();
+
+        // Energies and the virial ratio of a circular orbit
+        double kinetic = diagMass * orbitalSpeed * orbitalSpeed;
+        double potential = -_G * diagMass * diagMass / separation;
+        CHECK(diag.kineticEnergy == doctest::Approx(kinetic).epsilon(1E-5));
+        CHECK(diag.potentialEnergy == doctest::Approx(potential).epsilon(1E-5));
+        CHECK(diag.totalEnergy == doctest::Approx(kinetic + potential).epsilon(1E-5));
+        CHECK(diag.virialRatio == doctest::Approx(1).epsilon(1E-4));
+
+        // Momenta
+        CHECK(std::abs(diag.momentum[0]) < 1E-6);
+        CHECK(std::abs(diag.momentum[1]) < 1E-6);
+        CHECK(diag.angularMomentum[2] == doctest::Approx(diagMass * orbitalSpeed * separation).epsilon(1E-5));
+
+        // Diagnostics are recorded at the requested cadence
+        for (int i = 0; i < 5; i++) {
+            diagEnv.step(0.1);
+        }
+        CHECK(diagEnv.diagnostics.size() == 3);
+        CHECK(diagEnv.diagnostics[1].time == doctest::Approx(0.2));
+        std::string diagLog = diagEnv.getDiagnosticsLog();
+        CHECK(diagLog.find("Time,kineticEnergy,potentialEnergy,totalEnergy") == 0);
+        CHECK(std::count(diagLog.begin(), diagLog.end(), '\n') == 4);
+
+        // Reset clears the time series
+        diagEnv.reset();
+        CHECK(diagEnv.diagnostics.empty());
+
+        // The cadence can be set from the global config block
+        diagEnv.applyGlobalConfig({{"diagnosticsInterval", "7"}});
+        CHECK(diagEnv.diagnosticsInterval == 7);
+
+        // Restore the particles for the next algorithm
+        diag1Ptr->position = diag_pos1;
+        diag2Ptr->position = diag_pos2;
+        diag1Ptr->velocity = diag_velo1;
+        diag2Ptr->velocity = diag_velo2;
+    }
+
+    // simulate ends with a row for the final state, from the forces the last leapfrog step left cached
+    GravitationalEnvironment<Particle> finalEnv(diagParticles, false, "run", "Barnes-Hut");
+    finalEnv.applyGlobalConfig({{"integrator", "leapfrog"}, {"diagnosticsInterval", "1"}, {"verbosity", "silent"}});
+    finalEnv.simulate(0.4, 0.1);
+    CHECK(finalEnv.diagnostics.size() == 5);
+    CHECK(finalEnv.diagnostics.back().time == doctest::Approx(0.4));
+    CHECK(finalEnv.fullWalkCount == 5);
+
+    // and the next run does not record it again
+    finalEnv.simulate(0.1, 0.1);
+    CHECK(finalEnv.diagnostics.size() == 6);
+}
+
+
+TEST_CASE("Collision Merging") {
+
+    // Two overlapping bodies and one far away
+    std::array<float, 3> col_pos1 = {0, 0, 0};
+    std::array<float, 3> col_pos2 = {1.5, 0, 0};
+    std::array<float, 3> col_pos3 = {50, 0, 0};
+    std::array<float, 3> col_velo1 = {1, 0, 0};
+    std::array<float, 3> col_velo2 = {-1, 2, 0};
+    std::array<float, 3> col_velo3 = {0, 0, 0};
+    auto col1Ptr = std::make_shared<Body>(&col_pos1, &col_velo1, 3, 1);
+    auto col2Ptr = std::make_shared<Body>(&col_pos2, &col_velo2, 1, 1);
+    auto col3Ptr = std::make_shared<Body>(&col_pos3, &col_velo3, 1, 1);
+    std::vector<std::shared_ptr<Body>> colBodies = {col1Ptr, col2Ptr, col3Ptr};
+
+    GravitationalEnvironment<Body> colEnv(colBodies, false);
+    colEnv.applyGlobalConfig({{"collisions", "merge"}});
+    CHECK(colEnv.resolveCollisions() == 1);
+
+    // Compacted, and the survivor conserves mass, momentum and volume
+    CHECK(colEnv.nParticles == 2);
+    CHECK(colEnv.particlePtrs.size() == 2);
+    CHECK(colEnv.particlePtrs[0] == col1Ptr);
+    CHECK(colEnv.particlePtrs[1] == col3Ptr);
+    CHECK(col1Ptr->mass == 4);
+    CHECK(col1Ptr->position[0] == doctest::Approx(0.375));
+    CHECK(col1Ptr->velocity[0] == doctest::Approx(0.5));
+    CHECK(col1Ptr->velocity[1] == doctest::Approx(0.5));
+    CHECK(col1Ptr->radius == doctest::Approx(cbrt(2)));
+
+    // Nothing left to merge
+    CHECK(colEnv.resolveCollisions() == 0);
+
+    // An absorbed middle body keeps its log columns, filled with NaN, and the bodies after it keep theirs
+    std::vector<std::array<float, 3>> idPositions = {{0, 0, 0}, {1, 0, 0}, {20, 0, 0}, {40, 0, 0}};
+    std::vector<std::array<float, 3>> idVelocities(4, {0, 0, 0});
+    std::vector<std::shared_ptr<Body>> idBodies;
+    for (int i = 0; i < 4; i++) {
+        idBodies.push_back(std::make_shared<Body>(&idPositions[i], &idVelocities[i], i + 1, 1));
+    }
+    GravitationalEnvironment<Body> idEnv(idBodies, false);
+    idEnv.applyGlobalConfig({{"collisions", "merge"}, {"logFields", "x"}});
+    std::string idHeader = idEnv.getLogHeader();
+    CHECK(idHeader.find("Time,x0,x1,x2,x3\n") != std::string::npos);
+    CHECK(idEnv.resolveCollisions() == 1);
+    CHECK(idEnv.nParticles == 3);
+    CHECK(idEnv.particleIds == std::vector<int>({0, 2, 3}));
+    CHECK(idEnv.getLogHeader().find("Time,x0,x1,x2,x3\n") != std::string::npos);
+    Snapshot idSnapshot;
+    idEnv.captureSnapshot(0, idSnapshot);
+    REQUIRE(idSnapshot.values.size() == 4);
+    CHECK(idSnapshot.values[0] == doctest::Approx(2.0 / 3));
+    CHECK(std::isnan(idSnapshot.values[1]));
+    CHECK(idSnapshot.values[2] == 20);
+    CHECK(idSnapshot.values[3] == 40);
+    CHECK(idEnv.getStepLog() == "0.000000,0.666667,nan,20.000000,40.000000\n");
+
+    // Without a mass column, the first row after the merge carries the new masses
+    REQUIRE(idSnapshot.masses.size() == 4);
+    CHECK(idSnapshot.masses[0] == 3);
+    CHECK(std::isnan(idSnapshot.masses[1]));
+    CHECK(idSnapshot.masses[3] == 4);
+    CHECK(idEnv.getMassLine(idSnapshot.masses) == "# mass,3.000000,nan,3.000000,4.000000\n");
+
+    // Output selection names bodies by ID
+    idEnv.applyGlobalConfig({{"outputParticles", "1-2"}});
+    idEnv.selectOutputParticles();
+    CHECK(idEnv.getLogHeader().find("Time,x2\n") != std::string::npos);
+    idEnv.captureSnapshot(0, idSnapshot);
+    CHECK(idSnapshot.values == std::vector<float>({20}));
+
+    // Invalid modes are rejected
+    CHECK_THROWS_AS(colEnv.applyGlobalConfig({{"collisions", "explode"}}), std::invalid_argument);
+}
+
+TEST_CASE("Collision Bouncing") {
+
+    // Head-on, equal mass, elastic: the velocities swap
+    std::array<float, 3> col_pos1 = {0, 0, 0};
+    std::array<float, 3> col_pos2 = {1.5, 0, 0};
+    std::array<float, 3> col_velo1 = {1, 0, 0};
+    std::array<float, 3> col_velo2 = {-1, 0, 0};
+    auto col1Ptr = std::make_shared<Body>(&col_pos1, &col_velo1, 1, 1);
+    auto col2Ptr = std::make_shared<Body>(&col_pos2, &col_velo2, 1, 1);
+    std::vector<std::shared_ptr<Body>> colBodies = {col1Ptr, col2Ptr};
+
+    GravitationalEnvironment<Body> colEnv(colBodies, false);
+    colEnv.applyGlobalConfig({{"collisions", "bounce"}, {"restitution", "1"}});
+    CHECK(colEnv.resolveCollisions() == 1);
+    CHECK(colEnv.nParticles == 2);
+    CHECK(col1Ptr->velocity[0] == doctest::Approx(-1));
+    CHECK(col2Ptr->velocity[0] == doctest::Approx(1));
+
+    // Separating bodies are left alone, and do not count as a collision
+    CHECK(colEnv.resolveCollisions() == 0);
+    CHECK(col1Ptr->velocity[0] == doctest::Approx(-1));
+    CHECK(col2Ptr->velocity[0] == doctest::Approx(1));
+
+    // A bounce keeps the cached forces, which depend on the positions only
+    colEnv.applyGlobalConfig({{"integrator", "leapfrog"}});
+    col1Ptr->velocity[0] = 1;
+    col2Ptr->velocity[0] = -1;
+    colEnv.step(1E-3);
+    CHECK(col1Ptr->velocity[0] < 0);
+    CHECK(colEnv.forcesCached);
+
+    // Point particles never collide
+    std::vector<std::shared_ptr<Particle>> points = {std::make_shared<Particle>(&col_pos1, &col_velo1, 1), std::make_shared<Particle>(&col_pos1, &col_velo2, 1)};
+    GravitationalEnvironment<Particle> pointEnv(points, false);
+    pointEnv.collisionMode = "merge";
+    CHECK(pointEnv.resolveCollisions() == 0);
+}
+
+
+TEST_CASE("Softened Forces") {
+
+    float softMass = 1E10;
+    std::array<float, 3> soft_pos1 = {0, 0, 0};
+    std::array<float, 3> soft_pos2 = {4, 0, 0};
+    std::array<float, 3> soft_velo = {0, 0, 0};
+    std::vector<std::shared_ptr<Particle>> softParticles = {std::make_shared<Particle>(&soft_pos1, &soft_velo, softMass), std::make_shared<Particle>(&soft_pos2, &soft_velo, softMass)};
+
+    // Plummer softening of 3 at a separation of 4: F = G m^2 4 / 5^3
+    for (std::string algorithm : {"pair-wise", "Barnes-Hut"}) {
+        GravitationalEnvironment<Particle> softEnv(softParticles, false, "run", algorithm);
+        softEnv.applyGlobalConfig({{"softening", "plummer"}, {"softeningLength", "3"}});
+        std::vector<std::array<float, 3>> forces = softEnv.getForces(0);
+
+        CHECK(forces[0][0] == doctest::Approx(_G * softMass * softMass * 4 / 125));
+        CHECK(forces[1][0] == doctest::Approx(-_G * softMass * softMass * 4 / 125));
+        CHECK(forces[0][1] == 0);
+
+        // The potential energy uses the same kernel
+        CHECK(softEnv.getDiagnostics().potentialEnergy == doctest::Approx(-_G * softMass * softMass / 5));
+    }
+}
+
+
+TEST_CASE("Periodic Boundaries") {
+
+    float boxMass = 1E10;
+    std::array<float, 3> box_pos1 = {2, 5, 5};
+    std::array<float, 3> box_pos2 = {7, 5, 5};
+    std::array<float, 3> box_pos3 = {9, 5, 5};
+    std::array<float, 3> box_velo = {0, 0, 0};
+
+    for (std::string algorithm : {"pair-wise", "Barnes-Hut"}) {
+
+        // Two particles half a box apart feel no net force
+        std::vector<std::shared_ptr<Particle>> boxParticles = {std::make_shared<Particle>(&box_pos1, &box_velo, boxMass), std::make_shared<Particle>(&box_pos2, &box_velo, boxMass)};
+        GravitationalEnvironment<Particle> boxEnv(boxParticles, false, "run", algorithm);
+        boxEnv.applyGlobalConfig({{"boundary", "periodic"}, {"boxSize", "10"}});
+        std::vector<std::array<float, 3>> forces = boxEnv.getForces(0);
+        CHECK(std::abs(forces[0][0]) < 1E-3 * _G * boxMass * boxMass / 25);
+        CHECK(std::abs(forces[1][0]) < 1E-3 * _G * boxMass * boxMass / 25);
+
+        // The nearest image is across the boundary: 9 -> 2 is a separation of +3
+        std::vector<std::shared_ptr<Particle>> wrapParticles = {std::make_shared<Particle>(&box_pos1, &box_velo, boxMass), std::make_shared<Particle>(&box_pos3, &box_velo, boxMass)};
+        GravitationalEnvironment<Particle> wrapEnv(wrapParticles, false, "run", algorithm);
+        wrapEnv.applyGlobalConfig({{"boundary", "periodic"}, {"boxSize", "10"}});
+        forces = wrapEnv.getForces(0);
+        CHECK(forces[0][0] < 0);
+        CHECK(forces[1][0] > 0);
+        CHECK(forces[0][0] == doctest::Approx(-forces[1][0]));
+    }
+
+    // Particles are wrapped back into the box after a step
+    std::array<float, 3> escaping_velo = {3, 0, -4};
+    std::vector<std::shared_ptr<Particle>> escaping = {std::make_shared<Particle>(&box_pos3, &escaping_velo, 1)};
+    GravitationalEnvironment<Particle> escapeEnv(escaping, false);
+    escapeEnv.applyGlobalConfig({{"boundary", "periodic"}, {"boxSize", "10"}});
+    escapeEnv.step(2);
+    CHECK(escaping[0]->position[0] == doctest::Approx(5));
+    CHECK(escaping[0]->position[2] == doctest::Approx(7));
+
+    // A box size is required
+    CHECK_THROWS_AS(escapeEnv.applyGlobalConfig({{"boundary", "periodic"}}), std::invalid_argument);
+    CHECK_THROWS_AS(escapeEnv.applyGlobalConfig({{"boundary", "spherical"}}), std::invalid_argument);
+}
+
+
+TEST_CASE("Seeded Config Is Reproducible") {
+
+    // Two environments from the same seed are identical
+    GravitationalEnvironment<Particle> seededEnv1("seeded.yaml", false);
+    GravitationalEnvironment<Particle> seededEnv2("seeded.yaml", false);
+    CHECK(seededEnv1.seed == 12345);
+    CHECK(seededEnv1.nThreads == 4);
+    CHECK(seededEnv1.nParticles == 500);
+
+    bool identical = true;
+    for (int i = 0; i < seededEnv1.nParticles; i++) {
+        identical &= seededEnv1.particlePtrs[i]->position == seededEnv2.particlePtrs[i]->position;
+        identical &= seededEnv1.particlePtrs[i]->velocity == seededEnv2.particlePtrs[i]->velocity;
+    }
+    CHECK(identical);
+
+    // The properties use independent streams
+    CHECK(seededEnv1.particlePtrs[0]->position[0] != seededEnv1.particlePtrs[0]->velocity[0]);
+}
+
+
+TEST_CASE("Load Phase-Space Model From Config") {
+    GravitationalEnvironment<Particle> modelEnv("plummer.yaml", false);
+    CHECK(modelEnv.nParticles == 1000);
+    CHECK(modelEnv.particlePtrs[0]->mass == doctest::Approx(1E6));
+    CHECK(modelEnv.softening.type == "plummer");
+
+    // Starts near virial equilibrium
+    modelEnv.getForces(0);
+    CHECK(modelEnv.getDiagnostics().virialRatio == doctest::Approx(1).epsilon(0.15));
+}
+
+
+TEST_CASE("Load Particles From Catalog") {
+    GravitationalEnvironment<Body> catalogEnv("catalog.yaml", false);
+    CHECK(catalogEnv.nParticles == 4);
+    CHECK(catalogEnv.particlePtrs[1]->position[0] == doctest::Approx(1.5E11));
+    CHECK(catalogEnv.particlePtrs[1]->velocity[1] == doctest::Approx(29780));
+    CHECK(catalogEnv.particlePtrs[3]->mass == doctest::Approx(1.9E27));
+
+    // Bodies keep the catalog radius
+    CHECK(catalogEnv.particlePtrs[0]->radius == doctest::Approx(7E8));
+}
+
+
+TEST_CASE("Log Field Selection") {
+    std::array<float, 3> log_pos = {1, 2, 3};
+    std::array<float, 3> log_velo = {-1, 0.5, 0};
+    std::vector<std::shared_ptr<Particle>> logParticles = {std::make_shared<Particle>(&log_pos, &log_velo, 2), std::make_shared<Particle>(&log_velo, &log_pos, 4)};
+    GravitationalEnvironment<Particle> logEnv(logParticles, false);
+
+    // Default rows match the header
+    CHECK(logEnv.getStepLog() == "0.000000,2.000000,1.000000,2.000000,3.000000,-1.000000,0.500000,0.000000,4.000000,-1.000000,0.500000,0.000000,1.000000,2.000000,3.000000\n");
+
+    // A subset of fields, written at shortest round-trip precision
+    logEnv.applyGlobalConfig({{"logFields", "x,vy"}, {"logPrecision", "shortest"}});
+    CHECK(logEnv.getLogHeader() == "# mass,2,4\nTime,x0,vy0,x1,vy1\n");
+    CHECK(logEnv.getStepLog() == "0,1,0.5,-1,2\n");
+
+    CHECK_THROWS_AS(logEnv.applyGlobalConfig({{"logFields", "x,speed"}}), std::invalid_argument);
+    CHECK_THROWS_AS(logEnv.applyGlobalConfig({{"logPrecision", "scientific"}}), std::invalid_argument);
+}
+
+TEST_CASE("Console Verbosity") {
+    std::array<float, 3> quiet_pos = {0, 0, 0};
+    std::array<float, 3> quiet_velo = {1, 0, 0};
+    std::vector<std::shared_ptr<Particle>> quietParticles = {std::make_shared<Particle>(&quiet_pos, &quiet_velo, 1)};
+    GravitationalEnvironment<Particle> quietEnv(quietParticles, false);
+
+    // Redirect std::cout to a stringstream
+    std::stringstream buffer;
+    std::streambuf* prevCoutStreamBuf = std::cout.rdbuf();
+    std::cout.rdbuf(buffer.rdbuf());
+
+    // Silent runs print nothing
+    quietEnv.applyGlobalConfig({{"verbosity", "silent"}});
+    quietEnv.simulate(2, 1);
+    std::string silentOutput = buffer.str();
+
+    // Progress runs print status lines but no rows
+    buffer.str("");
+    quietEnv.applyGlobalConfig({{"verbosity", "progress"}});
+    quietEnv.simulate(2, 1);
+    std::string progressOutput = buffer.str();
+
+    // Full runs echo the header and every row
+    buffer.str("");
+    quietEnv.applyGlobalConfig({{"verbosity", "full"}});
+    quietEnv.simulate(2, 1);
+    std::string fullOutput = buffer.str();
+
+    std::cout.rdbuf(prevCoutStreamBuf);
+
+    CHECK(silentOutput.empty());
+    CHECK(progressOutput.find("step 2/2") != std::string::npos);
+    CHECK(progressOutput.find("Time") == std::string::npos);
+    CHECK(fullOutput.find("Time,mass0,x0") == 0);
+    CHECK(std::count(fullOutput.begin(), fullOutput.end(), '\n') == 4);
+
+    CHECK_THROWS_AS(quietEnv.applyGlobalConfig({{"verbosity", "loud"}}), std::invalid_argument);
+}
+
+TEST_CASE("Progress Line") {
+    CHECK(formatProgress(50, 200, 2.5, 10, std::nan("")) == "step 50/200  t=2.5  5.0 steps/s  ETA 30.0 s\n");
+    CHECK(formatProgress(200, 200, 10, 40, 1.5E-6) == "step 200/200  t=10  5.0 steps/s  ETA 0.0 s  dE/E=1.500e-06\n");
+}
+
+TEST_CASE("Trajectory Output") {
+    std::array<float, 3> trajectory_pos1 = {0, 0, 0};
+    std::array<float, 3> trajectory_pos2 = {1, 0, 0};
+    std::array<float, 3> trajectory_velo = {0, 0, 0};
+    std::vector<std::shared_ptr<Particle>> trajectoryParticles = {std::make_shared<Particle>(&trajectory_pos1, &trajectory_velo, 1), std::make_shared<Particle>(&trajectory_pos2, &trajectory_velo, 1)};
+    GravitationalEnvironment<Particle> trajectoryEnv(trajectoryParticles, false);
+    trajectoryEnv.applyGlobalConfig({{"outputFormat", "trajectory"}, {"verbosity", "silent"}, {"logFields", "x,vx"}});
+    trajectoryEnv.log = true;
+    trajectoryEnv.logFileName = "test_environment_trajectory.csv";
+    trajectoryEnv.simulate(2, 1);
+
+    // The trajectory replaces the csv and holds the same rows
+    TrajectoryReader reader("test_environment_trajectory.htrj");
+    CHECK(reader.getNSteps() == 3);
+    CHECK(reader.getTime(2) == 2);
+    CHECK(reader.readField(2, "x")[0] == trajectoryParticles[0]->position[0]);
+    CHECK(reader.readField(2, "vx", 1, 2)[0] == trajectoryParticles[1]->velocity[0]);
+    std::remove("test_environment_trajectory.htrj");
+
+    CHECK_THROWS_AS(trajectoryEnv.applyGlobalConfig({{"outputFormat", "hdf5"}}), std::invalid_argument);
+}
+
+TEST_CASE("Output Selection") {
+    std::vector<std::array<float, 3>> select_pos(10);
+    std::array<float, 3> select_velo = {0, 0, 0};
+    std::vector<std::shared_ptr<Particle>> selectParticles;
+    for (int i = 0; i < 10; i++) {
+        select_pos[i] = {static_cast<float>(i), 0, 0};
+        selectParticles.push_back(std::make_shared<Particle>(&select_pos[i], &select_velo, 1 + i));
+    }
+    GravitationalEnvironment<Particle> selectEnv(selectParticles, false, "run", "pair-wise");
+    selectEnv.applyGlobalConfig({{"logFields", "x,ax,potential"}, {"logPrecision", "shortest"}, {"outputParticles", "1-3,7"}, {"outputRegion", "2,-1,-1,100,1,1"}});
+    selectEnv.selectOutputParticles();
+
+    // Particles 2, 3 and 7 are in both the ranges and the region; their masses move to a comment line
+    CHECK(selectEnv.getLogHeader() == "# mass,3,4,8\nTime,x2,ax2,potential2,x3,ax3,potential3,x7,ax7,potential7\n");
+
+    // Accelerations and potentials are those of the logged positions
+    selectEnv.recordAccelerations(selectEnv.getForces(1));
+    Snapshot snapshot;
+    selectEnv.captureSnapshot(0, snapshot);
+    REQUIRE(snapshot.values.size() == 9);
+    CHECK(snapshot.values[0] == 2);
+    CHECK(snapshot.values[1] == doctest::Approx(selectEnv.accelerations[2][0]));
+    CHECK(snapshot.values[1] != 0);
+    CHECK(snapshot.values[8] == doctest::Approx(selectEnv.potentials[7]));
+
+    // A random tracer fraction is reproducible for a seed
+    selectEnv.outputRanges.clear();
+    selectEnv.outputRegion.clear();
+    selectEnv.applyGlobalConfig({{"outputFraction", "0.5"}});
+    selectEnv.selectOutputParticles();
+    std::string tracerHeader = selectEnv.getLogHeader();
+    selectEnv.selectOutputParticles();
+    CHECK(selectEnv.getLogHeader() == tracerHeader);
+
+    CHECK_THROWS_AS(selectEnv.applyGlobalConfig({{"outputParticles", "5-2"}}), std::invalid_argument);
+    CHECK_THROWS_AS(selectEnv.applyGlobalConfig({{"outputFraction", "0"}}), std::invalid_argument);
+    CHECK_THROWS_AS(selectEnv.applyGlobalConfig({{"outputRegion", "0,0,0"}}), std::invalid_argument);
+}
+
+TEST_CASE("Adaptive Timestep") {
+    std::array<float, 3> adaptive_pos1 = {0, 0, 0};
+    std::array<float, 3> adaptive_pos2 = {1, 0, 0};
+    std::array<float, 3> adaptive_velo = {0, 0, 0};
+    std::vector<std::shared_ptr<Particle>> adaptiveParticles = {std::make_shared<Particle>(&adaptive_pos1, &adaptive_velo, 1E9), std::make_shared<Particle>(&adaptive_pos2, &adaptive_velo, 1E9)};
+    GravitationalEnvironment<Particle> adaptiveEnv(adaptiveParticles, false, "run", "pair-wise");
+    CHECK_THROWS_AS(adaptiveEnv.applyGlobalConfig({{"timestepping", "adaptive"}}), std::invalid_argument);
+    adaptiveEnv.applyGlobalConfig({{"timestepping", "adaptive"}, {"timestepLength", "0.01"}, {"timestepEta", "0.1"}, {"verbosity", "silent"}});
+
+    // dt = eta * sqrt(length / |a|), with |a| = 2 for a unit mass feeling a force of 2
+    std::vector<std::array<float, 3>> forces = {{2E9, 0, 0}, {-2E9, 0, 0}};
+    CHECK(adaptiveEnv.chooseTimestep(forces) == doctest::Approx(0.1 * std::sqrt(0.005)));
+
+    // Bounds and the growth limit
+    adaptiveEnv.applyGlobalConfig({{"dtMax", "0.001"}});
+    CHECK(adaptiveEnv.chooseTimestep(forces) == doctest::Approx(0.001));
+    adaptiveEnv.applyGlobalConfig({{"dtMax", "0"}, {"dtMin", "0.1"}});
+    CHECK(adaptiveEnv.chooseTimestep(forces) == doctest::Approx(0.1));
+    adaptiveEnv.applyGlobalConfig({{"dtMin", "0"}});
+    adaptiveEnv.lastTimestep = 0.001;
+    CHECK(adaptiveEnv.chooseTimestep(forces) == doctest::Approx(0.002));
+    adaptiveEnv.lastTimestep = 0;
+
+    // Substeps land exactly on every output time
+    adaptiveEnv.simulate(1, 0.25);
+    CHECK(adaptiveEnv.time == 1);
+    CHECK(adaptiveEnv.stepCount > 4);
+    CHECK(adaptiveParticles[0]->position[0] > 0);
+    CHECK(adaptiveParticles[0]->position[0] == doctest::Approx(1 - adaptiveParticles[1]->position[0]));
+
+    // A step cut short by its upper limit leaves the growth limit at the controller's choice
+    float chosen = adaptiveEnv.chooseTimestep(adaptiveEnv.getForces(0));
+    CHECK(adaptiveEnv.step(1E-5) == doctest::Approx(1E-5));
+    CHECK(adaptiveEnv.lastTimestep > 1E-5);
+    CHECK(adaptiveEnv.lastTimestep == doctest::Approx(chosen).epsilon(1E-2));
+}
+
+TEST_CASE("Hermite Jerks") {
+    std::array<float, 3> jerk_pos1 = {0, 0, 0};
+    std::array<float, 3> jerk_pos2 = {1, 0.5, 0};
+    std::array<float, 3> jerk_velo1 = {0, 0, 0};
+    std::array<float, 3> jerk_velo2 = {0.2, -0.3, 0.1};
+    std::vector<std::shared_ptr<Particle>> jerkParticles = {std::make_shared<Particle>(&jerk_pos1, &jerk_velo1, 2E10), std::make_shared<Particle>(&jerk_pos2, &jerk_velo2, 1E10)};
+    GravitationalEnvironment<Particle> jerkEnv(jerkParticles, false);
+    jerkEnv.applyGlobalConfig({{"integrator", "hermite"}, {"softening", "plummer"}, {"softeningLength", "0.3"}});
+
+    // The jerk is the rate of change of the force as the particles drift
+    std::vector<std::array<float, 3>> forces0 = jerkEnv.getForces(0);
+    std::vector<std::array<float, 3>> jerks0 = jerkEnv.jerks;
+    float h = 1E-3;
+    for (int k = 0; k < 3; k++) {
+        jerkParticles[1]->position[k] += jerkParticles[1]->velocity[k] * h;
+    }
+    std::vector<std::array<float, 3>> forces1 = jerkEnv.getForces(0);
+    for (int k = 0; k < 2; k++) {
+        CHECK(jerks0[0][k] == doctest::Approx((forces1[0][k] - forces0[0][k]) / h).epsilon(1E-2));
+        CHECK(jerks0[1][k] == doctest::Approx(-jerks0[0][k]));
+    }
+
+    CHECK_THROWS_AS(jerkEnv.applyGlobalConfig({{"integrator", "rk4"}}), std::invalid_argument);
+}
+
+TEST_CASE("Integrator Orders") {
+    // A light particle on a circular orbit of radius 1 and period 2 pi (GM = 1), followed for one orbit
+    std::map<std::string, float> errors;
+    for (std::string integrator : {"euler", "leapfrog", "yoshida4", "yoshida6", "hermite"}) {
+        std::array<float, 3> orbit_pos1 = {0, 0, 0};
+        std::array<float, 3> orbit_pos2 = {1, 0, 0};
+        std::array<float, 3> orbit_velo1 = {0, 0, 0};
+        std::array<float, 3> orbit_velo2 = {0, 1, 0};
+        std::vector<std::shared_ptr<Particle>> orbitParticles = {std::make_shared<Particle>(&orbit_pos1, &orbit_velo1, 1 / _G), std::make_shared<Particle>(&orbit_pos2, &orbit_velo2, 1E-3)};
+        GravitationalEnvironment<Particle> orbitEnv(orbitParticles, false);
+        orbitEnv.applyGlobalConfig({{"integrator", integrator}});
+        for (int i = 0; i < 64; i++) {
+            orbitEnv.step(2 * M_PI / 64);
+        }
+        std::array<float, 3> relative = {orbitParticles[1]->position[0] - orbitParticles[0]->position[0], orbitParticles[1]->position[1] - orbitParticles[0]->position[1], 0};
+        errors[integrator] = getEuclidianDistance(relative, {1, 0, 0});
+    }
+
+    // Higher orders return much closer to the start after the same number of steps
+    CHECK(errors["leapfrog"] < errors["euler"] / 10);
+    CHECK(errors["yoshida4"] < errors["leapfrog"] / 10);
+    CHECK(errors["yoshida6"] < errors["yoshida4"]);
+    CHECK(errors["hermite"] < errors["leapfrog"] / 10);
+}
+
+TEST_CASE("Wisdom-Holman") {
+    // A star with GM = 1, two planets on circular orbits at radii 1 and 2 and a test particle at 1.5, with steps of
+    // 1/20 of the inner orbit for 50 orbits (leapfrog divides forces by mass, so its tracer weighs 1 kg)
+    std::map<std::string, float> energyErrors;
+    std::map<std::string, float> tracerRadius;
+    for (std::string integrator : {"leapfrog", "wisdom-holman"}) {
+        std::array<float, 3> star_pos = {0, 0, 0};
+        std::array<float, 3> star_velo = {0, 0, 0};
+        std::array<float, 3> inner_pos = {1, 0, 0};
+        std::array<float, 3> inner_velo = {0, 1, 0};
+        std::array<float, 3> outer_pos = {0, 2, 0};
+        std::array<float, 3> outer_velo = {-std::sqrt(0.5f), 0, 0};
+        std::array<float, 3> tracer_pos = {-1.5, 0, 0};
+        std::array<float, 3> tracer_velo = {0, -std::sqrt(1 / 1.5f), 0};
+        std::vector<std::shared_ptr<Particle>> systemParticles = {std::make_shared<Particle>(&star_pos, &star_velo, 1 / _G), std::make_shared<Particle>(&inner_pos, &inner_velo, 1E-4 / _G), std::make_shared<Particle>(&outer_pos, &outer_velo, 1E-4 / _G), std::make_shared<Particle>(&tracer_pos, &tracer_velo, integrator == "wisdom-holman" ? 0 : 1)};
+        GravitationalEnvironment<Particle> systemEnv(systemParticles, false);
+        systemEnv.applyGlobalConfig({{"integrator", integrator}, {"diagnosticsInterval", "1"}});
+        for (int i = 0; i < 1000; i++) {
+            systemEnv.step(2 * M_PI / 20);
+        }
+        energyErrors[integrator] = systemEnv.getEnergyError();
+        tracerRadius[integrator] = getEuclidianDistance(systemParticles[3]->position, systemParticles[0]->position);
+    }
+
+    // Only the interactions are integrated approximately
+    CHECK(energyErrors["wisdom-holman"] < 1E-5);
+    CHECK(energyErrors["wisdom-holman"] < energyErrors["leapfrog"] / 100);
+    CHECK(tracerRadius["wisdom-holman"] == doctest::Approx(1.5).epsilon(0.01));
+
+    // Periodic boxes have no central body to orbit
+    std::array<float, 3> box_pos = {0.5, 0.5, 0.5};
+    std::vector<std::shared_ptr<Particle>> boxParticles = {std::make_shared<Particle>(&box_pos, &box_pos, 1)};
+    GravitationalEnvironment<Particle> boxEnv(boxParticles, false);
+    CHECK_THROWS_AS(boxEnv.applyGlobalConfig({{"integrator", "wisdom-holman"}, {"boundary", "periodic"}, {"boxSize", "1"}}), std::invalid_argument);
+}
+
+TEST_CASE("Massless Tracers") {
+    // Tracers on circular orbits (GM = 1) at radii 1 and 2 about a central mass, under both force engines
+    for (std::string algorithm : {"pair-wise", "Barnes-Hut"}) {
+        std::array<float, 3> center_pos = {0, 0, 0};
+        std::array<float, 3> center_velo = {0, 0, 0};
+        std::array<float, 3> far_pos = {100, 0, 0};
+        std::vector<std::shared_ptr<Particle>> massiveParticles = {std::make_shared<Particle>(&center_pos, &center_velo, 1 / _G), std::make_shared<Particle>(&far_pos, &center_velo, 1)};
+        GravitationalEnvironment<Particle> tracerEnv(massiveParticles, false, "run", algorithm);
+        tracerEnv.addTracers({{1, 0, 0}, {0, 2, 0}}, {{0, 1, 0}, {-std::sqrt(0.5f), 0, 0}});
+        for (int i = 0; i < 200; i++) {
+            tracerEnv.step(2 * M_PI / 200);
+        }
+
+        // Tracers orbit without disturbing the massive particles
+        CHECK(getEuclidianDistance(tracerEnv.tracerPositions[0], {1, 0, 0}) < 0.01);
+        CHECK(getEuclidianDistance(tracerEnv.tracerPositions[1], {0, 0, 0}) == doctest::Approx(2).epsilon(0.01));
+        CHECK(tracerEnv.nParticles == 2);
+        CHECK(std::abs(massiveParticles[0]->position[0]) < 1E-8);
+    }
+
+    // A leapfrog step ends with a tree at the new positions, which the tracers walk instead of building another
+    std::array<float, 3> reuse_pos1 = {0, 0, 0};
+    std::array<float, 3> reuse_pos2 = {3, 1, 0};
+    std::array<float, 3> reuse_velo = {0, 0.1, 0};
+    std::vector<std::shared_ptr<Particle>> reuseParticles = {std::make_shared<Particle>(&reuse_pos1, &reuse_velo, 1 / _G), std::make_shared<Particle>(&reuse_pos2, &reuse_velo, 1 / _G)};
+    GravitationalEnvironment<Particle> reuseEnv(reuseParticles, false, "run", "Barnes-Hut");
+    reuseEnv.applyGlobalConfig({{"integrator", "leapfrog"}});
+    reuseEnv.addTracers({{1, 2, 0}}, {{0, 0, 0}});
+    CHECK(!reuseEnv.octreeCurrent);
+    reuseEnv.step(0.01);
+    CHECK(reuseEnv.octreeCurrent);
+    std::array<float, 3> reusedAcceleration = reuseEnv.tracerAccelerations[0];
+    reuseEnv.buildOctree();
+    reuseEnv.computeTracerAccelerations();
+    CHECK(reuseEnv.tracerAccelerations[0] == reusedAcceleration);
+
+    // Tracers load from a catalog and are logged after the massive particles
+    GravitationalEnvironment<Body> catalogEnv("tracers.yaml", false);
+    CHECK(catalogEnv.nParticles == 4);
+    CHECK(catalogEnv.tracerPositions.size() == 3);
+    CHECK(catalogEnv.tracerVelocities[1][0] == doctest::Approx(17780));
+    catalogEnv.setLogFields({"x"});
+    std::string header = catalogEnv.getLogHeader();
+    CHECK(header.find(",0.000000,0.000000,0.000000\nTime,x0,x1,x2,x3,xt0,xt1,xt2\n") != std::string::npos);
+    catalogEnv.applyGlobalConfig({{"outputRegion", "-1E12,-1E12,-1E9,1E12,1E12,1E9"}});
+    catalogEnv.selectOutputParticles();
+    CHECK(catalogEnv.getLogHeader().find("xt0,xt1\n") != std::string::npos);
+}
+
+TEST_CASE("Barnes-Hut Settings") {
+    std::vector<std::shared_ptr<Particle>> particlePtrs = getPlummerParticles(300, 1);
+    GravitationalEnvironment<Particle> env(particlePtrs, false, "run", "Barnes-Hut");
+    std::vector<std::array<float, 3>> reference = env.getForcesPairWise(0);
+
+    // With theta = 0 every node is opened, for any leaf size
+    for (std::string leafSize : {"1", "4", "16"}) {
+        env.applyGlobalConfig({{"theta", "0"}, {"leafSize", leafSize}});
+        CHECK(getMedianForceError(env.getForces(0), reference) < 1E-5);
+    }
+
+    // Quadrupole moments cut the error of the accepted nodes
+    env.applyGlobalConfig({{"theta", "0.8"}, {"leafSize", "1"}});
+    float monopoleError = getMedianForceError(env.getForces(0), reference);
+    env.applyGlobalConfig({{"multipoleOrder", "2"}});
+    float quadrupoleError = getMedianForceError(env.getForces(0), reference);
+    CHECK(monopoleError > 1E-4);
+    CHECK(quadrupoleError < 0.5 * monopoleError);
+
+    // Tracers use the same walk
+    env.addTracers({particlePtrs[0]->position}, {{0, 0, 0}});
+    env.computeTracerAccelerations();
+    CHECK(getEuclidianDistance(env.tracerAccelerations[0], {reference[0][0] / particlePtrs[0]->mass, reference[0][1] / particlePtrs[0]->mass, reference[0][2] / particlePtrs[0]->mass}) < 0.05 * getEuclidianDistance(reference[0], {0, 0, 0}) / particlePtrs[0]->mass);
+
+    CHECK_THROWS_AS(env.applyGlobalConfig({{"theta", "-1"}}), std::invalid_argument);
+    CHECK_THROWS_AS(env.applyGlobalConfig({{"leafSize", "0"}}), std::invalid_argument);
+    CHECK_THROWS_AS(env.applyGlobalConfig({{"multipoleOrder", "1"}}), std::invalid_argument);
+}
+
+TEST_CASE("Opening Criteria") {
+    std::vector<std::shared_ptr<Particle>> particlePtrs = getPlummerParticles(300, 2);
+    GravitationalEnvironment<Particle> env(particlePtrs, false, "run", "Barnes-Hut");
+    std::vector<std::array<float, 3>> reference = env.getForcesPairWise(0);
+
+    // Salmon-Warren opens everything at theta = 0, and its error shrinks with theta. bmax is at most the cell diagonal
+    // and usually far smaller, so a given theta accepts more nodes than the geometric test.
+    env.applyGlobalConfig({{"openingCriterion", "salmon-warren"}, {"theta", "0"}});
+    CHECK(getMedianForceError(env.getForces(0), reference) < 1E-5);
+    env.applyGlobalConfig({{"theta", "0.25"}});
+    float tightTheta = getMedianForceError(env.getForces(0), reference);
+    CHECK(tightTheta < 1E-2);
+    env.applyGlobalConfig({{"theta", "0.5"}});
+    CHECK(getMedianForceError(env.getForces(0), reference) > tightTheta);
+    env.buildOctree();
+    CHECK(env.envOctree.bmax > 0);
+    CHECK(env.envOctree.bmax <= getEuclidianDistance({env.envOctree.xCoords[0], env.envOctree.yCoords[0], env.envOctree.zCoords[0]}, {env.envOctree.xCoords[1], env.envOctree.yCoords[1], env.envOctree.zCoords[1]}));
+
+    // The relative criterion needs the accelerations of a previous evaluation, and falls back to the geometric one
+    // without them; its error then tracks forceAccuracy
+    env.reset();
+    env.applyGlobalConfig({{"openingCriterion", "relative"}, {"forceAccuracy", "0.001"}});
+    env.getForces(0);
+    CHECK(env.previousAccelerations.size() == 300);
+    float tightError = getMedianForceError(env.getForces(0), reference);
+    CHECK(tightError < 2E-3);
+    env.applyGlobalConfig({{"forceAccuracy", "0.05"}});
+    CHECK(getMedianForceError(env.getForces(0), reference) > tightError);
+
+    // Tracers share the acceptance test
+    env.addTracers({particlePtrs[0]->position}, {{0, 0, 0}});
+    env.computeTracerAccelerations();
+    env.computeTracerAccelerations();
+    CHECK(getEuclidianDistance(env.tracerAccelerations[0], {reference[0][0] / particlePtrs[0]->mass, reference[0][1] / particlePtrs[0]->mass, reference[0][2] / particlePtrs[0]->mass}) < 0.05 * getEuclidianDistance(reference[0], {0, 0, 0}) / particlePtrs[0]->mass);
+
+    CHECK_THROWS_AS(env.applyGlobalConfig({{"openingCriterion", "bmax"}}), std::invalid_argument);
+    CHECK_THROWS_AS(env.applyGlobalConfig({{"forceAccuracy", "0"}}), std::invalid_argument);
+}
+
+TEST_CASE("Compact Tree Layout") {
+    std::vector<std::shared_ptr<Particle>> particlePtrs = getPlummerParticles(300, 5);
+    GravitationalEnvironment<Particle> env(particlePtrs, false, "run", "Barnes-Hut");
+    std::vector<std::array<float, 3>> reference = env.getForcesPairWise(0);
+    std::vector<float> referencePotentials = env.potentials;
+
+    // Opening every node gives direct summation, for any leaf size
+    for (std::string leafSize : {"1", "8"}) {
+        env.applyGlobalConfig({{"treeLayout", "compact"}, {"theta", "0"}, {"leafSize", leafSize}});
+        CHECK(getMedianForceError(env.getForces(0), reference) < 1E-5);
+        CHECK(env.potentials[7] == doctest::Approx(referencePotentials[7]).epsilon(1E-4));
+    }
+
+    // Each criterion and multipole order is as accurate as with the pointer layout
+    for (std::string criterion : {"geometric", "salmon-warren"}) {
+        for (std::string multipoleOrder : {"0", "2"}) {
+            env.applyGlobalConfig({{"treeLayout", "pointer"}, {"theta", "0.4"}, {"openingCriterion", criterion}, {"multipoleOrder", multipoleOrder}});
+            float pointerError = getMedianForceError(env.getForces(0), reference);
+            env.applyGlobalConfig({{"treeLayout", "compact"}});
+            float compactError = getMedianForceError(env.getForces(0), reference);
+            CHECK(compactError < 2 * pointerError + 1E-5);
+        }
+    }
+
+    // The parallel walk does not depend on the thread count
+    env.applyGlobalConfig({{"nThreads", "1"}});
+    std::vector<std::array<float, 3>> serialForces = env.getForces(0);
+    env.applyGlobalConfig({{"nThreads", "3"}});
+    CHECK(env.getForces(0) == serialForces);
+
+    // Spatial queries answer with particle indices: each particle is its own nearest neighbor
+    std::vector<std::array<float, 3>> centers = {particlePtrs[3]->position, particlePtrs[42]->position};
+    std::vector<int> neighbors(2 * 4);
+    std::vector<float> distances2(2 * 4);
+    env.kNearestQueries(centers, 4, neighbors, distances2);
+    CHECK(neighbors[0] == 3);
+    CHECK(neighbors[4] == 42);
+    CHECK(distances2[0] == 0);
+    CHECK(distances2[1] <= distances2[3]);
+    std::vector<int> counts(2);
+    std::vector<int> members(2 * 300);
+    env.radiusQueries(centers, std::sqrt(distances2[3]), 300, members, counts);
+    CHECK(counts[0] >= 4);
+    env.boxQueries({{-100, -100, -100}}, {{100, 100, 100}}, 300, members, counts);
+    CHECK(counts[0] == 300);
+
+    CHECK_THROWS_AS(env.applyGlobalConfig({{"treeLayout", "linear"}}), std::invalid_argument);
+    CHECK_THROWS_AS(env.applyGlobalConfig({{"treeLayout", "compact"}, {"interactionListInterval", "2"}}), std::invalid_argument);
+}
+
+TEST_CASE("Interaction Lists") {
+    std::vector<std::shared_ptr<Particle>> particlePtrs = getPlummerParticles(300, 4);
+    GravitationalEnvironment<Particle> env(particlePtrs, false, "run", "Barnes-Hut");
+    env.applyGlobalConfig({{"theta", "0.5"}, {"leafSize", "4"}, {"interactionListInterval", "4"}, {"interactionListMargin", "0.2"}});
+
+    // Against direct summation at the positions of the moment
+    auto getMedianError = [&](const std::vector<std::array<float, 3>>& forces) {
+        return getMedianForceError(forces, env.getForcesPairWise(0));
+    };
+
+    // The first evaluation walks the tree; the next three reuse its lists as the particles move a little
+    CHECK(getMedianError(env.getForces(0)) < 2E-3);
+    CHECK(env.fullWalkCount == 1);
+    CHECK(env.interactionNodes.size() == 300);
+    for (int step = 0; step < 3; step++) {
+        for (int i = 0; i < 300; i++) {
+            particlePtrs[i]->position[i % 3] += 1E-3f * (i % 5 - 2);
+        }
+        CHECK(getMedianError(env.getForces(0)) < 2E-3);
+    }
+    CHECK(env.fullWalkCount == 1);
+    env.getForces(0);
+    CHECK(env.fullWalkCount == 2);
+
+    // A particle moved far breaks the criterion of its stored nodes, which forces a fresh walk
+    std::array<float, 3> original = particlePtrs[0]->position;
+    particlePtrs[0]->position = particlePtrs[299]->position;
+    particlePtrs[0]->position[0] += 1E-2f;
+    CHECK(getMedianError(env.getForces(0)) < 2E-3);
+    CHECK(env.fullWalkCount == 3);
+    particlePtrs[0]->position = original;
+
+    // Lists agree with the plain walk at the same positions
+    env.applyGlobalConfig({{"interactionListInterval", "0"}});
+    std::vector<std::array<float, 3>> walkForces = env.getForces(0);
+    env.applyGlobalConfig({{"interactionListInterval", "4"}, {"interactionListMargin", "0"}});
+    std::vector<std::array<float, 3>> listForces = env.getForces(0);
+    for (int i = 0; i < 300; i++) {
+        CHECK(getEuclidianDistance(listForces[i], walkForces[i]) <= 1E-4 * getEuclidianDistance(walkForces[i], {0, 0, 0}));
+    }
+
+    CHECK_THROWS_AS(env.applyGlobalConfig({{"interactionListInterval", "-1"}}), std::invalid_argument);
+    CHECK_THROWS_AS(env.applyGlobalConfig({{"interactionListMargin", "1"}}), std::invalid_argument);
+    CHECK_THROWS_AS(env.applyGlobalConfig({{"interactionListInterval", "4"}, {"boundary", "periodic"}, {"boxSize", "10"}}), std::invalid_argument);
+
+    // A collision broad phase that finds nothing leaves the lists alone
+    std::vector<std::array<float, 3>> bodyPositions = {{0, 0, 0}, {10, 0, 0}, {0, 10, 0}, {0, 0, 10}, {10, 10, 10}};
+    std::vector<std::array<float, 3>> bodyVelocities(5, {0, 0, 0});
+    std::vector<std::shared_ptr<Body>> bodyPtrs;
+    for (int i = 0; i < 5; i++) {
+        bodyPtrs.push_back(std::make_shared<Body>(&bodyPositions[i], &bodyVelocities[i], 1, 0.5));
+    }
+    GravitationalEnvironment<Body> bodyEnv(bodyPtrs, false, "run", "Barnes-Hut");
+    bodyEnv.applyGlobalConfig({{"integrator", "leapfrog"}, {"collisions", "merge"}, {"interactionListInterval", "8"}});
+    for (int step = 0; step < 4; step++) {
+        bodyEnv.step(0.01);
+    }
+    CHECK(bodyEnv.nParticles == 5);
+    CHECK(bodyEnv.fullWalkCount == 1);
+}
+
+TEST_CASE("Dual-Tree Forces") {
+    std::vector<std::shared_ptr<Particle>> particlePtrs = getPlummerParticles(400, 3);
+    GravitationalEnvironment<Particle> env(particlePtrs, false, "run", "dual-tree");
+    std::vector<std::array<float, 3>> reference = env.getForcesPairWise(0);
+    std::vector<float> referencePotentials = env.potentials;
+
+    // theta = 0 accepts no cell pair, which leaves direct summation
+    env.applyGlobalConfig({{"theta", "0"}, {"leafSize", "4"}});
+    CHECK(getForceErrors(env.getForces(0), reference)[200] < 1E-5);
+    for (int i = 0; i < 400; i++) {
+        CHECK(env.potentials[i] == doctest::Approx(referencePotentials[i]).epsilon(1E-4));
+    }
+
+    // Accepted cell pairs keep the error small, and quadrupoles reduce it further
+    env.applyGlobalConfig({{"theta", "0.3"}});
+    std::vector<std::array<float, 3>> forces = env.getForces(0);
+    std::vector<float> monopoleErrors = getForceErrors(forces, reference);
+    CHECK(monopoleErrors[200] < 1E-2);
+    CHECK(monopoleErrors[396] < 5E-2);
+    env.applyGlobalConfig({{"multipoleOrder", "2"}});
+    CHECK(getForceErrors(env.getForces(0), reference)[200] < monopoleErrors[200]);
+
+    // Every sink subtree is walked on its own, so the forces do not depend on the thread count
+    env.applyGlobalConfig({{"nThreads", "1"}});
+    std::vector<std::array<float, 3>> serialForces = env.getForces(0);
+    env.applyGlobalConfig({{"nThreads", "4"}});
+    CHECK(env.getForces(0) == serialForces);
+
+    // Total energy agrees with direct summation
+    double potential = 0, referencePotential = 0;
+    for (int i = 0; i < 400; i++) {
+        potential += env.potentials[i];
+        referencePotential += referencePotentials[i];
+    }
+    CHECK(potential == doctest::Approx(referencePotential).epsilon(1E-3));
+
+    // Periodic boxes are left to the walks that apply the Ewald correction
+    CHECK_THROWS_AS(env.applyGlobalConfig({{"boundary", "periodic"}, {"boxSize", "100"}}), std::invalid_argument);
+}
@@ -0,0 +1,42 @@
+#include <array>
+#include <cmath>
+
+#include "../include/doctest.h"
+#include "../include/ewald.h"
+
+TEST_CASE("Ewald Sums") {
+
+    // The potential correction tends to the known self-energy constant
+    CHECK(getEwaldPotentialCorrection({1E-4, 0, 0}) == doctest::Approx(2.8372975).epsilon(1E-4));
+    CHECK(getEwaldPotentialCorrection({0, 0, 0}) == doctest::Approx(2.8372975));
+
+    // Halfway across the box the images cancel the direct term: the correction is +x / |x|^3
+    std::array<double, 3> halfway = getEwaldForceCorrection({0.5, 0, 0});
+    CHECK(halfway[0] == doctest::Approx(4).epsilon(1E-4));
+    CHECK(std::abs(halfway[1]) < 1E-6);
+    CHECK(std::abs(halfway[2]) < 1E-6);
+
+    // No self force
+    std::array<double, 3> origin = getEwaldForceCorrection({0, 0, 0});
+    CHECK(origin[0] == 0);
+}
+
+TEST_CASE("Ewald Table") {
+    EwaldTable table(16);
+    float boxSize = 10;
+
+    // Interpolated values match the direct sums (scaled to the box)
+    std::array<float, 3> separation = {-2.3, 1.1, 3.7};
+    std::array<double, 3> exact = getEwaldForceCorrection({2.3 / boxSize, -1.1 / boxSize, -3.7 / boxSize});
+    std::array<float, 3> correction = table.forceCorrection(separation, boxSize);
+    for (int k = 0; k < 3; k++) {
+        CHECK(correction[k] == doctest::Approx(exact[k] / (boxSize * boxSize)).epsilon(2E-2));
+    }
+    CHECK(table.potentialCorrection(separation, boxSize) == doctest::Approx(getEwaldPotentialCorrection({0.23, 0.11, 0.37}) / boxSize).epsilon(1E-2));
+
+    // Odd symmetry of the force
+    std::array<float, 3> mirrored = table.forceCorrection({2.3, -1.1, -3.7}, boxSize);
+    for (int k = 0; k < 3; k++) {
+        CHECK(mirrored[k] == doctest::Approx(-correction[k]));
+    }
+}
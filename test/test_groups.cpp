@@ -0,0 +1,182 @@
+#include <array>
+#include <vector>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+#include "../include/doctest.h"
+#include "../include/groups.h"
+#include "../include/statistics.h"
+#include "../include/particle.h"
+#include "../include/environment.h"
+
+// Labels from linking every pair closer than the linking length, one pair at a time
+std::vector<int> getBruteForceLabels(const std::vector<std::array<float, 3>>& positions, float linkingLength, float period) {
+    int n = positions.size();
+    std::vector<int> labels(n);
+    for (int i = 0; i < n; i++) {
+        labels[i] = i;
+    }
+    for (int i = 0; i < n; i++) {
+        for (int j = i + 1; j < n; j++) {
+            float distance2 = 0;
+            for (int k = 0; k < 3; k++) {
+                float offset = positions[j][k] - positions[i][k];
+                if (period > 0) {
+                    offset -= period * std::round(offset / period);
+                }
+                distance2 += offset * offset;
+            }
+            if (distance2 <= linkingLength * linkingLength && labels[i] != labels[j]) {
+                int from = std::max(labels[i], labels[j]);
+                int to = std::min(labels[i], labels[j]);
+                for (int& label : labels) {
+                    if (label == from) {
+                        label = to;
+                    }
+                }
+            }
+        }
+    }
+    return labels;
+}
+
+TEST_CASE("Concurrent Union-Find") {
+    // Threads link a chain from both ends and the middle at once; every element ends up labelled 0
+    const int n = 10000;
+    ConcurrentUnionFind sets(n);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&sets, t]() {
+            for (int i = 0; i < n - 1; i++) {
+                int link = t % 2 == 0 ? i : n - 2 - i;
+                sets.unite(link, link + 1);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    for (int i = 0; i < n; i++) {
+        CHECK(sets.find(i) == 0);
+    }
+
+    // Separate sets keep their smallest members as labels
+    ConcurrentUnionFind pairs(6);
+    pairs.unite(5, 1);
+    pairs.unite(4, 2);
+    pairs.unite(2, 5);
+    CHECK(pairs.find(4) == 1);
+    CHECK(pairs.find(0) == 0);
+    CHECK(pairs.find(3) == 3);
+}
+
+TEST_CASE("Friends-of-Friends Groups") {
+    // Random points, open and periodic, match brute-force linking for any thread count
+    CounterRNG rng(11);
+    std::vector<std::array<float, 3>> positions(600);
+    for (int i = 0; i < 600; i++) {
+        positions[i] = {static_cast<float>(10 * rng.uniform(i, 0)), static_cast<float>(10 * rng.uniform(i, 1)), static_cast<float>(10 * rng.uniform(i, 2))};
+    }
+    std::vector<float> masses(600, 1);
+    for (float period : {0.0f, 10.0f}) {
+        CompactOctree tree(4);
+        tree.period = period;
+        if (period > 0) {
+            tree.build(positions, masses, {5, 5, 5}, 5);
+        } else {
+            tree.build(positions, masses);
+        }
+        std::vector<int> reference = getBruteForceLabels(positions, 0.8, period);
+        for (int nThreads : {1, 4}) {
+            CHECK(findFriendsOfFriends(tree, 0.8, nThreads) == reference);
+        }
+    }
+    CompactOctree tree;
+    tree.build(positions, masses);
+    CHECK_THROWS_AS(findFriendsOfFriends(tree, 0), std::invalid_argument);
+
+    // Two clumps on a lattice of spacing 0.1 plus an isolated particle; the larger clump comes first
+    std::vector<std::array<float, 3>> clumps;
+    std::vector<std::array<float, 3>> velocities;
+    std::vector<float> clumpMasses;
+    for (int i = 0; i < 27; i++) {
+        clumps.push_back({0.1f * (i % 3), 0.1f * (i / 3 % 3), 0.1f * (i / 9)});
+        velocities.push_back({i % 2 == 0 ? 1.0f : -1.0f, 2, 0});
+        clumpMasses.push_back(2);
+    }
+    for (int i = 0; i < 8; i++) {
+        clumps.push_back({5 + 0.1f * (i % 2), 0.1f * (i / 2 % 2), 0.1f * (i / 4)});
+        velocities.push_back({0, 0, 3});
+        clumpMasses.push_back(1);
+    }
+    clumps.push_back({-5, 0, 0});
+    velocities.push_back({0, 0, 0});
+    clumpMasses.push_back(1);
+    tree.build(clumps, clumpMasses);
+    std::vector<int> labels = findFriendsOfFriends(tree, 0.15);
+    std::vector<GroupProperties> groups = getGroupProperties(labels, clumps, velocities, clumpMasses, 2, 0, 1.5);
+    REQUIRE(groups.size() == 2);
+    CHECK(groups[0].time == 1.5);
+    CHECK(groups[0].group == 0);
+    CHECK(groups[0].nMembers == 27);
+    CHECK(groups[0].mass == doctest::Approx(54));
+    CHECK(groups[0].center[0] == doctest::Approx(0.1));
+    CHECK(groups[0].center[2] == doctest::Approx(0.1));
+    CHECK(groups[0].velocity[0] == doctest::Approx(1.0 / 27));
+    CHECK(groups[0].velocity[1] == doctest::Approx(2));
+    CHECK(groups[0].velocityDispersion == doctest::Approx(std::sqrt((1 - 1.0 / 729) / 3)));
+    CHECK(groups[1].nMembers == 8);
+    CHECK(groups[1].center[0] == doctest::Approx(5.05));
+    CHECK(groups[1].velocity[2] == doctest::Approx(3));
+    CHECK(groups[1].velocityDispersion == doctest::Approx(0));
+    CHECK(getGroupProperties(labels, clumps, velocities, clumpMasses, 10, 0, 0).size() == 1);
+
+    // A clump split by a periodic boundary is one group, centered across it
+    std::vector<std::array<float, 3>> split = {{0.05, 5, 5}, {9.95, 5, 5}, {9.85, 5, 5}};
+    std::vector<float> splitMasses(3, 1);
+    CompactOctree periodicTree;
+    periodicTree.period = 10;
+    periodicTree.build(split, splitMasses, {5, 5, 5}, 5);
+    groups = getGroupProperties(findFriendsOfFriends(periodicTree, 0.15), split, std::vector<std::array<float, 3>>(3, {0, 0, 0}), splitMasses, 3, 10, 0);
+    REQUIRE(groups.size() == 1);
+    CHECK(groups[0].center[0] == doctest::Approx(-0.05));
+}
+
+TEST_CASE("Group Catalogs") {
+    // Two bound pairs far apart, cataloged at every other output
+    std::vector<std::array<float, 3>> positions = {{0, 0, 0}, {0.1, 0, 0}, {10, 0, 0}, {10.1, 0, 0}, {0.05, 0.05, 0}};
+    std::vector<std::array<float, 3>> velocities(5, {0, 0, 0});
+    std::vector<std::shared_ptr<Particle>> particlePtrs;
+    for (int i = 0; i < 5; i++) {
+        particlePtrs.push_back(std::make_shared<Particle>(&positions[i], &velocities[i], i < 4 ? 1.0f : 0.5f));
+    }
+    GravitationalEnvironment<Particle> env(particlePtrs, false, "run", "Barnes-Hut");
+    CHECK_THROWS_AS(env.findGroups(), std::invalid_argument);
+    CHECK_THROWS_AS(env.applyGlobalConfig({{"linkingLength", "-1"}}), std::invalid_argument);
+    CHECK_THROWS_AS(env.applyGlobalConfig({{"groupInterval", "0"}}), std::invalid_argument);
+    CHECK_THROWS_AS(env.applyGlobalConfig({{"minGroupMembers", "0"}}), std::invalid_argument);
+    env.applyGlobalConfig({{"linkingLength", "0.5"}, {"groupInterval", "2"}, {"minGroupMembers", "2"}, {"integrator", "leapfrog"}, {"verbosity", "silent"}});
+
+    std::vector<GroupProperties> groups = env.findGroups();
+    REQUIRE(groups.size() == 2);
+    CHECK(groups[0].nMembers == 3);
+    CHECK(groups[0].mass == doctest::Approx(2.5));
+    CHECK(groups[1].nMembers == 2);
+    CHECK(groups[1].center[0] == doctest::Approx(10.05));
+
+    env.simulate(0.004, 0.001);
+    REQUIRE(env.groupCatalog.size() == 4);
+    CHECK(env.groupCatalog[0].time == doctest::Approx(0.002));
+    CHECK(env.groupCatalog[3].time == doctest::Approx(0.004));
+    std::string groupLog = env.getGroupLog();
+    CHECK(groupLog.substr(0, groupLog.find('\n')) == "Time,group,nMembers,mass,x,y,z,vx,vy,vz,velocityDispersion");
+    CHECK(std::count(groupLog.begin(), groupLog.end(), '\n') == 5);
+
+    env.reset();
+    CHECK(env.groupCatalog.empty());
+}
@@ -0,0 +1,53 @@
+#include <array>
+#include <cmath>
+
+#include "../include/doctest.h"
+#include "../include/kepler.h"
+
+// Specific orbital energy and angular momentum (z) about a mass with GM = mu
+double getOrbitEnergy(const std::array<double, 3>& position, const std::array<double, 3>& velocity, double mu) {
+    double r = std::sqrt(position[0] * position[0] + position[1] * position[1] + position[2] * position[2]);
+    return 0.5 * (velocity[0] * velocity[0] + velocity[1] * velocity[1] + velocity[2] * velocity[2]) - mu / r;
+}
+
+TEST_CASE("Stumpff Functions") {
+    // The series and closed forms agree across the switch, on both signs
+    for (double x : {0.0999, 0.1001, -0.0999, -0.1001}) {
+        std::array<double, 4> c = getStumpffFunctions(x);
+        CHECK(c[0] == doctest::Approx(x > 0 ? std::cos(std::sqrt(x)) : std::cosh(std::sqrt(-x))).epsilon(1E-12));
+        CHECK(c[1] == doctest::Approx(x > 0 ? std::sin(std::sqrt(x)) / std::sqrt(x) : std::sinh(std::sqrt(-x)) / std::sqrt(-x)).epsilon(1E-12));
+    }
+    CHECK(getStumpffFunctions(0)[2] == 0.5);
+    CHECK(getStumpffFunctions(0)[3] == doctest::Approx(1.0 / 6));
+}
+
+TEST_CASE("Kepler Drift") {
+    // A quarter of a circular orbit
+    std::array<double, 3> position = {1, 0, 0};
+    std::array<double, 3> velocity = {0, 1, 0};
+    keplerDrift(position, velocity, 1, M_PI / 2);
+    CHECK(position[0] == doctest::Approx(0).scale(1));
+    CHECK(position[1] == doctest::Approx(1));
+    CHECK(velocity[0] == doctest::Approx(-1));
+
+    // An eccentric orbit returns to pericenter after a period, taken in uneven pieces
+    std::array<double, 3> pericenter = {0.5, 0, 0};
+    std::array<double, 3> fast = {0, std::sqrt(3.0), 0};
+    position = pericenter;
+    velocity = fast;
+    for (double piece : {0.3, 2.0, 1.7, 2 * M_PI - 4.0}) {
+        keplerDrift(position, velocity, 1, piece);
+    }
+    CHECK(position[0] == doctest::Approx(0.5));
+    CHECK(position[1] == doctest::Approx(0).scale(1));
+    CHECK(velocity[1] == doctest::Approx(std::sqrt(3.0)));
+
+    // Hyperbolic orbits keep their energy and angular momentum
+    position = {1, 0, 0};
+    velocity = {0, 2, 0};
+    double energy = getOrbitEnergy(position, velocity, 1);
+    keplerDrift(position, velocity, 1, 10);
+    CHECK(getOrbitEnergy(position, velocity, 1) == doctest::Approx(energy));
+    CHECK(position[0] * velocity[1] - position[1] * velocity[0] == doctest::Approx(2));
+    CHECK(position[0] < 0);
+}
@@ -0,0 +1,130 @@
+#include <array>
+#include <vector>
+#include <map>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+#include "../include/doctest.h"
+#include "../include/models.h"
+
+const double MODEL_G = 6.6743e-11;
+
+// 2K / |W| by direct summation
+double getVirialRatio(const PhaseSpaceSample& sample) {
+    double kinetic = 0;
+    double potential = 0;
+    size_t n = sample.masses.size();
+    for (size_t i = 0; i < n; i++) {
+        const std::array<float, 3>& v = sample.velocities[i];
+        kinetic += 0.5 * sample.masses[i] * (v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        for (size_t j = i + 1; j < n; j++) {
+            double r = sqrt(pow(sample.positions[i][0] - sample.positions[j][0], 2) + pow(sample.positions[i][1] - sample.positions[j][1], 2) + pow(sample.positions[i][2] - sample.positions[j][2], 2));
+            potential -= MODEL_G * sample.masses[i] * sample.masses[j] / r;
+        }
+    }
+    return 2 * kinetic / std::abs(potential);
+}
+
+// Median distance from the origin
+double getHalfMassRadius(const PhaseSpaceSample& sample) {
+    std::vector<double> radii;
+    for (const std::array<float, 3>& x : sample.positions) {
+        radii.push_back(sqrt(x[0] * x[0] + x[1] * x[1] + x[2] * x[2]));
+    }
+    std::nth_element(radii.begin(), radii.begin() + radii.size() / 2, radii.end());
+    return radii[radii.size() / 2];
+}
+
+TEST_CASE("Plummer Model") {
+    std::map<std::string, std::string> config = {{"dist", "plummer"}, {"totalMass", "1E10"}, {"scaleRadius", "2"}};
+    PhaseSpaceSample sample = samplePhaseSpaceModel(config, 2000, 7);
+
+    CHECK(sample.positions.size() == 2000);
+    CHECK(sample.masses[0] == doctest::Approx(5E6));
+    CHECK(getHalfMassRadius(sample) == doctest::Approx(2 * 1.3048).epsilon(0.1));
+    CHECK(getVirialRatio(sample) == doctest::Approx(1).epsilon(0.1));
+
+    // Independent of the thread count
+    PhaseSpaceSample parallel = samplePhaseSpaceModel(config, 2000, 7, 5);
+    CHECK(parallel.positions == sample.positions);
+    CHECK(parallel.velocities == sample.velocities);
+}
+
+TEST_CASE("Hernquist Model") {
+    std::map<std::string, std::string> config = {{"dist", "hernquist"}, {"totalMass", "1E10"}, {"scaleRadius", "1"}};
+    PhaseSpaceSample sample = samplePhaseSpaceModel(config, 2000, 3);
+
+    // Half of the mass inside the 20a truncation
+    CHECK(getHalfMassRadius(sample) == doctest::Approx(2.062).epsilon(0.12));
+    CHECK(getVirialRatio(sample) == doctest::Approx(1).epsilon(0.12));
+}
+
+TEST_CASE("King Model") {
+
+    // The profile ends at a finite tidal radius
+    KingProfile profile = getKingProfile(6);
+    CHECK(profile.potential.back() == 0);
+    CHECK(profile.radius.back() == doctest::Approx(17.8).epsilon(0.03));
+    CHECK(std::is_sorted(profile.enclosedMass.begin(), profile.enclosedMass.end()));
+
+    std::map<std::string, std::string> config = {{"dist", "king"}, {"totalMass", "1E10"}, {"scaleRadius", "1"}, {"W0", "6"}};
+    PhaseSpaceSample sample = samplePhaseSpaceModel(config, 2000, 11);
+    CHECK(getVirialRatio(sample) == doctest::Approx(1).epsilon(0.1));
+
+    bool inside = true;
+    for (const std::array<float, 3>& x : sample.positions) {
+        inside &= sqrt(x[0] * x[0] + x[1] * x[1] + x[2] * x[2]) < 1.2 * profile.radius.back();
+    }
+    CHECK(inside);
+}
+
+TEST_CASE("Exponential Disk Model") {
+    std::map<std::string, std::string> config = {{"dist", "disk"}, {"totalMass", "1E10"}, {"scaleRadius", "2"}, {"scaleHeight", "0.1"}};
+    PhaseSpaceSample sample = samplePhaseSpaceModel(config, 4000, 5);
+
+    // Radial and vertical profiles
+    std::vector<double> cylindrical;
+    std::vector<double> heights;
+    double angularMomentum = 0;
+    for (size_t i = 0; i < sample.positions.size(); i++) {
+        const std::array<float, 3>& x = sample.positions[i];
+        const std::array<float, 3>& v = sample.velocities[i];
+        cylindrical.push_back(sqrt(x[0] * x[0] + x[1] * x[1]));
+        heights.push_back(std::abs(x[2]));
+        angularMomentum += x[0] * v[1] - x[1] * v[0];
+    }
+    std::sort(cylindrical.begin(), cylindrical.end());
+    std::sort(heights.begin(), heights.end());
+    CHECK(cylindrical[cylindrical.size() / 2] == doctest::Approx(2 * 1.6783).epsilon(0.1));
+    CHECK(heights[heights.size() / 2] == doctest::Approx(0.1 * 0.5493).epsilon(0.1));
+
+    // Rotating about +z
+    CHECK(angularMomentum > 0);
+}
+
+TEST_CASE("Cold Collapse Model") {
+    std::map<std::string, std::string> config = {{"dist", "coldCollapse"}, {"totalMass", "1E10"}, {"scaleRadius", "3"}};
+    PhaseSpaceSample sample = samplePhaseSpaceModel(config, 1000, 1);
+
+    bool inside = true;
+    bool cold = true;
+    for (size_t i = 0; i < sample.positions.size(); i++) {
+        const std::array<float, 3>& x = sample.positions[i];
+        inside &= sqrt(x[0] * x[0] + x[1] * x[1] + x[2] * x[2]) < 3.5;
+        cold &= sample.velocities[i] == std::array<float, 3>{0, 0, 0};
+    }
+    CHECK(inside);
+    CHECK(cold);
+
+    // Warm start at a requested virial ratio
+    config["virialRatio"] = "0.5";
+    CHECK(getVirialRatio(samplePhaseSpaceModel(config, 1000, 1)) == doctest::Approx(0.5).epsilon(0.15));
+}
+
+TEST_CASE("Invalid Model") {
+    CHECK(isPhaseSpaceModel("plummer"));
+    CHECK(!isPhaseSpaceModel("uniform"));
+    CHECK_THROWS_AS(samplePhaseSpaceModel({{"dist", "uniform"}, {"totalMass", "1"}}, 10, 1), std::invalid_argument);
+}
@@ -4,6 +4,7 @@
 #include <cmath>
 #include <memory>
 #include <iostream>
+#include <algorithm>
 
 #include "../include/doctest.h" 
 #include "../include/body.h"
@@ -452,3 +453,40 @@ TEST_CASE("Insert Into Each Child") {
     CHECK(testOctree.child0->child7->zCoords[1] == 5);
 
 }
+
+
+TEST_CASE("Octree Leaf Size And Quadrupoles") {
+
+    // Three bodies in one octant stay in a single leaf of size 4, and split with leaves of size 1
+    std::vector<std::array<float, 3>> leafPositions = {{1, 1, 1}, {2, 1, 1}, {4, 3, 1}, {-6, -6, -6}};
+    std::array<float, 3> leafVelocity = {0, 0, 0};
+    std::vector<std::shared_ptr<Body>> leafBodies;
+    for (std::array<float, 3>& position : leafPositions) {
+        leafBodies.push_back(std::make_shared<Body>(&position, &leafVelocity, oct_mass, radius));
+    }
+    Octree<Body> bucketOctree(xCoords, yCoords, zCoords, true, 4);
+    bucketOctree.build(leafBodies);
+    CHECK(!bucketOctree.child0->internal);
+    CHECK(bucketOctree.child0->objPtrs.size() == 3);
+    CHECK(bucketOctree.child6->objPtrs.size() == 1);
+
+    Octree<Body> splitOctree(xCoords, yCoords, zCoords, true);
+    splitOctree.build(leafBodies);
+    CHECK(splitOctree.child0->internal);
+
+    // Two equal masses at (+-1, 0, 0) about their center of mass: Q = m (4, -2, -2, 0, 0, 0)
+    std::vector<std::array<float, 3>> pairPositions = {{1, 0, 0}, {-1, 0, 0}};
+    std::vector<std::shared_ptr<Body>> pairBodies;
+    for (std::array<float, 3>& position : pairPositions) {
+        pairBodies.push_back(std::make_shared<Body>(&position, &leafVelocity, 2, radius));
+    }
+    for (int leafSize : {1, 2}) {
+        Octree<Body> pairOctree(xCoords, yCoords, zCoords, true, leafSize);
+        pairOctree.build(pairBodies);
+        pairOctree.computeQuadrupoles();
+        std::array<float, 6> expected = {8, -4, -4, 0, 0, 0};
+        for (int k = 0; k < 6; k++) {
+            CHECK(pairOctree.quadrupole[k] == doctest::Approx(expected[k]));
+        }
+    }
+}
@@ -0,0 +1,32 @@
+#include <vector>
+#include <atomic>
+
+#include "../include/doctest.h"
+#include "../include/parallel.h"
+
+TEST_CASE("Parallel For") {
+
+    // Every index is visited exactly once, for any thread count
+    for (int nThreads : {0, 1, 3, 8, 64}) {
+        std::vector<int> visits(1001, 0);
+        parallelFor(visits.size(), nThreads, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                visits[i]++;
+            }
+        });
+
+        bool once = true;
+        for (int v : visits) {
+            once &= (v == 1);
+        }
+        CHECK(once);
+    }
+
+    // Empty ranges are fine
+    std::atomic<int> calls(0);
+    parallelFor(0, 4, [&](size_t begin, size_t end) { calls += end - begin; });
+    CHECK(calls == 0);
+
+    CHECK(getThreadCount(5) == 5);
+    CHECK(getThreadCount(0) >= 1);
+}
@@ -0,0 +1,76 @@
+#include <cmath>
+#include <stdexcept>
+
+#include "../include/doctest.h"
+#include "../include/softening.h"
+
+TEST_CASE("Softening None") {
+    Softening newtonian;
+
+    CHECK(newtonian.forceFactor(4) == doctest::Approx(1. / 8));
+    CHECK(newtonian.potential(4) == doctest::Approx(-0.5));
+
+    // Coincident particles do not interact
+    CHECK(newtonian.forceFactor(0) == 0);
+    CHECK(newtonian.potential(0) == 0);
+}
+
+TEST_CASE("Softening Plummer") {
+    Softening plummer("plummer", 1);
+
+    CHECK(plummer.forceFactor(0) == doctest::Approx(1));
+    CHECK(plummer.potential(0) == doctest::Approx(-1));
+    CHECK(plummer.forceFactor(3) == doctest::Approx(1. / 8));
+    CHECK(plummer.potential(3) == doctest::Approx(-0.5));
+}
+
+TEST_CASE("Softening Spline") {
+    float length = 0.5;
+    Softening spline("spline", length);
+    float h = 2.8 * length;
+
+    // Newtonian beyond the kernel support
+    CHECK(spline.forceFactor(4) == doctest::Approx(1. / 8));
+    CHECK(spline.potential(4) == doctest::Approx(-0.5));
+
+    // Plummer-equivalent depth at the center, and finite everywhere
+    CHECK(spline.potential(0) == doctest::Approx(-1 / length));
+    CHECK(std::isfinite(spline.forceFactor(0)));
+
+    // Continuous across the kernel boundaries
+    float below = h * 0.999999;
+    CHECK(spline.forceFactor(below * below) == doctest::Approx(1 / (h * h * h)).epsilon(1E-3));
+    CHECK(spline.potential(below * below) == doctest::Approx(-1 / h).epsilon(1E-3));
+    float half = 0.5 * h;
+    float justBelow = half * 0.99999;
+    float justAbove = half * 1.00001;
+    CHECK(spline.forceFactor(justBelow * justBelow) == doctest::Approx(spline.forceFactor(justAbove * justAbove)).epsilon(1E-3));
+    CHECK(spline.potential(justBelow * justBelow) == doctest::Approx(spline.potential(justAbove * justAbove)).epsilon(1E-3));
+
+    // The force is the gradient of the potential
+    float r = 0.6 * h;
+    float dr = 1E-3;
+    float dPotential = (spline.potential((r + dr) * (r + dr)) - spline.potential((r - dr) * (r - dr))) / (2 * dr);
+    CHECK(spline.forceFactor(r * r) * r == doctest::Approx(dPotential).epsilon(1E-2));
+}
+
+TEST_CASE("Softening Invalid") {
+    CHECK_THROWS_AS(Softening("gaussian", 1), std::invalid_argument);
+    CHECK_THROWS_AS(Softening("plummer", -1), std::invalid_argument);
+
+    // A zero length is Newtonian
+    Softening zeroLength("plummer", 0);
+    CHECK(zeroLength.forceFactor(0) == 0);
+}
+
+TEST_CASE("Softening Force Derivative") {
+    // dg/d(r^2) matches a central difference for every kernel, inside and outside the spline's halves
+    for (Softening kernel : {Softening("none", 0), Softening("plummer", 0.5), Softening("spline", 0.5)}) {
+        for (float r : {0.3f, 1.0f, 2.0f}) {
+            float r2 = r * r;
+            float dr2 = 1E-3 * r2;
+            float numeric = (kernel.forceFactor(r2 + dr2) - kernel.forceFactor(r2 - dr2)) / (2 * dr2);
+            CHECK(kernel.forceFactorDerivative(r2) == doctest::Approx(numeric).epsilon(1E-2));
+        }
+    }
+}
@@ -1,6 +1,8 @@
 #include <vector>
 #include <random>
 #include <iostream>
+#include <array>
+#include <cmath>
 
 #include "../include/doctest.h"
 #include "../include/statistics.h"
@@ -67,4 +69,57 @@ TEST_CASE("Uniform") {
 
 TEST_CASE("Dummy Executable") {
     CHECK(dummyExecutable() == 0);
-}
\ No newline at end of file
+}
+
+TEST_CASE("Philox Known Answers") {
+    // Reference vectors for Philox4x32-10
+    std::array<uint32_t, 4> zeros = philox4x32({0, 0, 0, 0}, {0, 0});
+    CHECK(zeros == std::array<uint32_t, 4>{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8});
+
+    std::array<uint32_t, 4> ones = philox4x32({0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}, {0xffffffff, 0xffffffff});
+    CHECK(ones == std::array<uint32_t, 4>{0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd});
+
+    std::array<uint32_t, 4> pi = philox4x32({0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}, {0xa4093822, 0x299f31d0});
+    CHECK(pi == std::array<uint32_t, 4>{0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1});
+}
+
+TEST_CASE("Counter-Based Sampling") {
+    CounterRNG rng(2024, getStreamId("x"));
+
+    // Samples are a pure function of their index
+    CHECK(rng.uniform(17) == CounterRNG(2024, getStreamId("x")).uniform(17));
+    CHECK(rng.uniform(17) != rng.uniform(18));
+    CHECK(rng.uniform(17) != CounterRNG(2024, getStreamId("y")).uniform(17));
+    CHECK(rng.uniform(17) != CounterRNG(2025, getStreamId("x")).uniform(17));
+
+    // Parallel sampling is bit-identical to serial sampling
+    int n = 10000;
+    std::vector<float> serial = sampleNormal(n, 3, 2, rng, 1);
+    std::vector<float> parallel = sampleNormal(n, 3, 2, rng, 7);
+    CHECK(serial == parallel);
+    CHECK(sampleUniform(n, -5, 5, rng, 1) == sampleUniform(n, -5, 5, rng, 3));
+
+    // Moments
+    float mean = 0;
+    float var = 0;
+    for (float v : serial) {
+        mean += v;
+    }
+    mean /= n;
+    for (float v : serial) {
+        var += (v - mean) * (v - mean);
+    }
+    var /= n;
+    CHECK(abs(mean - 3) < 0.1);
+    CHECK(abs(sqrt(var) - 2) < 0.1);
+
+    std::vector<float> uniform = sampleUniform(n, -5, 5, rng);
+    bool inRange = true;
+    float uniformMean = 0;
+    for (float v : uniform) {
+        inRange &= ((v < 5) & (v >= -5));
+        uniformMean += v / n;
+    }
+    CHECK(inRange);
+    CHECK(abs(uniformMean) < 0.25);
+}
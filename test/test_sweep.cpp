@@ -0,0 +1,62 @@
+#include <vector>
+#include <map>
+#include <string>
+#include <fstream>
+
+#include "../include/doctest.h"
+#include "../include/sweep.h"
+
+TEST_CASE("Sweep Expansion") {
+    Sweep sweep("sweep.yaml");
+
+    // Two points, each crossed with a 2 x 2 grid, the first grid key varying slowest
+    CHECK(sweep.runs.size() == 8);
+    CHECK(sweep.overrideKeys == std::vector<std::string>({"global.softeningLength", "global.integrator", "global.nParticles", "sweep.timestep"}));
+    CHECK(sweep.runs[1].overrides.at("global.softeningLength") == "0.01");
+    CHECK(sweep.runs[1].overrides.at("global.integrator") == "yoshida4");
+    CHECK(sweep.runs[1].overrides.at("global.nParticles") == "50");
+    CHECK(sweep.runs[1].overrides.find("sweep.timestep") == sweep.runs[1].overrides.end());
+
+    std::map<std::string, std::map<std::string, std::string>> configMap = sweep.getRunConfig(sweep.runs[6]);
+    CHECK(configMap.at("global").at("softeningLength") == "0.05");
+    CHECK(configMap.at("global").at("nParticles") == "100");
+    CHECK(configMap.at("sweep").at("timestep") == "0.005");
+    CHECK(configMap.at("model").at("dist") == "plummer");
+
+    // Runs that differ only in softening and integrator share initial conditions
+    CHECK(sweep.nInitialConditions == 2);
+    CHECK(sweep.runs[3].initialConditions == sweep.runs[0].initialConditions);
+    CHECK(sweep.runs[4].initialConditions != sweep.runs[0].initialConditions);
+
+    // Cost grows with the particle count, the steps and the force evaluations per step
+    configMap["global"]["integrator"] = "leapfrog";
+    double leapfrogCost = estimateRunCost(configMap, 100);
+    configMap["global"]["integrator"] = "yoshida4";
+    CHECK(estimateRunCost(configMap, 100) == doctest::Approx(3 * leapfrogCost));
+    CHECK(estimateRunCost(configMap, 50) == doctest::Approx(estimateRunCost(configMap, 100) / 4));
+}
+
+TEST_CASE("Sweep Run") {
+    Sweep sweep("sweep.yaml");
+    sweep.run();
+
+    for (const SweepRun& sweepRun : sweep.runs) {
+        CHECK(sweepRun.error == "");
+        CHECK(sweepRun.seconds > 0);
+        CHECK(sweepRun.energyError < 1E-3);
+    }
+    CHECK(sweep.runs[4].nSteps == 20);
+    CHECK(sweep.runs[0].nSteps == 10);
+    CHECK(sweep.runs[5].estimatedCost == doctest::Approx(3 * sweep.runs[4].estimatedCost));
+
+    // The summary has a header and a row per run
+    std::ifstream summaryFile(sweep.summaryFileName);
+    std::string line;
+    std::getline(summaryFile, line);
+    CHECK(line == "run,global.softeningLength,global.integrator,global.nParticles,sweep.timestep,initialConditions,estimatedCost,steps,seconds,energyError,error");
+    int nRows = 0;
+    while (std::getline(summaryFile, line)) {
+        nRows++;
+    }
+    CHECK(nRows == 8);
+}
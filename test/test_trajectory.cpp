@@ -0,0 +1,98 @@
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+
+#include "../include/doctest.h"
+#include "../include/trajectory.h"
+#include "../include/statistics.h"
+
+TEST_CASE("LZ Codec") {
+    // Incompressible, repetitive and empty inputs all round-trip
+    CounterRNG rng(7);
+    std::vector<uint8_t> noise(5000);
+    for (size_t i = 0; i < noise.size(); i++) {
+        noise[i] = rng.bits(i, 0)[0] & 0xff;
+    }
+    std::vector<uint8_t> repetitive(70000);
+    for (size_t i = 0; i < repetitive.size(); i++) {
+        repetitive[i] = i % 300 < 200 ? 0 : i % 7;
+    }
+    for (const std::vector<uint8_t>& data : {noise, repetitive, std::vector<uint8_t>()}) {
+        std::vector<uint8_t> compressed = compressLZ(data.data(), data.size());
+        CHECK(decompressLZ(compressed.data(), compressed.size(), data.size()) == data);
+    }
+    std::vector<uint8_t> compressed = compressLZ(repetitive.data(), repetitive.size());
+    CHECK(compressed.size() < repetitive.size() / 10);
+
+    // Truncated input is rejected
+    CHECK_THROWS_AS(decompressLZ(compressed.data(), compressed.size() - 1, repetitive.size()), std::runtime_error);
+}
+
+TEST_CASE("Byte Shuffle") {
+    std::vector<uint8_t> words = {1, 2, 3, 4, 5, 6, 7, 8};
+    std::vector<uint8_t> shuffled(8);
+    std::vector<uint8_t> restored(8);
+    shuffleBytes(words.data(), 2, shuffled.data());
+    CHECK(shuffled == std::vector<uint8_t>({1, 5, 2, 6, 3, 7, 4, 8}));
+    unshuffleBytes(shuffled.data(), 2, restored.data());
+    CHECK(restored == words);
+}
+
+TEST_CASE("Trajectory Round Trip") {
+    // Slowly drifting particles over several keyframes, with a drop in particle count at step 7
+    std::string fileName = "test_trajectory.htrj";
+    std::vector<Snapshot> snapshots;
+    for (int s = 0; s < 10; s++) {
+        Snapshot snapshot;
+        snapshot.time = 0.5 * s;
+        int nParticles = s < 7 ? 1000 : 999;
+        for (int i = 0; i < nParticles; i++) {
+            snapshot.values.push_back(2);
+            snapshot.values.push_back(i + 0.001 * s * i);
+            snapshot.values.push_back(-0.25 * i);
+        }
+        snapshots.push_back(snapshot);
+    }
+    {
+        TrajectoryWriter writer(fileName, {"mass", "x", "vx"}, 64, 4);
+        for (const Snapshot& snapshot : snapshots) {
+            writer.writeStep(snapshot);
+        }
+    }
+
+    TrajectoryReader reader(fileName);
+    CHECK(reader.getNSteps() == 10);
+    CHECK(reader.getFields() == std::vector<std::string>({"mass", "x", "vx"}));
+    CHECK(reader.getTime(3) == 1.5);
+    CHECK(reader.findStep(1.2) == 3);
+    CHECK(reader.getNParticles(8) == 999);
+
+    // Every step and field reads back exactly
+    for (int s = 0; s < 10; s++) {
+        std::vector<float> x = reader.readField(s, "x");
+        REQUIRE(x.size() == snapshots[s].values.size() / 3);
+        bool exact = true;
+        for (size_t i = 0; i < x.size(); i++) {
+            exact = exact && x[i] == snapshots[s].values[3 * i + 1];
+        }
+        CHECK(exact);
+    }
+
+    // A particle range across chunk boundaries
+    std::vector<float> vx = reader.readField(6, "vx", 60, 130);
+    CHECK(vx.size() == 70);
+    CHECK(vx.front() == -15);
+    CHECK(vx.back() == -0.25 * 129);
+
+    CHECK_THROWS_AS(reader.readField(10, "x"), std::out_of_range);
+    CHECK_THROWS_AS(reader.readField(0, "vy"), std::invalid_argument);
+
+    // Constant columns and small deltas compress well below the raw size
+    std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+    CHECK(static_cast<size_t>(file.tellg()) < 10 * 1000 * 3 * 4 / 2);
+    file.close();
+    std::remove(fileName.c_str());
+}